@@ -1,10 +1,12 @@
 #include <string>
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <cstdlib>
 #include <cctype>
 #include <cstring>
+#include <cerrno>
+
+#include "fasta_reader.h"
 
 class ContigInfo {
 public:
@@ -19,27 +21,25 @@ std::ostream& operator<<(std::ostream& out, const ContigInfo& info) {
   return out;
 }
 
-std::vector<ContigInfo> count_fasta_sizes(std::istream& input) {
+// Contig length is the size of the sequence text minus its line feeds
+std::vector<ContigInfo> count_fasta_sizes(fasta_reader_t& input) {
   std::vector<ContigInfo> result;
-  std::string seq_id;
-  int seq_len = 0;
-  while (input.good()) {
-    std::string line;
-    std::getline(input, line);
-    if (line.length() > 0) {
-      if (line[0] == '>') {
-        if (seq_id.length() > 0) {
-          result.push_back(ContigInfo(seq_id, seq_len));
-        }
-        seq_id = line.substr(1);
-        seq_len = 0;
-      } else {
-        seq_len += line.length();
-      }
+  int more;
+  while ((more = fasta_next(&input)) > 0) {
+    if (input.hdr == NULL || input.hdr_len == 0) {
+      continue;
+    }
+    const char *p = input.seq, *end = input.seq + input.seq_len;
+    int seq_len = (int)input.seq_len;
+    while ((p = (const char *)memchr(p, '\n', end - p)) != NULL) {
+      --seq_len;
+      ++p;
     }
+    result.push_back(ContigInfo(std::string(input.hdr, input.hdr_len), seq_len));
   }
-  if (seq_id.length() > 0) {
-    result.push_back(ContigInfo(seq_id, seq_len));
+  if (more < 0) {
+    std::cerr << "Failed to read file: " << input.err << std::endl;
+    exit(1);
   }
   return result;
 }
@@ -56,15 +56,12 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
-  if (!strcmp(argv[1], "-")) {
-    print_sizes(count_fasta_sizes(std::cin), std::cout);
-  } else {
-    std::ifstream fasta_file(argv[1], std::ifstream::in);
-    if (fasta_file.fail()) {
-      std::cerr << "Failed to open file" << std::endl;
-      exit(1);
-    }
-    print_sizes(count_fasta_sizes(fasta_file), std::cout);
+  fasta_reader_t fasta_file;
+  if (fasta_open(&fasta_file, argv[1]) != 0) {
+    std::cerr << "Failed to open file" << std::endl;
+    exit(1);
   }
+  print_sizes(count_fasta_sizes(fasta_file), std::cout);
+  fasta_close(&fasta_file);
   return 0;
 }
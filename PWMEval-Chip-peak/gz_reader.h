@@ -0,0 +1,452 @@
+/*
+
+  Gzip decompression for the FASTA reader (fasta_reader.h), so that .gz
+  sequence files are read directly instead of being unpacked to a
+  temporary copy first.
+
+  Inflation runs in background threads, ahead of the reader, through a
+  ring of buffers.  BGZF files (bgzip, samtools) are a series of
+  independent gzip members of at most 64 KiB whose compressed size is
+  stored in their header: the input thread only cuts the blocks and
+  GZ_THREADS_MAX worker threads at most inflate them in parallel; the
+  reader takes the results in file order.  Other gzip files, with one or
+  several members, cannot be split without inflating them and are inflated
+  by the input thread alone, which still overlaps with parsing and scoring.
+
+  The compressed input is a memory block (a mapped file) or a stream, of
+  which the first bytes may already have been read (they were needed to
+  recognise the format).
+
+*/
+#ifndef GZ_READER_H
+#define GZ_READER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#define GZ_BLOCK (1 << 16)       /* Largest BGZF block, compressed or not */
+#define GZ_CHUNK (1 << 18)       /* Output buffer of the single-stream inflater */
+#define GZ_IN_CHUNK (1 << 20)    /* Read size of stream input */
+#define GZ_THREADS_MAX 4
+#define GZ_SLOTS_PER_THREAD 4
+
+enum { GZ_FREE, GZ_FULL, GZ_BUSY, GZ_DONE };
+
+typedef struct _gz_slot_t {
+  int state;
+  unsigned char *in;         /* BGZF block                         */
+  size_t in_len;
+  size_t in_hlen;            /* Length of its header               */
+  char *out;                 /* Inflated data                      */
+  size_t out_len;
+} gz_slot_t;
+
+typedef struct _gz_reader_t {
+  /* Compressed input: data[pos, len) */
+  const unsigned char *data;
+  size_t len, pos;
+  FILE *stream;              /* Rest of the input, or NULL         */
+  unsigned char *ibuf;       /* Stream buffer (data points to it)  */
+  size_t ibuf_size;
+  int bgzf;
+  /* Ring of slots: filled by the input thread, inflated by the workers
+     (BGZF) and read in order */
+  gz_slot_t *slots;
+  int nslots;
+  long filled, taken, read;
+  size_t out_pos;            /* Read offset in slot read           */
+  int finished;              /* No more slots will be filled       */
+  int stop;
+  const char *err;           /* First error, NULL if none          */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t input;
+  pthread_t workers[GZ_THREADS_MAX];
+  int nworkers;
+} gz_reader_t;
+
+static inline int
+gz_magic(const unsigned char *p, size_t n)
+{
+  return n >= 2 && p[0] == 0x1f && p[1] == 0x8b;
+}
+
+static inline unsigned long
+gz_le32(const unsigned char *p)
+{
+  return (unsigned long)p[0] | (unsigned long)p[1] << 8
+    | (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+/* Size of the BGZF block whose header is at p (n bytes available), 0 if it
+   is not one; *hlen is set to the header length */
+static inline size_t
+gz_bgzf_size(const unsigned char *p, size_t n, size_t *hlen)
+{
+  size_t xlen, i;
+
+  if (n < 12 || !gz_magic(p, n) || p[2] != 8 || !(p[3] & 4))
+    return 0;
+  xlen = (size_t)p[10] | (size_t)p[11] << 8;
+  if (n < 12 + xlen)
+    return 0;
+  for (i = 12; i + 4 <= 12 + xlen; i += 4 + ((size_t)p[i + 2] | (size_t)p[i + 3] << 8))
+    if (p[i] == 'B' && p[i + 1] == 'C' && p[i + 2] == 2 && p[i + 3] == 0 && i + 6 <= 12 + xlen) {
+      *hlen = 12 + xlen;
+      return ((size_t)p[i + 4] | (size_t)p[i + 5] << 8) + 1;
+    }
+  return 0;
+}
+
+static inline void
+gz_fail(gz_reader_t *g, const char *msg)
+{
+  pthread_mutex_lock(&g->lock);
+  if (g->err == NULL)
+    g->err = msg;
+  pthread_cond_broadcast(&g->cond);
+  pthread_mutex_unlock(&g->lock);
+}
+
+/* Make at least n compressed bytes available at data + pos, if the input
+   has them.  Returns the number of bytes available */
+static inline size_t
+gz_want(gz_reader_t *g, size_t n)
+{
+  size_t avail = g->len - g->pos;
+
+  if (avail >= n || g->stream == NULL)
+    return avail;
+  memmove(g->ibuf, g->ibuf + g->pos, avail);
+  g->pos = 0;
+  g->len = avail;
+  while (g->len < n) {
+    size_t k = g->ibuf_size - g->len;
+    k = fread(g->ibuf + g->len, 1, k < GZ_IN_CHUNK ? k : GZ_IN_CHUNK, g->stream);
+    if (k == 0) {
+      if (ferror(g->stream))
+        gz_fail(g, strerror(errno));
+      break;
+    }
+    g->len += k;
+  }
+  return g->len;
+}
+
+/* Wait for the next slot to fill; NULL if the reader is closing */
+static inline gz_slot_t *
+gz_free_slot(gz_reader_t *g)
+{
+  gz_slot_t *s = &g->slots[g->filled % g->nslots];
+
+  pthread_mutex_lock(&g->lock);
+  while (s->state != GZ_FREE && !g->stop && g->err == NULL)
+    pthread_cond_wait(&g->cond, &g->lock);
+  if (g->stop || g->err != NULL)
+    s = NULL;
+  pthread_mutex_unlock(&g->lock);
+  return s;
+}
+
+static inline void
+gz_put_slot(gz_reader_t *g, gz_slot_t *s, int state)
+{
+  pthread_mutex_lock(&g->lock);
+  s->state = state;
+  g->filled++;
+  pthread_cond_broadcast(&g->cond);
+  pthread_mutex_unlock(&g->lock);
+}
+
+/* Input thread of a BGZF file: cut it into blocks */
+static inline void
+gz_split_bgzf(gz_reader_t *g)
+{
+  gz_slot_t *s;
+  size_t size, hlen;
+
+  while (gz_want(g, 18) > 0) {
+    size = gz_bgzf_size(g->data + g->pos, gz_want(g, 12 + 0xffff), &hlen);
+    if (size == 0 || size < hlen + 8) {
+      gz_fail(g, "Invalid BGZF block");
+      return;
+    }
+    if (gz_want(g, size) < size) {
+      gz_fail(g, "Unexpected end of compressed file");
+      return;
+    }
+    if ((s = gz_free_slot(g)) == NULL)
+      return;
+    memcpy(s->in, g->data + g->pos, size);
+    s->in_len = size;
+    s->in_hlen = hlen;
+    g->pos += size;
+    gz_put_slot(g, s, GZ_FULL);
+  }
+}
+
+/* Input thread of other gzip files: inflate them, member after member */
+static inline void
+gz_inflate_stream(gz_reader_t *g)
+{
+  z_stream z;
+  gz_slot_t *s;
+  size_t avail;
+  int ret = Z_OK;
+
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, 15 + 16) != Z_OK) {
+    gz_fail(g, "Out of memory");
+    return;
+  }
+  while (ret != Z_STREAM_END) {
+    if ((s = gz_free_slot(g)) == NULL)
+      break;
+    z.next_out = (Bytef *)s->out;
+    z.avail_out = GZ_CHUNK;
+    while (z.avail_out > 0) {
+      if ((avail = gz_want(g, 1)) == 0) {
+        gz_fail(g, "Unexpected end of compressed file");
+        break;
+      }
+      if (avail > GZ_IN_CHUNK)
+        avail = GZ_IN_CHUNK;
+      z.next_in = (Bytef *)(g->data + g->pos);
+      z.avail_in = (uInt)avail;
+      ret = inflate(&z, Z_NO_FLUSH);
+      g->pos += avail - z.avail_in;
+      if (ret == Z_STREAM_END) {
+        /* Concatenated members make one stream */
+        avail = gz_want(g, 2);
+        if (!gz_magic(g->data + g->pos, avail))
+          break;
+        inflateReset(&z);
+        ret = Z_OK;
+      } else if (ret != Z_OK) {
+        gz_fail(g, z.msg ? z.msg : "Invalid compressed data");
+        break;
+      }
+    }
+    s->out_len = GZ_CHUNK - z.avail_out;
+    gz_put_slot(g, s, GZ_DONE);
+    if (g->err != NULL)
+      break;
+  }
+  inflateEnd(&z);
+}
+
+static inline void *
+gz_input_main(void *arg)
+{
+  gz_reader_t *g = (gz_reader_t *)arg;
+
+  if (g->bgzf)
+    gz_split_bgzf(g);
+  else
+    gz_inflate_stream(g);
+  pthread_mutex_lock(&g->lock);
+  g->finished = 1;
+  pthread_cond_broadcast(&g->cond);
+  pthread_mutex_unlock(&g->lock);
+  return NULL;
+}
+
+/* Inflate one BGZF block; returns an error message or NULL */
+static inline const char *
+gz_inflate_block(z_stream *z, gz_slot_t *s)
+{
+  const unsigned char *trailer = s->in + s->in_len - 8;
+  unsigned long isize = gz_le32(trailer + 4);
+
+  if (isize > GZ_BLOCK)
+    return "Invalid BGZF block";
+  inflateReset(z);
+  z->next_in = (Bytef *)(s->in + s->in_hlen);
+  z->avail_in = (uInt)(s->in_len - s->in_hlen - 8);
+  z->next_out = (Bytef *)s->out;
+  z->avail_out = GZ_BLOCK;
+  if (inflate(z, Z_FINISH) != Z_STREAM_END || z->total_out != isize)
+    return z->msg ? z->msg : "Invalid compressed data";
+  if (crc32(crc32(0L, Z_NULL, 0), (const Bytef *)s->out, (uInt)isize) != gz_le32(trailer))
+    return "Compressed data CRC error";
+  s->out_len = isize;
+  return NULL;
+}
+
+static inline void *
+gz_worker_main(void *arg)
+{
+  gz_reader_t *g = (gz_reader_t *)arg;
+  gz_slot_t *s;
+  const char *err;
+  z_stream z;
+
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, -15) != Z_OK) {
+    gz_fail(g, "Out of memory");
+    return NULL;
+  }
+  pthread_mutex_lock(&g->lock);
+  for (;;) {
+    while (g->taken == g->filled && !g->finished && !g->stop && g->err == NULL)
+      pthread_cond_wait(&g->cond, &g->lock);
+    if (g->taken == g->filled || g->stop || g->err != NULL)
+      break;
+    s = &g->slots[g->taken++ % g->nslots];
+    s->state = GZ_BUSY;
+    pthread_mutex_unlock(&g->lock);
+    err = gz_inflate_block(&z, s);
+    pthread_mutex_lock(&g->lock);
+    if (err != NULL && g->err == NULL)
+      g->err = err;
+    s->state = GZ_DONE;
+    pthread_cond_broadcast(&g->cond);
+  }
+  pthread_mutex_unlock(&g->lock);
+  inflateEnd(&z);
+  return NULL;
+}
+
+static inline int
+gz_threads(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n < 1 ? 1 : n > GZ_THREADS_MAX ? GZ_THREADS_MAX : (int)n;
+}
+
+static inline void gz_close(gz_reader_t *g);
+
+/* Start inflating a gzip input: the size bytes at data, followed by the
+   rest of stream if it is not NULL (data is then copied).  Returns NULL if
+   out of memory */
+static inline gz_reader_t *
+gz_open(const unsigned char *data, size_t size, FILE *stream)
+{
+  gz_reader_t *g = (gz_reader_t *)calloc(1, sizeof(gz_reader_t));
+  size_t hlen;
+  int i, ok = g != NULL;
+
+  if (!ok)
+    return NULL;
+  g->data = data;
+  g->len = size;
+  if (stream != NULL) {
+    g->stream = stream;
+    g->ibuf_size = size + GZ_IN_CHUNK + 2 * GZ_BLOCK;
+    ok = (g->ibuf = (unsigned char *)malloc(g->ibuf_size)) != NULL;
+    if (ok)
+      memcpy(g->ibuf, data, size);
+    g->data = g->ibuf;
+  }
+  pthread_mutex_init(&g->lock, NULL);
+  pthread_cond_init(&g->cond, NULL);
+  if (ok)
+    g->bgzf = gz_bgzf_size(g->data, gz_want(g, 12 + 0xffff), &hlen) != 0;
+  g->nworkers = g->bgzf ? gz_threads() : 0;
+  g->nslots = g->bgzf ? g->nworkers * GZ_SLOTS_PER_THREAD : GZ_SLOTS_PER_THREAD;
+  if (ok && (g->slots = (gz_slot_t *)calloc((size_t)g->nslots, sizeof(gz_slot_t))) == NULL)
+    ok = 0;
+  for (i = 0; ok && i < g->nslots; i++) {
+    if (g->bgzf)
+      ok = (g->slots[i].in = (unsigned char *)malloc(GZ_BLOCK)) != NULL;
+    if (ok)
+      ok = (g->slots[i].out = (char *)malloc(g->bgzf ? GZ_BLOCK : GZ_CHUNK)) != NULL;
+  }
+  if (!ok || pthread_create(&g->input, NULL, gz_input_main, g) != 0) {
+    g->nworkers = -1;
+    gz_close(g);
+    return NULL;
+  }
+  for (i = 0; i < g->nworkers; i++)
+    if (pthread_create(&g->workers[i], NULL, gz_worker_main, g) != 0) {
+      g->nworkers = i;
+      break;
+    }
+  if (g->bgzf && g->nworkers == 0) {
+    gz_close(g);
+    return NULL;
+  }
+  return g;
+}
+
+/* Read up to n inflated bytes into buf.  Returns the number of bytes read,
+   0 at the end of the input and -1 on error (see gz_error) */
+static inline long
+gz_read(gz_reader_t *g, char *buf, size_t n)
+{
+  size_t done = 0, k;
+  gz_slot_t *s;
+
+  pthread_mutex_lock(&g->lock);
+  while (done < n) {
+    s = &g->slots[g->read % g->nslots];
+    if (g->err != NULL) {
+      pthread_mutex_unlock(&g->lock);
+      return -1;
+    }
+    if (g->read == g->filled && g->finished)
+      break;
+    if (g->read == g->filled || s->state != GZ_DONE) {
+      pthread_cond_wait(&g->cond, &g->lock);
+      continue;
+    }
+    k = s->out_len - g->out_pos;
+    if (k > n - done)
+      k = n - done;
+    pthread_mutex_unlock(&g->lock);
+    memcpy(buf + done, s->out + g->out_pos, k);
+    done += k;
+    g->out_pos += k;
+    pthread_mutex_lock(&g->lock);
+    if (g->out_pos == s->out_len) {
+      s->state = GZ_FREE;
+      g->read++;
+      g->out_pos = 0;
+      pthread_cond_broadcast(&g->cond);
+    }
+  }
+  pthread_mutex_unlock(&g->lock);
+  return (long)done;
+}
+
+static inline const char *
+gz_error(gz_reader_t *g)
+{
+  return g->err;
+}
+
+/* Stop the threads and release everything but the input itself */
+static inline void
+gz_close(gz_reader_t *g)
+{
+  int i;
+
+  if (g == NULL)
+    return;
+  pthread_mutex_lock(&g->lock);
+  g->stop = 1;
+  pthread_cond_broadcast(&g->cond);
+  pthread_mutex_unlock(&g->lock);
+  if (g->nworkers >= 0) {
+    pthread_join(g->input, NULL);
+    for (i = 0; i < g->nworkers; i++)
+      pthread_join(g->workers[i], NULL);
+  }
+  for (i = 0; g->slots != NULL && i < g->nslots; i++) {
+    free(g->slots[i].in);
+    free(g->slots[i].out);
+  }
+  free(g->slots);
+  free(g->ibuf);
+  pthread_mutex_destroy(&g->lock);
+  pthread_cond_destroy(&g->cond);
+  free(g);
+}
+
+#endif
@@ -0,0 +1,2966 @@
+/*
+
+  Motif scanning library of pwm_scoring (see motif_scan.h): score
+  nucleotide sequences based on matches to sequence motifs represented by
+  position weight matrices (PWM) or base probability matrices (LPM)
+
+  Giovanna Ambrosini, EPFL/SV, giovanna.ambrosini@epfl.ch
+
+  Copyright (c) 2014
+  School of Life Sciences
+  Ecole Polytechnique Federale de Lausanne
+  and Swiss Institute of Bioinformatics
+  EPFL SV ISREC UPNAE
+  Station 15
+  CH-1015 Lausanne, Switzerland.
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "motif_scan.h"
+
+#define NUCL  5
+#define LINE_SIZE 1024
+#define MVAL_MAX 32
+
+#define BEST_HIT_POS 256
+#define WIN_BLOCK 1024     /* Number of windows scored per kernel call */
+#define STREAM_BASES (1 << 20) /* Bases of a streamed sequence scanned at once */
+#define MAT_INIT_LEN 10    /* Initial number of matrix columns */
+#define MOTIF_GROUP 4      /* Motifs scored together in multi-motif mode */
+#define SOA_LANES MS_BATCH_LANES
+#define SOA_MIN_SEQS 4     /* Shortest run of same-length reads worth batching */
+#define ARENA_ALIGN 64     /* Alignment of the scratch arena buffers */
+#define BOUND_SLACK 1e-9   /* Relative rounding margin of LPM scores */
+/*#define MIN_SCORE -5000000 */
+#define MIN_SCORE INT_MIN
+#define SITES_FILTER_LEN 16 /* Shortest LPM prefiltered by its bound (--threshold) */
+#define PVAL_RES 1000.0    /* Bins per unit of log LPM score (--pvalue) */
+#define PVAL_MAX_BINS (1 << 22) /* Widest score distribution (--pvalue) */
+
+static char nucleotide[] = {'A','C','G','T', 'N'};
+
+/* Super-alphabet lookup tables (--kmer): the motif columns are cut into
+   groups of k, and for every group the partial score of each of the 4^k
+   k-mers is stored, so that a window costs one lookup per group.  The
+   last group may be shorter; its table ignores the extra bases. */
+typedef struct _kmer_tab_t {
+  int k;                     /* Columns per group (0 = no tables) */
+  int ngrp;                  /* Number of groups                  */
+  double *lpm;               /* Partial products [group][k-mer]   */
+  int *pwm;                  /* Partial scores [group][k-mer]     */
+} kmer_tab_t;
+
+/* Branch-and-bound of the best-hit scans (--best, --pwm): the first cols
+   columns of every window are scored by the scanning kernel, and only the
+   windows whose prefix score, completed with the best score of each of the
+   remaining columns, can still reach the best hit are scored to the end */
+typedef struct _bound_tab_t {
+  int cols;                  /* Columns scored for every window       */
+  double lpm_rest;           /* Product of the remaining column maxima */
+  double lpm_err;            /* Absolute margin (subnormal rounding)  */
+  int pwm_rest;              /* Sum of the remaining column maxima    */
+  int ok;                    /* Bound usable (finite, no overflow)    */
+} bound_tab_t;
+
+typedef struct _motif_t {
+  char *name;                /* Motif name (header line or file name) */
+  int len;                   /* Matrix Length              */
+  int size;                  /* Allocated matrix columns   */
+  double *lpm[NUCL];         /* Letter Probability Matrix  */
+  int *pwm[NUCL];            /* Position Weight Matrix     */
+  double *lpm_fwd;           /* LPM/background score table, forward strand */
+  double *lpm_rev;           /* LPM/background score table, reverse strand */
+  int *pwm_fwd;              /* PWM score table, forward strand */
+  int *pwm_rev;              /* PWM score table, reverse strand */
+  kmer_tab_t kmer_fwd;       /* k-mer lookup tables, forward strand */
+  kmer_tab_t kmer_rev;       /* k-mer lookup tables, reverse strand */
+  bound_tab_t bound_fwd;     /* Best-hit bound, forward strand */
+  bound_tab_t bound_rev;     /* Best-hit bound, reverse strand */
+} motif_t, *motif_p_t;
+
+/* Motifs scored together in one pass over the sequence; their score tables
+   are interleaved as [column][nucleotide][motif] and padded to the longest
+   motif with neutral columns (ratio 1.0 / score 0) */
+typedef struct _motif_group_t {
+  int cnt;                   /* Number of motifs in the group */
+  int maxLen;                /* Longest motif of the group    */
+  motif_p_t m[MOTIF_GROUP];
+  double *lpm_fwd;
+  double *lpm_rev;
+  int *pwm_fwd;
+  int *pwm_rev;
+} motif_group_t, *motif_group_p_t;
+
+/* Motifs of a scoring setup and their score tables.  Only ms_load_* and
+   ms_prepare write to it; scanners read it from any thread. */
+struct _ms_context_t {
+  ms_options_t opt;
+  double bg[NUCL];           /* Background (LPM)           */
+  int bg_set;                /* Background given (ms_set_background) */
+  motif_t *motifs;           /* Motif collection           */
+  int motifCnt;
+  int motifSize;
+  int maxLen;                /* Longest motif length       */
+  int minLen;                /* Shortest motif length      */
+  motif_group_t *groups;     /* Multi-motif scoring groups */
+  int groupCnt;
+  int soa_ok;                /* Batched kernels usable (see score_seqs) */
+  int prepared;
+};
+
+/* Results of the windows of a sequence scanned so far: a sequence is
+   scanned in one range of windows, or in consecutive ranges as it is
+   streamed (ms_stream_text) */
+typedef struct _scan_acc_t {
+  double lpm;                /* Sum of probabilities, or best LPM score */
+  char lpm_strand;           /* Strand of the best LPM hit          */
+  int pwm;                   /* Best PWM score                      */
+  int pwm_pos;               /* Window of the best PWM hit          */
+  int pwm_rev;               /* Best PWM hit on the reverse strand  */
+  int tag_set;               /* tag_match already holds the best PWM hit */
+} scan_acc_t;
+
+/* Per-thread scratch arena: the scoring buffers of a scanner are carved
+   out of a single block allocated once, so that scoring a sequence does
+   not allocate */
+typedef struct _arena_t {
+  char *base;
+  size_t size;
+  size_t used;
+} arena_t;
+
+/* Scoring state of one thread.  With -q the background and score tables
+   change with every sequence, so the scanner then works on its own copies
+   of the motif and group tables. */
+struct _ms_scanner_t {
+  const ms_context_t *ctx;
+  ms_options_t opt;
+  double bg[NUCL];
+  motif_t *motifs;
+  motif_group_t *groups;
+  double lpm_win[2][WIN_BLOCK];  /* Window scores of the current block */
+  int pwm_win[2][WIN_BLOCK];
+  unsigned char strand_win[WIN_BLOCK]; /* Windows where the reverse strand wins */
+  double *group_lpm_win[2];      /* Window scores of a motif group [window][motif] */
+  int *group_pwm_win[2];
+  double *multi_lpm;             /* Per-motif scores of the current sequence */
+  int *multi_pwm;
+  int *code_buf;                 /* Unpacked codes of windows with N */
+  uint64_t *tag_rcomp;           /* Packed reverse complement of a match */
+  char *tag_match;               /* Sequence of the best PWM match */
+  unsigned char *soa_codes;      /* Codes of a run of reads [base][lane] */
+  double *soa_lpm[2];            /* Window scores of a run [window][lane] */
+  int *soa_pwm[2];
+  arena_t arena;
+  char *best_pos;                /* Best hit position(s) of the current sequence */
+  size_t best_pos_len;
+  size_t best_pos_size;
+  double *scores;                /* Score values (ms_score_values), or NULL */
+  scan_acc_t acc;                /* Results of the current sequence */
+  int pos_off;                   /* Sequence position of base 0 of the scanned bases */
+  seq_t seq;                     /* Sequence of ms_score */
+  seq_t stream;                  /* Bases of a streamed sequence from pos_off on */
+  int stream_start;              /* First window of stream not scanned yet */
+  long stream_idx;               /* Number of the streamed sequence */
+  char hdr[1];
+};
+
+static const unsigned char fwd_strand[WIN_BLOCK];    /* All forward, for --forward */
+
+/* Append a new, empty motif to the motif collection */
+static motif_p_t
+new_motif(ms_context_t *ctx, const char *name)
+{
+  motif_p_t m;
+  int i;
+
+  if (ctx->motifCnt == ctx->motifSize) {
+    ctx->motifSize = ctx->motifSize ? 2 * ctx->motifSize : 4;
+    if ((ctx->motifs = realloc(ctx->motifs, (size_t)ctx->motifSize * sizeof(motif_t))) == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+  }
+  m = &ctx->motifs[ctx->motifCnt++];
+  memset(m, 0, sizeof(motif_t));
+  m->name = strdup(name);
+  m->size = MAT_INIT_LEN;
+  for (i = 0; i < NUCL; i++) {
+    /* Allocate columns for ACGT + N */
+    if (ctx->opt.lpm)
+      m->lpm[i] = calloc((size_t)m->size, sizeof(double));
+    else
+      m->pwm[i] = calloc((size_t)m->size, sizeof(int));
+    if ((ctx->opt.lpm && m->lpm[i] == NULL) || (!ctx->opt.lpm && m->pwm[i] == NULL)) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+  }
+  return m;
+}
+
+/* Read the matrices of a motif file into the motif collection.  A file may
+   hold several motifs, each one introduced by a '>' header line; a single
+   matrix may come without header.  Returns the number of motifs read. */
+static int 
+read_profile(ms_context_t *ctx, FILE *f, const char *iFile)
+{
+  motif_p_t m = NULL;
+  int l = 0;
+  int first = ctx->motifCnt;
+  char *s, *res, *buf;
+  size_t bLen = LINE_SIZE;
+  char mval[MVAL_MAX] = "";
+  int i, k;
+
+  if ((s = malloc(bLen * sizeof(char))) == NULL) {
+    perror("process_sga: malloc");
+    return(-1);
+  }
+  /* Read Matrix file line by line */
+  while ((res = fgets(s, (int) bLen, f)) != NULL) {
+    size_t cLen = strlen(s);
+
+    while (cLen + 1 == bLen && s[cLen - 1] != '\n') {
+      bLen *= 2;
+      if ((s = realloc(s, bLen)) == NULL) {
+        perror("process_file: realloc");
+        exit(1);
+      }
+      res = fgets(s + cLen, (int) (bLen - cLen), f);
+      cLen = strlen(s);
+    }
+    if (cLen > 0 && s[cLen - 1] == '\n')
+      s[--cLen] = 0;
+    if (cLen > 0 && s[cLen - 1] == '\r')
+      s[--cLen] = 0;
+
+    buf = s;
+    /* Get first character: if # skip line, if > start a new motif */
+    if (*buf == '#')
+      continue;
+    if (*buf == '>') {
+      buf++;
+      while (isspace(*buf))
+        buf++;
+      if (m != NULL && l == 0) {
+        free(m->name);
+        m->name = strdup(buf);
+      } else {
+        if (m != NULL)
+          m->len = l;
+        m = new_motif(ctx, *buf ? buf : iFile);
+        l = 0;
+      }
+      continue;
+    }
+    while (isspace(*buf))
+      buf++;
+    if (*buf == 0)
+      continue;
+    if (m == NULL)
+      m = new_motif(ctx, iFile);
+    /* Get PWM fields: one value per nucleotide (A, C, G, T) */
+    for (k = 0; k < NUCL-1; k++) {
+      while (isspace(*buf))
+        buf++;
+      i = 0;
+      while (isdigit(*buf) || *buf == '-' ||
+             (ctx->opt.lpm && (*buf == '.' || *buf == 'e' || *buf == 'E'))) {
+        if (i >= MVAL_MAX - 1) {
+          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
+          free(s);
+          return -1;
+        }
+        mval[i++] = *buf++;
+      }
+      mval[i] = 0;
+      if (strlen(mval) == 0) {
+        fprintf(stderr, "Matrix value for colum %d (row %d) is missing, please check the matrix format (it should be %s)\n",
+                k + 1, l, ctx->opt.lpm ? "LPM" : "Integer");
+        free(s);
+        return(-1);
+      }
+      if (ctx->opt.lpm)
+        m->lpm[k][l] = atof(mval);
+      else
+        m->pwm[k][l] = atoi(mval);
+    }
+#ifdef DEBUG
+    if (ctx->opt.lpm)
+      fprintf(stderr, "%3d   %f   %f   %f   %f\n", l, m->lpm[0][l], m->lpm[1][l], m->lpm[2][l], m->lpm[3][l]);
+    else
+      fprintf(stderr, "%3d   %7d   %7d   %7d   %7d\n", l, m->pwm[0][l], m->pwm[1][l], m->pwm[2][l], m->pwm[3][l]);
+#endif
+    if (l == m->size-1) {
+     /* Reallocate Matrix columns */
+      for (i = 0; i < NUCL; i++) {
+        if (ctx->opt.lpm)
+          m->lpm[i] = realloc(m->lpm[i], (size_t)m->size*2*sizeof(double));
+        else
+          m->pwm[i] = realloc(m->pwm[i], (size_t)m->size*2*sizeof(int));
+        if ((ctx->opt.lpm && m->lpm[i] == NULL) || (!ctx->opt.lpm && m->pwm[i] == NULL)) {
+          fprintf(stderr, "Out of memory\n");
+          exit(1);
+        }
+      }
+      m->size *= 2;
+    }
+    l++;
+  }
+  if (m != NULL)
+    m->len = l;
+  free(s);
+  for (i = first; i < ctx->motifCnt; i++) {
+    if (ctx->motifs[i].len == 0) {
+      fprintf(stderr, "Motif %s in file %s has no matrix rows\n", ctx->motifs[i].name, iFile);
+      return -1;
+    }
+#ifdef DEBUG
+    fprintf(stderr, "PWM length: %d\n", ctx->motifs[i].len);
+#endif
+  }
+  return ctx->motifCnt - first;
+}
+
+/* Compute the best-hit bound of a score table (position-major, as built by
+   build_lpm_table/build_pwm_table; one of lpm_tab and pwm_tab is NULL).
+   The LPM bound includes N.  PWM windows with N are always scored in full
+   (their INT_MIN scores wrap around), so the PWM bound leaves N out. */
+static void
+build_bound_table(bound_tab_t *bt, const double *lpm_tab, const int *pwm_tab, int len)
+{
+  double rest = 1.0, peak = 1.0;
+  long long total = 0, sum = 0;
+  int j, n;
+
+  bt->cols = len < 4 ? len : (2 * len + 2) / 3;
+  bt->ok = 1;
+  for (j = len - 1; j >= 0; j--) {
+    if (lpm_tab) {
+      double max = 0.0;
+      for (n = 0; n < NUCL; n++) {
+        double v = lpm_tab[j*NUCL + n];
+        if (!(v >= 0.0 && v < HUGE_VAL))
+          bt->ok = 0;
+        else if (v > max)
+          max = v;
+      }
+      if (j >= bt->cols) {
+        rest *= max;
+        if (rest > peak)
+          peak = rest;
+      }
+    } else {
+      int max = INT_MIN, amax = 0;
+      for (n = 0; n < NUCL - 1; n++) {
+        int v = pwm_tab[j*NUCL + n];
+        max = v > max ? v : max;
+        amax = abs(v) > amax ? abs(v) : amax;
+      }
+      total += amax;
+      if (j >= bt->cols)
+        sum += max;
+    }
+  }
+  /* Roundings in the subnormal range are absolute: bound their effect,
+     amplified by the remaining columns */
+  bt->lpm_rest = rest * (1.0 + BOUND_SLACK);
+  bt->lpm_err = (double)len * peak * 4.9406564584124654e-324;
+  if (!(bt->lpm_rest < HUGE_VAL && bt->lpm_err < HUGE_VAL))
+    bt->ok = 0;
+  if (total >= INT_MAX / 2)
+    bt->ok = 0;
+  bt->pwm_rest = (int)sum;
+}
+
+/* Score table for the LPM: for every motif position j (row) and nucleotide n
+   the ratio lpm[n][j]/bg[n] is stored at [j*NUCL + n], so that a window is
+   scored by walking the table rows in memory order.  The reverse strand table
+   holds the same ratios for the reverse complement of the motif, i.e. row j
+   corresponds to the complement of the nucleotide at motif position
+   len-j-1. Both are rebuilt whenever the background changes. */
+static void
+build_lpm_table(motif_p_t m, const double *bg)
+{
+  int j, n;
+
+  for (j = 0; j < m->len; j++) {
+    for (n = 0; n < NUCL; n++) {
+      int c = (n == 4) ? 4 : 3 - n;
+      m->lpm_fwd[j*NUCL + n] = m->lpm[n][j]/bg[n];
+      m->lpm_rev[j*NUCL + n] = m->lpm[c][m->len-j-1]/bg[c];
+    }
+  }
+  build_bound_table(&m->bound_fwd, m->lpm_fwd, NULL, m->len);
+  build_bound_table(&m->bound_rev, m->lpm_rev, NULL, m->len);
+}
+
+/* Same layout as the LPM score table, for integer PWMs */
+static void
+build_pwm_table(motif_p_t m)
+{
+  int j, n;
+
+  for (j = 0; j < m->len; j++) {
+    for (n = 0; n < NUCL; n++) {
+      int c = (n == 4) ? 4 : 3 - n;
+      m->pwm_fwd[j*NUCL + n] = m->pwm[n][j];
+      m->pwm_rev[j*NUCL + n] = m->pwm[c][m->len-j-1];
+    }
+  }
+  build_bound_table(&m->bound_fwd, NULL, m->pwm_fwd, m->len);
+  build_bound_table(&m->bound_rev, NULL, m->pwm_rev, m->len);
+}
+
+/* Interleave the score tables of the motifs of a group */
+static void
+build_group_table(motif_group_p_t g, int lpm)
+{
+  int j, n, k;
+
+  for (j = 0; j < g->maxLen; j++) {
+    for (n = 0; n < NUCL; n++) {
+      for (k = 0; k < MOTIF_GROUP; k++) {
+        size_t at = ((size_t)j*NUCL + n)*MOTIF_GROUP + k;
+        int pad = (k >= g->cnt || j >= g->m[k]->len);
+        if (lpm) {
+          g->lpm_fwd[at] = pad ? 1.0 : g->m[k]->lpm_fwd[j*NUCL + n];
+          g->lpm_rev[at] = pad ? 1.0 : g->m[k]->lpm_rev[j*NUCL + n];
+        } else {
+          g->pwm_fwd[at] = pad ? 0 : g->m[k]->pwm_fwd[j*NUCL + n];
+          g->pwm_rev[at] = pad ? 0 : g->m[k]->pwm_rev[j*NUCL + n];
+        }
+      }
+    }
+  }
+}
+
+/* Rebuild the LPM score tables of a scanner after a background change */
+static void
+build_lpm_tables(ms_scanner_t *sc)
+{
+  int i;
+
+  for (i = 0; i < sc->ctx->motifCnt; i++)
+    build_lpm_table(&sc->motifs[i], sc->bg);
+  for (i = 0; i < sc->ctx->groupCnt; i++)
+    build_group_table(&sc->groups[i], 1);
+}
+
+/* Score threshold of a p-value (--pvalue): the lowest score reached by a
+   window of random sequence with probability at most p, from the exact
+   score distribution of the forward strand table.  Bases are drawn from the
+   background (-u, -p) or uniformly.  LPM scores are taken as sums of log
+   ratios rounded to 1/PVAL_RES, so their threshold is approximate; windows
+   with a zero ratio never reach it.  Returns -1 if the score range of the
+   motif is too wide. */
+static int
+pvalue_threshold(const ms_context_t *ctx, motif_p_t m, double p, double *thr)
+{
+  double q[NUCL-1], qsum = 0.0, tail = 0.0;
+  double *dist, *next, *tmp;
+  long *sc, lo = 0, width = 0, t;
+  int j, n;
+
+  for (n = 0; n < NUCL-1; n++) {
+    q[n] = (ctx->opt.lpm && ctx->bg_set) ? ctx->bg[n] : 0.25;
+    qsum += q[n];
+  }
+  if ((sc = malloc((size_t)m->len * (NUCL-1) * sizeof(long))) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  for (j = 0; j < m->len; j++) {
+    long cmin = LONG_MAX, cmax = LONG_MIN;
+    for (n = 0; n < NUCL-1; n++) {
+      long v;
+      if (!ctx->opt.lpm)
+        v = m->pwm_fwd[j*NUCL + n];
+      else if (m->lpm_fwd[j*NUCL + n] > 0.0)
+        v = lround(log(m->lpm_fwd[j*NUCL + n]) * PVAL_RES);
+      else
+        v = LONG_MIN;
+      sc[j*(NUCL-1) + n] = v;
+      if (v != LONG_MIN) {
+        cmin = v < cmin ? v : cmin;
+        cmax = v > cmax ? v : cmax;
+      }
+    }
+    if (cmin == LONG_MAX) {
+      /* No window scores above 0 */
+      free(sc);
+      *thr = HUGE_VAL;
+      return 0;
+    }
+    for (n = 0; n < NUCL-1; n++)
+      if (sc[j*(NUCL-1) + n] != LONG_MIN)
+        sc[j*(NUCL-1) + n] -= cmin;
+    lo += cmin;
+    width += cmax - cmin;
+    if (width >= PVAL_MAX_BINS) {
+      fprintf(stderr, "Score range of motif %s too wide for --pvalue\n", m->name);
+      free(sc);
+      return -1;
+    }
+  }
+  dist = calloc((size_t)width + 1, sizeof(double));
+  next = calloc((size_t)width + 1, sizeof(double));
+  if (dist == NULL || next == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  /* dist[t]: probability that the columns so far score lo' + t */
+  dist[0] = 1.0;
+  width = 0;
+  for (j = 0; j < m->len; j++) {
+    const long *col = sc + j*(NUCL-1);
+    long cw = 0;
+    for (n = 0; n < NUCL-1; n++)
+      cw = col[n] > cw ? col[n] : cw;
+    memset(next, 0, ((size_t)(width + cw) + 1) * sizeof(double));
+    for (t = 0; t <= width; t++) {
+      if (dist[t] == 0.0)
+        continue;
+      for (n = 0; n < NUCL-1; n++)
+        if (col[n] != LONG_MIN)
+          next[t + col[n]] += dist[t] * q[n] / qsum;
+    }
+    width += cw;
+    tmp = dist;
+    dist = next;
+    next = tmp;
+  }
+  /* Lowest score whose upper tail stays within p */
+  for (t = width; t >= 0 && tail + dist[t] <= p; t--)
+    tail += dist[t];
+  t++;
+  free(dist);
+  free(next);
+  free(sc);
+  if (ctx->opt.lpm)
+    *thr = exp((double)(lo + t) / PVAL_RES);
+  else
+    *thr = (double)(lo + t);
+  return 0;
+}
+
+/* Build the k-mer lookup tables of a score table (position-major, as
+   built by build_lpm_table/build_pwm_table).  The partial products are
+   accumulated in column order, starting from the first column of the group. */
+static void
+build_kmer_table(kmer_tab_t *kt, const double *lpm_tab, const int *pwm_tab, int len, int k)
+{
+  size_t size = (size_t)1 << (2 * k);
+  size_t x;
+  int g, j;
+
+  kt->k = k;
+  kt->ngrp = (len + k - 1) / k;
+  if (lpm_tab != NULL)
+    kt->lpm = malloc(kt->ngrp * size * sizeof(double));
+  else
+    kt->pwm = malloc(kt->ngrp * size * sizeof(int));
+  if (kt->lpm == NULL && kt->pwm == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  for (g = 0; g < kt->ngrp; g++) {
+    int w = (len - g*k < k) ? len - g*k : k;
+    for (x = 0; x < size; x++) {
+      double prod = 1.0;
+      unsigned int score = 0;
+      for (j = 0; j < w; j++) {
+        int n = (int)((x >> (2 * j)) & 3);
+        if (lpm_tab != NULL)
+          prod *= lpm_tab[(g*k + j)*NUCL + n];
+        else
+          score += (unsigned int)pwm_tab[(g*k + j)*NUCL + n];
+      }
+      if (lpm_tab != NULL)
+        kt->lpm[g*size + x] = prod;
+      else
+        kt->pwm[g*size + x] = (int)score;
+    }
+  }
+}
+
+static void
+build_kmer_tables(motif_p_t m, int k, int lpm)
+{
+  if (lpm) {
+    build_kmer_table(&m->kmer_fwd, m->lpm_fwd, NULL, m->len, k);
+    build_kmer_table(&m->kmer_rev, m->lpm_rev, NULL, m->len, k);
+  } else {
+    build_kmer_table(&m->kmer_fwd, NULL, m->pwm_fwd, m->len, k);
+    build_kmer_table(&m->kmer_rev, NULL, m->pwm_rev, m->len, k);
+  }
+}
+
+/*
+  Window scanning kernels.
+
+  A kernel scores the n consecutive windows starting at positions p, p+1,
+  ..., p+n-1 of a packed sequence against a score table and stores one
+  score per window in out[].  Kernels read the 2-bit packed bases directly
+  and are only used for windows without any N; windows that overlap an N
+  are scored by the *_scan_codes kernels on unpacked codes (see
+  lpm_scan_windows).
+
+  The SIMD kernels score 4 (AVX2) or 8 (AVX-512) windows per iteration for
+  the LPM and 8 or 16 windows for the PWM: the bases of one motif column
+  for all lanes are spread from a single 64-bit extract of the packed
+  sequence, and the corresponding table entries are picked from the
+  table row with a register permute.  Each lane multiplies (adds) the
+  column scores in the same order as the scalar kernel, so their results
+  are bit-for-bit identical to it.  Integer scores wrap around on overflow
+  (N columns score INT_MIN) in all kernels.
+
+  The kernel is selected once at startup from the CPU features (see
+  select_kernels), so the same binary runs on any x86-64 machine.
+
+  The kernel bodies are always inlined into one instance per motif length
+  from SPEC_MIN_LEN to SPEC_MAX_LEN (see SCAN_KERNELS), where the column
+  loop has a constant trip count and is fully unrolled (the unroll pragmas
+  of the bodies match SPEC_MAX_LEN), and into a generic instance for the
+  other lengths; the scanning functions (lpm_scan, ...) dispatch on the
+  length through a table.
+*/
+#define SPEC_MIN_LEN 5
+#define SPEC_MAX_LEN 32
+#define SPEC_LENGTHS(X, a, b, c)                                               \
+  X(a, b, c, 5) X(a, b, c, 6) X(a, b, c, 7) X(a, b, c, 8) X(a, b, c, 9)        \
+  X(a, b, c, 10) X(a, b, c, 11) X(a, b, c, 12) X(a, b, c, 13) X(a, b, c, 14)   \
+  X(a, b, c, 15) X(a, b, c, 16) X(a, b, c, 17) X(a, b, c, 18) X(a, b, c, 19)   \
+  X(a, b, c, 20) X(a, b, c, 21) X(a, b, c, 22) X(a, b, c, 23) X(a, b, c, 24)   \
+  X(a, b, c, 25) X(a, b, c, 26) X(a, b, c, 27) X(a, b, c, 28) X(a, b, c, 29)   \
+  X(a, b, c, 30) X(a, b, c, 31) X(a, b, c, 32)
+
+#define KERNEL_BODY __attribute__((always_inline)) static inline
+#define KERNEL_BODY_TARGET(isa) __attribute__((always_inline, target(isa))) static inline
+
+/* Window kernel name (any length), name_L for every length L and the
+   name_fixed dispatch table, from name_body */
+#define SCAN_KERNEL(attr, name, type, L)                                       \
+  attr static void                                                             \
+  name##_##L(const uint64_t *bits, int p, int n, const type *tab, int len, type *out) \
+  {                                                                            \
+    (void)len;                                                                 \
+    name##_body(bits, p, n, tab, L, out);                                      \
+  }
+#define SCAN_ENTRY(attr, name, type, L) [L] = name##_##L,
+#define SCAN_KERNELS(attr, name, type)                                         \
+  attr static void                                                             \
+  name(const uint64_t *bits, int p, int n, const type *tab, int len, type *out) \
+  {                                                                            \
+    name##_body(bits, p, n, tab, len, out);                                    \
+  }                                                                            \
+  SPEC_LENGTHS(SCAN_KERNEL, attr, name, type)                                  \
+  static void (*const name##_fixed[SPEC_MAX_LEN + 1])(const uint64_t *, int, int, const type *, int, type *) = { \
+    SPEC_LENGTHS(SCAN_ENTRY, attr, name, type)                                 \
+  };
+
+/* Same for the batched kernels */
+#define SOA_KERNEL(attr, name, type, L)                                        \
+  attr static void                                                             \
+  name##_##L(const unsigned char *c, int n, const type *tab, int len, type *out) \
+  {                                                                            \
+    (void)len;                                                                 \
+    name##_body(c, n, tab, L, out);                                            \
+  }
+#define SOA_KERNELS(attr, name, type)                                          \
+  attr static void                                                             \
+  name(const unsigned char *c, int n, const type *tab, int len, type *out)     \
+  {                                                                            \
+    name##_body(c, n, tab, len, out);                                          \
+  }                                                                            \
+  SPEC_LENGTHS(SOA_KERNEL, attr, name, type)                                   \
+  static void (*const name##_fixed[SPEC_MAX_LEN + 1])(const unsigned char *, int, const type *, int, type *) = { \
+    SPEC_LENGTHS(SCAN_ENTRY, attr, name, type)                                 \
+  };
+
+typedef void (*lpm_kernel_t)(const uint64_t *bits, int p, int n, const double *tab, int len, double *out);
+typedef void (*pwm_kernel_t)(const uint64_t *bits, int p, int n, const int *tab, int len, int *out);
+
+static void
+lpm_scan_codes(const int *s, int n, const double *tab, int len, double *out)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    const double *t = tab;
+    double prod = 1.0;
+    for (j = 0; j < len; j++, t += NUCL)
+      prod *= t[s[i+j]];
+    out[i] = prod;
+  }
+}
+
+static void
+pwm_scan_codes(const int *s, int n, const int *tab, int len, int *out)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    const int *t = tab;
+    unsigned int score = 0;
+    for (j = 0; j < len; j++, t += NUCL)
+      score += (unsigned int)t[s[i+j]];
+    out[i] = (int)score;
+  }
+}
+
+KERNEL_BODY void
+lpm_scan_scalar_body(const uint64_t *bits, int p, int n, const double *tab, int len, double *out)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    const double *t = tab;
+    double prod = 1.0;
+    uint64_t x = 0;
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++, t += NUCL, x >>= 2) {
+      if (j % SEQ_WORD_BASES == 0)
+        x = seq_bits64(bits, p + i + j);
+      prod *= t[x & 3];
+    }
+    out[i] = prod;
+  }
+}
+
+KERNEL_BODY void
+pwm_scan_scalar_body(const uint64_t *bits, int p, int n, const int *tab, int len, int *out)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    const int *t = tab;
+    unsigned int score = 0;
+    uint64_t x = 0;
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++, t += NUCL, x >>= 2) {
+      if (j % SEQ_WORD_BASES == 0)
+        x = seq_bits64(bits, p + i + j);
+      score += (unsigned int)t[x & 3];
+    }
+    out[i] = (int)score;
+  }
+}
+
+typedef void (*lpm_kmer_kernel_t)(const int *idx, int n, const kmer_tab_t *kt, double *out);
+typedef void (*pwm_kmer_kernel_t)(const int *idx, int n, const kmer_tab_t *kt, int *out);
+
+/* k-mer lookup kernels: window i reads the k-mer indexes idx[i + g*k] */
+static void
+lpm_kmer_scalar(const int *idx, int n, const kmer_tab_t *kt, double *out)
+{
+  size_t size = (size_t)1 << (2 * kt->k);
+  int i, g;
+
+  for (i = 0; i < n; i++) {
+    const int *x = idx + i;
+    const double *t = kt->lpm;
+    double prod = 1.0;
+    for (g = 0; g < kt->ngrp; g++, x += kt->k, t += size)
+      prod *= t[*x];
+    out[i] = prod;
+  }
+}
+
+static void
+pwm_kmer_scalar(const int *idx, int n, const kmer_tab_t *kt, int *out)
+{
+  size_t size = (size_t)1 << (2 * kt->k);
+  int i, g;
+
+  for (i = 0; i < n; i++) {
+    const int *x = idx + i;
+    const int *t = kt->pwm;
+    unsigned int score = 0;
+    for (g = 0; g < kt->ngrp; g++, x += kt->k, t += size)
+      score += (unsigned int)t[*x];
+    out[i] = (int)score;
+  }
+}
+
+/*
+  Batched kernels for runs of reads of the same length (see score_seqs).
+
+  The codes of SOA_LANES reads are laid out base by base, c[pos*SOA_LANES +
+  lane], and window i of every lane is scored at once, so that the SIMD
+  lanes run across reads: short reads need no per-read setup and have no
+  ragged tail.  out[i*SOA_LANES + lane] receives the score of window i of
+  the read in lane.  The reads have no N; each lane multiplies (adds) the
+  columns in the same order as the other kernels, with identical results.
+*/
+typedef void (*lpm_soa_kernel_t)(const unsigned char *c, int n, const double *tab, int len, double *out);
+typedef void (*pwm_soa_kernel_t)(const unsigned char *c, int n, const int *tab, int len, int *out);
+
+KERNEL_BODY void
+lpm_soa_scalar_body(const unsigned char *c, int n, const double *tab, int len, double *out)
+{
+  int i, j, k;
+
+  for (i = 0; i < n; i++) {
+    double prod[SOA_LANES];
+    for (k = 0; k < SOA_LANES; k++)
+      prod[k] = 1.0;
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++) {
+      const unsigned char *x = c + (size_t)(i + j) * SOA_LANES;
+      for (k = 0; k < SOA_LANES; k++)
+        prod[k] *= tab[j*NUCL + x[k]];
+    }
+    memcpy(out + (size_t)i * SOA_LANES, prod, sizeof(prod));
+  }
+}
+
+KERNEL_BODY void
+pwm_soa_scalar_body(const unsigned char *c, int n, const int *tab, int len, int *out)
+{
+  int i, j, k;
+
+  for (i = 0; i < n; i++) {
+    unsigned int score[SOA_LANES];
+    for (k = 0; k < SOA_LANES; k++)
+      score[k] = 0;
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++) {
+      const unsigned char *x = c + (size_t)(i + j) * SOA_LANES;
+      for (k = 0; k < SOA_LANES; k++)
+        score[k] += (unsigned int)tab[j*NUCL + x[k]];
+    }
+    for (k = 0; k < SOA_LANES; k++)
+      out[(size_t)i * SOA_LANES + k] = (int)score[k];
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+/* A 64-bit extract holds the bases of W lanes for 33-W consecutive columns */
+#define LANE_RELOAD(W) (SEQ_WORD_BASES + 1 - (W))
+
+KERNEL_BODY_TARGET("avx2") void
+lpm_scan_avx2_body(const uint64_t *bits, int p, int n, const double *tab, int len, double *out)
+{
+  const __m256i shift = _mm256_setr_epi32(0, 0, 2, 2, 4, 4, 6, 6);
+  const __m256i half = _mm256_setr_epi32(0, 1, 0, 1, 0, 1, 0, 1);
+  const __m256i three = _mm256_set1_epi32(3);
+  int i = 0, j;
+
+  for (; i + 4 <= n; i += 4) {
+    __m256d prod = _mm256_set1_pd(1.0);
+    const double *t = tab;
+    uint64_t x = 0;
+    int left = 0;
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++, t += NUCL, x >>= 2, left--) {
+      if (left == 0) {
+        x = seq_bits64(bits, p + i + j);
+        left = LANE_RELOAD(4);
+      }
+      /* double k of the row is picked as the 32-bit pair (2k, 2k+1) */
+      __m256i c = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32((int)x), shift), three);
+      __m256i idx = _mm256_add_epi32(_mm256_add_epi32(c, c), half);
+      __m256i row = _mm256_castpd_si256(_mm256_loadu_pd(t));
+      prod = _mm256_mul_pd(prod, _mm256_castsi256_pd(_mm256_permutevar8x32_epi32(row, idx)));
+    }
+    _mm256_storeu_pd(out + i, prod);
+  }
+  if (i < n)
+    lpm_scan_scalar_body(bits, p + i, n - i, tab, len, out + i);
+}
+
+KERNEL_BODY_TARGET("avx2") void
+pwm_scan_avx2_body(const uint64_t *bits, int p, int n, const int *tab, int len, int *out)
+{
+  const __m256i shift = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+  const __m256i three = _mm256_set1_epi32(3);
+  int i = 0, j;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i score = _mm256_setzero_si256();
+    const int *t = tab;
+    uint64_t x = 0;
+    int left = 0;
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++, t += NUCL, x >>= 2, left--) {
+      if (left == 0) {
+        x = seq_bits64(bits, p + i + j);
+        left = LANE_RELOAD(8);
+      }
+      __m256i idx = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32((int)x), shift), three);
+      __m256i row = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)t));
+      score = _mm256_add_epi32(score, _mm256_permutevar8x32_epi32(row, idx));
+    }
+    _mm256_storeu_si256((__m256i *)(out + i), score);
+  }
+  if (i < n)
+    pwm_scan_scalar_body(bits, p + i, n - i, tab, len, out + i);
+}
+
+KERNEL_BODY_TARGET("avx512f") void
+lpm_scan_avx512_body(const uint64_t *bits, int p, int n, const double *tab, int len, double *out)
+{
+  const __m512i shift = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14);
+  const __m512i three = _mm512_set1_epi64(3);
+  int i = 0, j;
+
+  for (; i + 8 <= n; i += 8) {
+    __m512d prod = _mm512_set1_pd(1.0);
+    const double *t = tab;
+    uint64_t x = 0;
+    int left = 0;
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++, t += NUCL, x >>= 2, left--) {
+      if (left == 0) {
+        x = seq_bits64(bits, p + i + j);
+        left = LANE_RELOAD(8);
+      }
+      __m512i idx = _mm512_and_si512(_mm512_srlv_epi64(_mm512_set1_epi64((long long)x), shift), three);
+      __m512d row = _mm512_castpd256_pd512(_mm256_loadu_pd(t));
+      prod = _mm512_mul_pd(prod, _mm512_permutexvar_pd(idx, row));
+    }
+    _mm512_storeu_pd(out + i, prod);
+  }
+  if (i < n)
+    lpm_scan_avx2_body(bits, p + i, n - i, tab, len, out + i);
+}
+
+KERNEL_BODY_TARGET("avx512f") void
+pwm_scan_avx512_body(const uint64_t *bits, int p, int n, const int *tab, int len, int *out)
+{
+  const __m512i shift = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+  const __m512i three = _mm512_set1_epi32(3);
+  int i = 0, j;
+
+  for (; i + 16 <= n; i += 16) {
+    __m512i score = _mm512_setzero_si512();
+    const int *t = tab;
+    uint64_t x = 0;
+    int left = 0;
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++, t += NUCL, x >>= 2, left--) {
+      if (left == 0) {
+        x = seq_bits64(bits, p + i + j);
+        left = LANE_RELOAD(16);
+      }
+      __m512i idx = _mm512_and_si512(_mm512_srlv_epi32(_mm512_set1_epi32((int)x), shift), three);
+      __m512i row = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)t));
+      score = _mm512_add_epi32(score, _mm512_permutexvar_epi32(idx, row));
+    }
+    _mm512_storeu_si512((void *)(out + i), score);
+  }
+  if (i < n)
+    pwm_scan_avx2_body(bits, p + i, n - i, tab, len, out + i);
+}
+
+/* The k-mer indexes of consecutive windows are contiguous, so the table
+   entries of 4 (8) windows are fetched with one gather per group */
+__attribute__((target("avx2"))) static void
+lpm_kmer_avx2(const int *idx, int n, const kmer_tab_t *kt, double *out)
+{
+  size_t size = (size_t)1 << (2 * kt->k);
+  int i = 0, g;
+
+  for (; i + 4 <= n; i += 4) {
+    __m256d prod = _mm256_set1_pd(1.0);
+    const int *x = idx + i;
+    const double *t = kt->lpm;
+    for (g = 0; g < kt->ngrp; g++, x += kt->k, t += size) {
+      __m128i vi = _mm_loadu_si128((const __m128i *)x);
+      prod = _mm256_mul_pd(prod, _mm256_i32gather_pd(t, vi, 8));
+    }
+    _mm256_storeu_pd(out + i, prod);
+  }
+  if (i < n)
+    lpm_kmer_scalar(idx + i, n - i, kt, out + i);
+}
+
+__attribute__((target("avx2"))) static void
+pwm_kmer_avx2(const int *idx, int n, const kmer_tab_t *kt, int *out)
+{
+  size_t size = (size_t)1 << (2 * kt->k);
+  int i = 0, g;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i score = _mm256_setzero_si256();
+    const int *x = idx + i;
+    const int *t = kt->pwm;
+    for (g = 0; g < kt->ngrp; g++, x += kt->k, t += size) {
+      __m256i vi = _mm256_loadu_si256((const __m256i *)x);
+      score = _mm256_add_epi32(score, _mm256_i32gather_epi32(t, vi, 4));
+    }
+    _mm256_storeu_si256((__m256i *)(out + i), score);
+  }
+  if (i < n)
+    pwm_kmer_scalar(idx + i, n - i, kt, out + i);
+}
+/* Batched kernels: the codes of the lanes are widened to permute indexes
+   of the table row, as in the window kernels */
+KERNEL_BODY_TARGET("avx2") void
+lpm_soa_avx2_body(const unsigned char *c, int n, const double *tab, int len, double *out)
+{
+  const __m256i half = _mm256_setr_epi32(0, 1, 0, 1, 0, 1, 0, 1);
+  int i, j, k;
+
+  for (i = 0; i < n; i++) {
+    __m256d prod[SOA_LANES / 4];
+    for (k = 0; k < SOA_LANES / 4; k++)
+      prod[k] = _mm256_set1_pd(1.0);
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++) {
+      const unsigned char *x = c + (size_t)(i + j) * SOA_LANES;
+      __m256i row = _mm256_castpd_si256(_mm256_loadu_pd(tab + j*NUCL));
+      __m128i b = _mm_loadu_si128((const __m128i *)x);
+      /* Byte pairs (c, c) -> 32-bit pairs (2c, 2c+1) */
+      __m128i lo = _mm_unpacklo_epi8(b, b), hi = _mm_unpackhi_epi8(b, b);
+      for (k = 0; k < SOA_LANES / 4; k++) {
+        __m128i pair = (k < 2) ? lo : hi;
+        __m256i idx = _mm256_cvtepu8_epi32((k & 1) ? _mm_srli_si128(pair, 8) : pair);
+        idx = _mm256_add_epi32(_mm256_add_epi32(idx, idx), half);
+        prod[k] = _mm256_mul_pd(prod[k], _mm256_castsi256_pd(_mm256_permutevar8x32_epi32(row, idx)));
+      }
+    }
+    for (k = 0; k < SOA_LANES / 4; k++)
+      _mm256_storeu_pd(out + (size_t)i * SOA_LANES + 4*k, prod[k]);
+  }
+}
+
+KERNEL_BODY_TARGET("avx2") void
+pwm_soa_avx2_body(const unsigned char *c, int n, const int *tab, int len, int *out)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++) {
+      const unsigned char *x = c + (size_t)(i + j) * SOA_LANES;
+      __m256i row = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(tab + j*NUCL)));
+      __m128i b = _mm_loadu_si128((const __m128i *)x);
+      s0 = _mm256_add_epi32(s0, _mm256_permutevar8x32_epi32(row, _mm256_cvtepu8_epi32(b)));
+      s1 = _mm256_add_epi32(s1, _mm256_permutevar8x32_epi32(row, _mm256_cvtepu8_epi32(_mm_srli_si128(b, 8))));
+    }
+    _mm256_storeu_si256((__m256i *)(out + (size_t)i * SOA_LANES), s0);
+    _mm256_storeu_si256((__m256i *)(out + (size_t)i * SOA_LANES + 8), s1);
+  }
+}
+
+KERNEL_BODY_TARGET("avx512f") void
+lpm_soa_avx512_body(const unsigned char *c, int n, const double *tab, int len, double *out)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    __m512d p0 = _mm512_set1_pd(1.0), p1 = _mm512_set1_pd(1.0);
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++) {
+      const unsigned char *x = c + (size_t)(i + j) * SOA_LANES;
+      __m512d row = _mm512_castpd256_pd512(_mm256_loadu_pd(tab + j*NUCL));
+      __m128i b = _mm_loadu_si128((const __m128i *)x);
+      p0 = _mm512_mul_pd(p0, _mm512_permutexvar_pd(_mm512_cvtepu8_epi64(b), row));
+      p1 = _mm512_mul_pd(p1, _mm512_permutexvar_pd(_mm512_cvtepu8_epi64(_mm_srli_si128(b, 8)), row));
+    }
+    _mm512_storeu_pd(out + (size_t)i * SOA_LANES, p0);
+    _mm512_storeu_pd(out + (size_t)i * SOA_LANES + 8, p1);
+  }
+}
+
+KERNEL_BODY_TARGET("avx512f") void
+pwm_soa_avx512_body(const unsigned char *c, int n, const int *tab, int len, int *out)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++) {
+    __m512i score = _mm512_setzero_si512();
+    #pragma GCC unroll 32
+    for (j = 0; j < len; j++) {
+      const unsigned char *x = c + (size_t)(i + j) * SOA_LANES;
+      __m512i row = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)(tab + j*NUCL)));
+      __m512i idx = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)x));
+      score = _mm512_add_epi32(score, _mm512_permutexvar_epi32(idx, row));
+    }
+    _mm512_storeu_si512((void *)(out + (size_t)i * SOA_LANES), score);
+  }
+}
+#endif
+
+SCAN_KERNELS(, lpm_scan_scalar, double)
+SCAN_KERNELS(, pwm_scan_scalar, int)
+SOA_KERNELS(, lpm_soa_scalar, double)
+SOA_KERNELS(, pwm_soa_scalar, int)
+#ifdef HAVE_X86_SIMD
+SCAN_KERNELS(__attribute__((target("avx2"))), lpm_scan_avx2, double)
+SCAN_KERNELS(__attribute__((target("avx2"))), pwm_scan_avx2, int)
+SCAN_KERNELS(__attribute__((target("avx512f"))), lpm_scan_avx512, double)
+SCAN_KERNELS(__attribute__((target("avx512f"))), pwm_scan_avx512, int)
+SOA_KERNELS(__attribute__((target("avx2"))), lpm_soa_avx2, double)
+SOA_KERNELS(__attribute__((target("avx2"))), pwm_soa_avx2, int)
+SOA_KERNELS(__attribute__((target("avx512f"))), lpm_soa_avx512, double)
+SOA_KERNELS(__attribute__((target("avx512f"))), pwm_soa_avx512, int)
+#endif
+
+static lpm_kernel_t lpm_scan_any = lpm_scan_scalar;
+static pwm_kernel_t pwm_scan_any = pwm_scan_scalar;
+static const lpm_kernel_t *lpm_scan_fixed = lpm_scan_scalar_fixed;
+static const pwm_kernel_t *pwm_scan_fixed = pwm_scan_scalar_fixed;
+static lpm_kmer_kernel_t lpm_kmer_scan = lpm_kmer_scalar;
+static pwm_kmer_kernel_t pwm_kmer_scan = pwm_kmer_scalar;
+static lpm_soa_kernel_t lpm_soa_any = lpm_soa_scalar;
+static pwm_soa_kernel_t pwm_soa_any = pwm_soa_scalar;
+static const lpm_soa_kernel_t *lpm_soa_fixed = lpm_soa_scalar_fixed;
+static const pwm_soa_kernel_t *pwm_soa_fixed = pwm_soa_scalar_fixed;
+static const char *kernel_name = "scalar";
+
+/* Pick the widest kernel supported by both the CPU and the --kernel option */
+static int
+select_kernels(const char *name)
+{
+  int auto_select = (name == NULL || !strcmp(name, "auto"));
+
+  lpm_scan_any = lpm_scan_scalar;
+  pwm_scan_any = pwm_scan_scalar;
+  lpm_scan_fixed = lpm_scan_scalar_fixed;
+  pwm_scan_fixed = pwm_scan_scalar_fixed;
+  lpm_kmer_scan = lpm_kmer_scalar;
+  pwm_kmer_scan = pwm_kmer_scalar;
+  lpm_soa_any = lpm_soa_scalar;
+  pwm_soa_any = pwm_soa_scalar;
+  lpm_soa_fixed = lpm_soa_scalar_fixed;
+  pwm_soa_fixed = pwm_soa_scalar_fixed;
+  kernel_name = "scalar";
+  if (!auto_select && !strcmp(name, "scalar"))
+    return 0;
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if ((auto_select || !strcmp(name, "avx512")) && __builtin_cpu_supports("avx512f")) {
+    lpm_scan_any = lpm_scan_avx512;
+    pwm_scan_any = pwm_scan_avx512;
+    lpm_scan_fixed = lpm_scan_avx512_fixed;
+    pwm_scan_fixed = pwm_scan_avx512_fixed;
+    lpm_kmer_scan = lpm_kmer_avx2;
+    pwm_kmer_scan = pwm_kmer_avx2;
+    lpm_soa_any = lpm_soa_avx512;
+    pwm_soa_any = pwm_soa_avx512;
+    lpm_soa_fixed = lpm_soa_avx512_fixed;
+    pwm_soa_fixed = pwm_soa_avx512_fixed;
+    kernel_name = "avx512";
+    return 0;
+  }
+  if ((auto_select || !strcmp(name, "avx2")) && __builtin_cpu_supports("avx2")) {
+    lpm_scan_any = lpm_scan_avx2;
+    pwm_scan_any = pwm_scan_avx2;
+    lpm_scan_fixed = lpm_scan_avx2_fixed;
+    pwm_scan_fixed = pwm_scan_avx2_fixed;
+    lpm_kmer_scan = lpm_kmer_avx2;
+    pwm_kmer_scan = pwm_kmer_avx2;
+    lpm_soa_any = lpm_soa_avx2;
+    pwm_soa_any = pwm_soa_avx2;
+    lpm_soa_fixed = lpm_soa_avx2_fixed;
+    pwm_soa_fixed = pwm_soa_avx2_fixed;
+    kernel_name = "avx2";
+    return 0;
+  }
+#endif
+  if (auto_select)
+    return 0;
+  fprintf(stderr, "Scanning kernel \"%s\" is not supported on this CPU\n", name);
+  return -1;
+}
+
+/* The kernels are selected once per process, before the first context */
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void
+select_default_kernels(void)
+{
+  select_kernels(NULL);
+}
+
+/* Scanning kernels of the selected instruction set, specialized on the
+   motif length when there is an instance for it */
+static inline void
+lpm_scan(const uint64_t *bits, int p, int n, const double *tab, int len, double *out)
+{
+  if (len >= SPEC_MIN_LEN && len <= SPEC_MAX_LEN)
+    lpm_scan_fixed[len](bits, p, n, tab, len, out);
+  else
+    lpm_scan_any(bits, p, n, tab, len, out);
+}
+
+static inline void
+pwm_scan(const uint64_t *bits, int p, int n, const int *tab, int len, int *out)
+{
+  if (len >= SPEC_MIN_LEN && len <= SPEC_MAX_LEN)
+    pwm_scan_fixed[len](bits, p, n, tab, len, out);
+  else
+    pwm_scan_any(bits, p, n, tab, len, out);
+}
+
+static inline void
+lpm_soa_scan(const unsigned char *c, int n, const double *tab, int len, double *out)
+{
+  if (len >= SPEC_MIN_LEN && len <= SPEC_MAX_LEN)
+    lpm_soa_fixed[len](c, n, tab, len, out);
+  else
+    lpm_soa_any(c, n, tab, len, out);
+}
+
+static inline void
+pwm_soa_scan(const unsigned char *c, int n, const int *tab, int len, int *out)
+{
+  if (len >= SPEC_MIN_LEN && len <= SPEC_MAX_LEN)
+    pwm_soa_fixed[len](c, n, tab, len, out);
+  else
+    pwm_soa_any(c, n, tab, len, out);
+}
+
+/* Length of the leading stretch of windows of length len in [i, end) that
+   are either all free of N (returned as a positive length) or all
+   overlapping an N run (returned as a negative length); *r is the first N
+   run not yet passed */
+static int
+next_window_segment(const seq_t *seq, int *r, int i, int end, int len)
+{
+  int de;
+
+  if (*r >= seq->nrun_cnt || seq->nrun[2 * *r] - len + 1 > i) {
+    int ce = (*r < seq->nrun_cnt) ? seq->nrun[2 * *r] - len + 1 : end;
+    return (ce < end ? ce : end) - i;
+  }
+  /* Windows [s-len+1, e) overlap the N run [s, e); merge close runs */
+  de = seq->nrun[2 * *r + 1];
+  for ((*r)++; *r < seq->nrun_cnt && seq->nrun[2 * *r] - len + 1 <= de; (*r)++)
+    de = seq->nrun[2 * *r + 1];
+  return i - (de < end ? de : end);
+}
+
+/* Index of the k-mer starting at every position p, ..., p+n-1 */
+static void
+kmer_index(const uint64_t *bits, int p, int n, int k, int *idx)
+{
+  uint64_t mask = ((uint64_t)1 << (2 * k)) - 1;
+  int i;
+
+  for (i = 0; i < n; i++)
+    idx[i] = (int)(seq_bits64(bits, p + i) & mask);
+}
+
+/* Score N-free windows with the k-mer lookup tables (see kmer_tab_t): the
+   k-mer starting at every position is extracted once into code_buf, then
+   each window multiplies (adds) one table entry per column group.  The
+   integer scores are identical to the column by column ones; the LPM
+   products may differ in the last bits, since the columns of a group are
+   multiplied together first. */
+static void
+lpm_scan_kmer(ms_scanner_t *sc, const uint64_t *bits, int p, int n, const kmer_tab_t *kt, double *out)
+{
+  kmer_index(bits, p, n + (kt->ngrp - 1) * kt->k, kt->k, sc->code_buf);
+  lpm_kmer_scan(sc->code_buf, n, kt, out);
+}
+
+static void
+pwm_scan_kmer(ms_scanner_t *sc, const uint64_t *bits, int p, int n, const kmer_tab_t *kt, int *out)
+{
+  kmer_index(bits, p, n + (kt->ngrp - 1) * kt->k, kt->k, sc->code_buf);
+  pwm_kmer_scan(sc->code_buf, n, kt, out);
+}
+
+/* Score the n windows starting at position p, using the packed (or k-mer,
+   when kt has tables) kernel for N-free stretches and the scalar one on
+   unpacked codes elsewhere */
+static void
+lpm_scan_windows(ms_scanner_t *sc, const seq_t *seq, int p, int n, const double *tab, const kmer_tab_t *kt, int len, double *out)
+{
+  int r = seq_nrun_after(seq, p);
+  int i = p;
+
+  while (i < p + n) {
+    int seg = next_window_segment(seq, &r, i, p + n, len);
+    if (seg > 0) {
+      if (kt->k > 0)
+        lpm_scan_kmer(sc, seq->bits, i, seg, kt, out + i - p);
+      else
+        lpm_scan(seq->bits, i, seg, tab, len, out + i - p);
+    } else {
+      seg = -seg;
+      seq_unpack(seq, i, seg + len - 1, sc->code_buf);
+      lpm_scan_codes(sc->code_buf, seg, tab, len, out + i - p);
+    }
+    i += seg;
+  }
+}
+
+static void
+pwm_scan_windows(ms_scanner_t *sc, const seq_t *seq, int p, int n, const int *tab, const kmer_tab_t *kt, int len, int *out)
+{
+  int r = seq_nrun_after(seq, p);
+  int i = p;
+
+  while (i < p + n) {
+    int seg = next_window_segment(seq, &r, i, p + n, len);
+    if (seg > 0) {
+      if (kt->k > 0)
+        pwm_scan_kmer(sc, seq->bits, i, seg, kt, out + i - p);
+      else
+        pwm_scan(seq->bits, i, seg, tab, len, out + i - p);
+    } else {
+      seg = -seg;
+      seq_unpack(seq, i, seg + len - 1, sc->code_buf);
+      pwm_scan_codes(sc->code_buf, seg, tab, len, out + i - p);
+    }
+    i += seg;
+  }
+}
+
+/* Best strand of n windows: max[k] receives the larger of the forward and
+   reverse scores and rev_best[k] (if not NULL) whether the reverse strand
+   won.  The loops have no branches, and max may alias rev. */
+static void
+lpm_merge_strands(const double *fwd, const double *rev, int n, double *max, unsigned char *rev_best)
+{
+  int k;
+
+  for (k = 0; k < n; k++) {
+    double f = fwd[k];
+    double m = f > rev[k] ? f : rev[k];
+    if (rev_best != NULL)
+      rev_best[k] = m != f;
+    max[k] = m;
+  }
+}
+
+static void
+pwm_merge_strands(const int *fwd, const int *rev, int n, int *max, unsigned char *rev_best)
+{
+  int k;
+
+  for (k = 0; k < n; k++) {
+    int f = fwd[k];
+    /* Highest bit of the (wrapping) difference: 1 = reverse strand is better */
+    int r = (int)((unsigned int)f - (unsigned int)rev[k]) < 0;
+    if (rev_best != NULL)
+      rev_best[k] = (unsigned char)r;
+    max[k] = r ? rev[k] : f;
+  }
+}
+
+/* Scores of the n windows starting at p, on the best strand (both strands
+   unless --forward) and which strand it is: forward and bidirectional scans
+   share the same forward kernel, run on the reverse complement table for
+   the negative strand */
+static const double *
+lpm_best_windows(ms_scanner_t *sc, const seq_t *seq, int p, int n, motif_p_t m, const unsigned char **rev_best)
+{
+  lpm_scan_windows(sc, seq, p, n, m->lpm_fwd, &m->kmer_fwd, m->len, sc->lpm_win[0]);
+  if (sc->opt.forward) {
+    *rev_best = fwd_strand;
+    return sc->lpm_win[0];
+  }
+  lpm_scan_windows(sc, seq, p, n, m->lpm_rev, &m->kmer_rev, m->len, sc->lpm_win[1]);
+  lpm_merge_strands(sc->lpm_win[0], sc->lpm_win[1], n, sc->lpm_win[1], sc->strand_win);
+  *rev_best = sc->strand_win;
+  return sc->lpm_win[1];
+}
+
+static const int *
+pwm_best_windows(ms_scanner_t *sc, const seq_t *seq, int p, int n, motif_p_t m, const unsigned char **rev_best)
+{
+  pwm_scan_windows(sc, seq, p, n, m->pwm_fwd, &m->kmer_fwd, m->len, sc->pwm_win[0]);
+  if (sc->opt.forward) {
+    *rev_best = fwd_strand;
+    return sc->pwm_win[0];
+  }
+  pwm_scan_windows(sc, seq, p, n, m->pwm_rev, &m->kmer_rev, m->len, sc->pwm_win[1]);
+  pwm_merge_strands(sc->pwm_win[0], sc->pwm_win[1], n, sc->pwm_win[1], sc->strand_win);
+  *rev_best = sc->strand_win;
+  return sc->pwm_win[1];
+}
+
+/*
+  Multi-motif kernels.
+
+  All motifs of a group are scored on the same window before moving to the
+  next one: the MOTIF_GROUP running products (sums) stay in registers and
+  each motif column costs one contiguous load of the interleaved table row.
+  Windows are read from unpacked codes padded with A beyond the sequence
+  end, which the neutral padding columns of shorter motifs ignore; the
+  caller drops the windows that do not fit a motif.  Per motif, the results
+  are identical to the single-motif kernels.
+*/
+static void
+lpm_scan_group(const int *s, int n, const double *tab, int len, double *out)
+{
+  int i, j, k;
+
+  for (i = 0; i < n; i++) {
+    double prod[MOTIF_GROUP];
+    for (k = 0; k < MOTIF_GROUP; k++)
+      prod[k] = 1.0;
+    for (j = 0; j < len; j++) {
+      const double *row = tab + ((size_t)j*NUCL + s[i+j])*MOTIF_GROUP;
+      for (k = 0; k < MOTIF_GROUP; k++)
+        prod[k] *= row[k];
+    }
+    for (k = 0; k < MOTIF_GROUP; k++)
+      out[i*MOTIF_GROUP + k] = prod[k];
+  }
+}
+
+static void
+pwm_scan_group(const int *s, int n, const int *tab, int len, int *out)
+{
+  int i, j, k;
+
+  for (i = 0; i < n; i++) {
+    unsigned int score[MOTIF_GROUP];
+    for (k = 0; k < MOTIF_GROUP; k++)
+      score[k] = 0;
+    for (j = 0; j < len; j++) {
+      const int *row = tab + ((size_t)j*NUCL + s[i+j])*MOTIF_GROUP;
+      for (k = 0; k < MOTIF_GROUP; k++)
+        score[k] += (unsigned int)row[k];
+    }
+    for (k = 0; k < MOTIF_GROUP; k++)
+      out[i*MOTIF_GROUP + k] = (int)score[k];
+  }
+}
+
+/* Append a tied best-hit position to the comma-separated best_pos list */
+static void
+append_best_pos(ms_scanner_t *sc, int pos)
+{
+  if (sc->best_pos_len + 16 > sc->best_pos_size) {
+    sc->best_pos_size *= 2;
+    if ((sc->best_pos = realloc(sc->best_pos, sc->best_pos_size)) == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+  }
+  sc->best_pos_len += (size_t)sprintf(sc->best_pos + sc->best_pos_len, ",%d", pos);
+}
+
+/* Set the background to the nucleotide composition of the sequence (-q) */
+static void
+seq_background(ms_scanner_t *sc, seq_p_t seq)
+{
+  int i;
+  int nucl_cnt[] = {0, 0, 0, 0, 0};
+
+  seq_count(seq, nucl_cnt);
+  if (sc->opt.forward) {
+    for (i = 0; i < NUCL-1; i++) {
+      if (sc->opt.debug != 0)
+        fprintf(stderr, "nucl_cnt[%d] = %d ; seq LEN = %d\n", i, nucl_cnt[i], seq->len); 
+      sc->bg[i] = (double)nucl_cnt[i]/(double)seq->len;
+    }
+  } else {
+    double bcomp_at = (double) ((double)((double)((nucl_cnt[0]+nucl_cnt[3])/2)+(double)nucl_cnt[4]/4)/(double)seq->len);
+    sc->bg[0] = bcomp_at;
+    sc->bg[1] = (double) 0.5 - bcomp_at;
+    sc->bg[2] = (double) 0.5 - bcomp_at;
+    sc->bg[3] = bcomp_at;
+  }
+  if (sc->opt.debug != 0) {
+    fprintf(stderr, "Background nucleotide frequencies: ");
+    for (i = 0; i < NUCL; i++) {
+      fprintf(stderr, "sc->bg[%i] = %f ", i, sc->bg[i]);
+    }
+    fprintf(stderr, "\n\n");
+  }
+  build_lpm_tables(sc);
+}
+
+/*
+  Binary score output (--output-format binary): a 16-byte header (the 8
+  characters of MS_SCORE_MAGIC, then the number of columns and a reserved
+  word, both 32-bit little-endian) followed by one row per sequence of one
+  little-endian float64 per column.  The number of rows follows from the
+  file size.  In R:
+
+    con <- file(fn, "rb"); readChar(con, 8, useBytes=TRUE)
+    ncol <- readBin(con, "integer", n=2, size=4, endian="little")[1]
+    matrix(readBin(con, "double", n=(file.size(fn) - 16) / 8, size=8, endian="little"),
+           ncol=ncol, byrow=TRUE)
+*/
+static void
+write_binary_header(out_writer_t *out, int ncols)
+{
+  unsigned char hdr[16];
+  int i;
+
+  memcpy(hdr, MS_SCORE_MAGIC, 8);
+  for (i = 0; i < 4; i++) {
+    hdr[8 + i] = (unsigned char)((uint32_t)ncols >> (8*i));
+    hdr[12 + i] = 0;
+  }
+  out_write(out, hdr, sizeof(hdr));
+}
+
+static void
+write_binary_score(out_writer_t *out, double score)
+{
+  unsigned char buf[8];
+  uint64_t bits;
+  int i;
+
+  memcpy(&bits, &score, sizeof(bits));
+  for (i = 0; i < 8; i++)
+    buf[i] = (unsigned char)(bits >> (8*i));
+  out_write(out, buf, sizeof(buf));
+}
+
+/* Write one score of the binary output, or store it (ms_score_values) */
+static void
+write_score(ms_scanner_t *sc, out_writer_t *out, double score)
+{
+  if (sc->scores != NULL)
+    *sc->scores++ = score;
+  else
+    write_binary_score(out, score);
+}
+
+static void
+print_seq_codes(seq_p_t seq, const char *prefix)
+{
+  int i;
+
+  fprintf(stderr, "%s", prefix);
+  for (i = 0; i < seq->len; i++) {
+    fprintf(stderr, "%d", seq_base(seq, i));
+  }
+  fprintf(stderr, "\n");
+}
+
+/* Score of the LPM window at pos in the order of the original scoring
+   loop, prod*lpm/bg one column at a time (the reverse strand product in
+   *rprod, unless --forward).  The score tables hold the ratios lpm/bg,
+   whose products round differently when the background is not a power of
+   two */
+static double
+lpm_exact(const ms_scanner_t *sc, const seq_t *seq, const motif_t *m, int pos, double *rprod)
+{
+  double prod = 1.0, prod_rcomp = 1.0;
+  int j;
+
+  for (j = 0; j < m->len; j++) {
+    int c = seq_base(seq, pos + j);
+    prod = prod * m->lpm[c][j]/sc->bg[c];
+    if (!sc->opt.forward) {
+      int idx = (c == 4) ? 4 : 3 - c;
+      prod_rcomp = prod_rcomp * m->lpm[idx][m->len-j-1]/sc->bg[idx];
+    }
+  }
+  *rprod = prod_rcomp;
+  return prod;
+}
+
+/* Record an LPM window score of the best-hit scan: a new best hit, or a
+   tie whose position is appended to the list.  max is the window score of
+   a kernel (best strand); the windows that come within the rounding margin
+   of the best hit are scored again by lpm_exact, so that the best score,
+   its ties and their strands are those of the original loop whatever the
+   kernel */
+static void
+lpm_hit(ms_scanner_t *sc, const seq_t *seq, const motif_t *m, double max, int pos, double *best, char *strand)
+{
+  double floor = *best > sc->opt.min_score ? *best : sc->opt.min_score;
+  double prod, rprod;
+  int rev;
+
+  if (max * (1.0 + BOUND_SLACK) < floor)
+    return;
+  prod = lpm_exact(sc, seq, m, pos, &rprod);
+  max = (sc->opt.forward || prod > rprod) ? prod : rprod;
+  rev = max != prod;
+  if (max < sc->opt.min_score)
+    return;
+  if (max > *best) {
+    *best = max;
+    if (rev) {
+      *strand = '-';
+      sc->best_pos_len = out_fmt_int(sc->best_pos, sc->pos_off + pos + m->len);
+    } else {
+      *strand = '+';
+      sc->best_pos_len = out_fmt_int(sc->best_pos, sc->pos_off + pos);
+    }
+  } else if (max == *best && max != 0.0) {
+    append_best_pos(sc, sc->pos_off + (rev ? pos + m->len : pos));
+  }
+}
+
+/* Same for PWM windows: only the first best hit is kept */
+static void
+pwm_hit(int max, int rev, int pos, int *best, int *match_pos, int *strand)
+{
+  if (max > *best) {
+    *best = max;
+    *match_pos = pos;
+    *strand = rev;
+  }
+}
+
+/* Best PWM score below the hits: one less than --min-score, or INT_MIN */
+static int
+pwm_floor(ms_scanner_t *sc)
+{
+  if (sc->opt.min_score <= (double)INT_MIN + 1)
+    return INT_MIN;
+  if (sc->opt.min_score > (double)INT_MAX)
+    return INT_MAX;
+  return (int)ceil(sc->opt.min_score) - 1;
+}
+
+/* Whether the prefix bounds of m are usable (no k-mer tables, finite) */
+static int
+bound_usable(const ms_options_t *opt, const motif_t *m)
+{
+  return m->kmer_fwd.k == 0 && m->bound_fwd.ok && (opt->forward || m->bound_rev.ok);
+}
+
+/* Whether the best-hit scans of m can use branch and bound */
+static int
+motif_bound(const ms_options_t *opt, const motif_t *m)
+{
+  return opt->bound && bound_usable(opt, m);
+}
+
+/* Complete the prefix score part of the window at pos, from column from
+   on, in the column order of the scanning kernels */
+static double
+lpm_finish(const uint64_t *bits, int pos, const double *tab, int from, int len, double part)
+{
+  int j;
+
+  for (j = from; j < len; j++)
+    part *= tab[j*NUCL + seq_get2(bits, pos + j)];
+  return part;
+}
+
+static int
+pwm_finish(const uint64_t *bits, int pos, const int *tab, int from, int len, int part)
+{
+  unsigned int score = (unsigned int)part;
+  int j;
+
+  for (j = from; j < len; j++)
+    score += (unsigned int)tab[j*NUCL + seq_get2(bits, pos + j)];
+  return (int)score;
+}
+
+/* Best-hit scan of the n windows starting at p by branch and bound (see
+   bound_tab_t).  Windows with N are scored in full.  The hits are those of
+   the full scan, ties included. */
+static void
+lpm_bound_block(ms_scanner_t *sc, const seq_t *seq, int p, int n, motif_p_t m, double *best, char *strand)
+{
+  const bound_tab_t *bf = &m->bound_fwd;
+  const bound_tab_t *br = &m->bound_rev;
+  int run = seq_nrun_after(seq, p);
+  int i = p, k;
+
+  while (i < p + n) {
+    int seg = next_window_segment(seq, &run, i, p + n, m->len);
+    if (seg < 0) {
+      const unsigned char *rev_best;
+      const double *win;
+      seg = -seg;
+      win = lpm_best_windows(sc, seq, i, seg, m, &rev_best);
+      for (k = 0; k < seg; k++)
+        lpm_hit(sc, seq, m, win[k], i + k, best, strand);
+    } else {
+      lpm_scan(seq->bits, i, seg, m->lpm_fwd, bf->cols, sc->lpm_win[0]);
+      if (!sc->opt.forward)
+        lpm_scan(seq->bits, i, seg, m->lpm_rev, br->cols, sc->lpm_win[1]);
+      for (k = 0; k < seg; k++) {
+        double floor = *best > sc->opt.min_score ? *best : sc->opt.min_score;
+        double prod = sc->lpm_win[0][k], rprod = 0.0;
+        int hf = !(prod * bf->lpm_rest + bf->lpm_err < floor);
+        int hr = !sc->opt.forward && !(sc->lpm_win[1][k] * br->lpm_rest + br->lpm_err < floor);
+        if (!hf && !hr)
+          continue;
+        prod = hf ? lpm_finish(seq->bits, i + k, m->lpm_fwd, bf->cols, m->len, prod) : 0.0;
+        if (hr)
+          rprod = lpm_finish(seq->bits, i + k, m->lpm_rev, br->cols, m->len, sc->lpm_win[1][k]);
+        lpm_hit(sc, seq, m, prod > rprod ? prod : rprod, i + k, best, strand);
+      }
+    }
+    i += seg;
+  }
+}
+
+static void
+pwm_bound_block(ms_scanner_t *sc, const seq_t *seq, int p, int n, motif_p_t m, int *best, int *match_pos, int *strand)
+{
+  const bound_tab_t *bf = &m->bound_fwd;
+  const bound_tab_t *br = &m->bound_rev;
+  int run = seq_nrun_after(seq, p);
+  int i = p, k;
+
+  while (i < p + n) {
+    int seg = next_window_segment(seq, &run, i, p + n, m->len);
+    if (seg < 0) {
+      const unsigned char *rev_best;
+      const int *win;
+      seg = -seg;
+      win = pwm_best_windows(sc, seq, i, seg, m, &rev_best);
+      for (k = 0; k < seg; k++)
+        pwm_hit(win[k], rev_best[k], i + k, best, match_pos, strand);
+    } else {
+      pwm_scan(seq->bits, i, seg, m->pwm_fwd, bf->cols, sc->pwm_win[0]);
+      if (!sc->opt.forward)
+        pwm_scan(seq->bits, i, seg, m->pwm_rev, br->cols, sc->pwm_win[1]);
+      for (k = 0; k < seg; k++) {
+        int score = sc->pwm_win[0][k], rscore = 0, rev;
+        int hf = score + bf->pwm_rest > *best;
+        int hr = !sc->opt.forward && sc->pwm_win[1][k] + br->pwm_rest > *best;
+        if (!hf && !hr)
+          continue;
+        if (hf)
+          score = pwm_finish(seq->bits, i + k, m->pwm_fwd, bf->cols, m->len, score);
+        if (hr)
+          rscore = pwm_finish(seq->bits, i + k, m->pwm_rev, br->cols, m->len, sc->pwm_win[1][k]);
+        if (hf && hr)
+          rev = (int)((unsigned int)score - (unsigned int)rscore) < 0;
+        else
+          rev = hr;
+        pwm_hit(rev ? rscore : score, rev, i + k, best, match_pos, strand);
+      }
+    }
+    i += seg;
+  }
+}
+
+/* Write the best LPM hit of a sequence (best_pos holds its position(s)) */
+static void
+lpm_write_best(ms_scanner_t *sc, const seq_t *seq, double best_score, char strand, out_writer_t *out)
+{
+  if (sc->opt.debug != 0)
+    fprintf(stderr, "%s\t%e\t%d\t%s\t%c\n", seq->hdr, best_score, seq->len, sc->best_pos, strand);
+
+  if (sc->opt.binary)
+    write_score(sc, out, best_score);
+  else {
+    if (sc->opt.nohdr == 0) {
+      out_str(out, seq->hdr);
+      out_char(out, '\t');
+    }
+    out_double(out, best_score);
+    out_char(out, '\t');
+    out_int(out, seq->len);
+    out_char(out, '\t');
+    out_write(out, sc->best_pos, sc->best_pos_len);
+    out_char(out, '\t');
+    out_char(out, strand);
+    out_char(out, '\n');
+  }
+}
+
+/* Write the sum of probabilities of a sequence */
+static void
+lpm_write_sum(ms_scanner_t *sc, const seq_t *seq, double sum, out_writer_t *out)
+{
+  if (sc->opt.debug != 0)
+    fprintf(stderr, "%s\t%e\n", seq->hdr, sum);
+
+  if (sc->opt.binary)
+    write_score(sc, out, sum);
+  else {
+    if (sc->opt.nohdr == 0) {
+      out_str(out, seq->hdr);
+      out_char(out, '\t');
+    }
+    out_double(out, sum);
+    out_char(out, '\n');
+  }
+}
+
+/* LPM windows [from, to) of a single motif: best hit or sum of
+   probabilities */
+static void
+lpm_scan_range(ms_scanner_t *sc, const seq_t *seq, int from, int to, motif_p_t m)
+{
+  int b, k;
+
+  if (sc->opt.bestscore) { // Compute the single best score
+    for (b = from; b < to; b += WIN_BLOCK) {
+      int n = (to - b < WIN_BLOCK) ? to - b : WIN_BLOCK;
+      if (motif_bound(&sc->opt, m)) {
+        lpm_bound_block(sc, seq, b, n, m, &sc->acc.lpm, &sc->acc.lpm_strand);
+      } else {
+        const unsigned char *rev_best;
+        const double *win = lpm_best_windows(sc, seq, b, n, m, &rev_best);
+        for (k = 0; k < n; k++)
+          lpm_hit(sc, seq, m, win[k], b + k, &sc->acc.lpm, &sc->acc.lpm_strand);
+      }
+    }
+  } else { // Compute sum of probabilities [both strands is the default]
+    double sum = sc->acc.lpm;
+    for (b = from; b < to; b += WIN_BLOCK) {
+      int n = (to - b < WIN_BLOCK) ? to - b : WIN_BLOCK;
+      lpm_scan_windows(sc, seq, b, n, m->lpm_fwd, &m->kmer_fwd, m->len, sc->lpm_win[0]);
+      if (sc->opt.forward) {
+        for (k = 0; k < n; k++)
+          sum = sum + sc->lpm_win[0][k];
+      } else {
+        lpm_scan_windows(sc, seq, b, n, m->lpm_rev, &m->kmer_rev, m->len, sc->lpm_win[1]);
+        for (k = 0; k < n; k++)
+          sum = sum + sc->lpm_win[0][k] + sc->lpm_win[1][k];
+      }
+    }
+    sc->acc.lpm = sum;
+  }
+}
+
+/* Write the motif match of the window starting at pos into tag, reverse
+   complemented when the match is on the negative strand */
+static void
+set_tag_match(ms_scanner_t *sc, char *tag, const seq_t *seq, int pos, int len, int strand)
+{
+  if (strand)
+    seq_decode_revcomp(seq, pos, len, sc->tag_rcomp, tag);
+  else
+    seq_decode(seq, pos, len, tag);
+  tag[len] = '\0';
+}
+
+/* Write the best PWM hit of a sequence, or a no match line */
+static void
+pwm_write_best(ms_scanner_t *sc, const seq_t *seq, motif_p_t m, int best_score, int match_pos, int strand, out_writer_t *out)
+{
+  int floor = pwm_floor(sc);
+
+  /* No window (or none reaching --min-score) */
+  if (seq->len < m->len || (floor > INT_MIN && best_score == floor)) {
+    if (sc->opt.binary)
+      write_score(sc, out, MIN_SCORE);
+    else {
+      if (sc->opt.nohdr == 0) {
+        out_str(out, seq->hdr);
+        out_char(out, '\t');
+      }
+      out_str(out, "0\t0\tNOTAG\t");
+      out_int(out, MIN_SCORE);
+      out_str(out, "\t0\n");
+    }
+    return;
+  }
+  /* Rebuild the matched sequence once, from the best hit, unless it was
+     kept as the sequence was streamed */
+  if (!sc->acc.tag_set)
+    set_tag_match(sc, sc->tag_match, seq, match_pos, m->len, strand);
+  char str;
+  if (strand)
+    str = '-';
+  else
+    str = '+';
+  int match_end = match_pos + m->len;
+  if (sc->opt.debug != 0)
+    fprintf(stderr, "%s\t%d\t%d\t%s\t%d\t%c\n", seq->hdr, match_pos, match_end, sc->tag_match, best_score, str);
+
+  if (sc->opt.binary)
+    write_score(sc, out, best_score);
+  else {
+    if (sc->opt.nohdr == 0) {
+      out_str(out, seq->hdr);
+      out_char(out, '\t');
+    }
+    out_int(out, match_pos);
+    out_char(out, '\t');
+    out_int(out, match_end);
+    out_char(out, '\t');
+    out_write(out, sc->tag_match, (size_t)m->len);
+    out_char(out, '\t');
+    out_int(out, best_score);
+    out_char(out, '\t');
+    out_char(out, str);
+    out_char(out, '\n');
+  }
+}
+
+/* PWM windows [from, to) of a single motif: best hit */
+static void
+pwm_scan_range(ms_scanner_t *sc, const seq_t *seq, int from, int to, motif_p_t m)
+{
+  int b, k;
+  int best_score = sc->acc.pwm;
+  int match_pos = sc->acc.pwm_pos;
+  int strand = sc->acc.pwm_rev;
+
+  for (b = from; b < to; b += WIN_BLOCK) {
+    int n = (to - b < WIN_BLOCK) ? to - b : WIN_BLOCK;
+    if (motif_bound(&sc->opt, m)) {
+      pwm_bound_block(sc, seq, b, n, m, &best_score, &match_pos, &strand);
+    } else {
+      const unsigned char *rev_best;
+      const int *win = pwm_best_windows(sc, seq, b, n, m, &rev_best);
+      for (k = 0; k < n; k++)
+        pwm_hit(win[k], rev_best[k], b + k, &best_score, &match_pos, &strand);
+    }
+  }
+  sc->acc.pwm = best_score;
+  sc->acc.pwm_pos = match_pos;
+  sc->acc.pwm_rev = strand;
+}
+
+/*
+  Threshold hit reporting (--threshold, --pvalue).
+
+  Every window scoring at least the threshold is written as one record:
+  sequence index (0-based, in the order of the scored sequences), window
+  start on the forward strand, strand and score; with --output-format
+  binary, four float64 per record (strand +1/-1).  The windows of long LPMs
+  are first scored on the columns of the prefix bound only (see
+  bound_tab_t), and completed only if they may still reach the threshold,
+  so that most sub-threshold windows cost a partial kernel pass and one
+  comparison.  Shorter LPMs and integer PWMs are cheaper to scan in full.
+*/
+static void
+write_site(ms_scanner_t *sc, out_writer_t *out, const seq_t *seq, long idx, int pos, int rev)
+{
+  if (sc->opt.binary) {
+    write_score(sc, out, (double)idx);
+    write_score(sc, out, sc->pos_off + pos);
+    write_score(sc, out, rev ? -1.0 : 1.0);
+    return;
+  }
+  if (sc->opt.nohdr == 0) {
+    out_str(out, seq->hdr);
+    out_char(out, '\t');
+  }
+  out_int(out, idx);
+  out_char(out, '\t');
+  out_int(out, sc->pos_off + pos);
+  out_char(out, '\t');
+  out_char(out, rev ? '-' : '+');
+  out_char(out, '\t');
+}
+
+/* Lowest integer PWM score reaching the threshold */
+static int
+pwm_threshold(ms_scanner_t *sc)
+{
+  if (sc->opt.threshold <= (double)INT_MIN)
+    return INT_MIN;
+  if (sc->opt.threshold > (double)INT_MAX)
+    return INT_MAX;
+  return (int)ceil(sc->opt.threshold);
+}
+
+static void
+lpm_sites_block(ms_scanner_t *sc, const seq_t *seq, int p, int n, motif_p_t m, long idx, out_writer_t *out)
+{
+  double thr = sc->opt.threshold;
+  int ns = sc->opt.forward ? 1 : 2;
+  int filter = m->len >= SITES_FILTER_LEN && bound_usable(&sc->opt, m);
+  int run = seq_nrun_after(seq, p);
+  int i = p, k, s;
+
+  while (i < p + n) {
+    int seg = next_window_segment(seq, &run, i, p + n, m->len);
+    int cnt = seg < 0 ? -seg : seg;
+    for (s = 0; s < ns; s++) {
+      const double *tab = s ? m->lpm_rev : m->lpm_fwd;
+      const bound_tab_t *bt = s ? &m->bound_rev : &m->bound_fwd;
+      double *win = sc->lpm_win[s];
+      if (seg < 0 || !filter) {
+        lpm_scan_windows(sc, seq, i, cnt, tab, s ? &m->kmer_rev : &m->kmer_fwd, m->len, win);
+        continue;
+      }
+      lpm_scan(seq->bits, i, cnt, tab, bt->cols, win);
+      for (k = 0; k < cnt; k++) {
+        if (win[k] * bt->lpm_rest + bt->lpm_err < thr)
+          win[k] = -HUGE_VAL;
+        else
+          win[k] = lpm_finish(seq->bits, i + k, tab, bt->cols, m->len, win[k]);
+      }
+    }
+    for (k = 0; k < cnt; k++) {
+      for (s = 0; s < ns; s++) {
+        if (sc->lpm_win[s][k] >= thr) {
+          write_site(sc, out, seq, idx, i + k, s);
+          if (sc->opt.binary)
+            write_score(sc, out, sc->lpm_win[s][k]);
+          else {
+            out_double(out, sc->lpm_win[s][k]);
+            out_char(out, '\n');
+          }
+        }
+      }
+    }
+    i += cnt;
+  }
+}
+
+/* PWM windows with N are never reported (their INT_MIN scores wrap) */
+static void
+pwm_sites_block(ms_scanner_t *sc, const seq_t *seq, int p, int n, motif_p_t m, long idx, out_writer_t *out)
+{
+  int thr = pwm_threshold(sc);
+  int ns = sc->opt.forward ? 1 : 2;
+  int run = seq_nrun_after(seq, p);
+  int i = p, k, s;
+
+  while (i < p + n) {
+    int seg = next_window_segment(seq, &run, i, p + n, m->len);
+    if (seg < 0) {
+      i -= seg;
+      continue;
+    }
+    pwm_scan_windows(sc, seq, i, seg, m->pwm_fwd, &m->kmer_fwd, m->len, sc->pwm_win[0]);
+    if (!sc->opt.forward)
+      pwm_scan_windows(sc, seq, i, seg, m->pwm_rev, &m->kmer_rev, m->len, sc->pwm_win[1]);
+    for (k = 0; k < seg; k++) {
+      for (s = 0; s < ns; s++) {
+        if (sc->pwm_win[s][k] >= thr) {
+          write_site(sc, out, seq, idx, i + k, s);
+          if (sc->opt.binary)
+            write_score(sc, out, sc->pwm_win[s][k]);
+          else {
+            out_int(out, sc->pwm_win[s][k]);
+            out_char(out, '\n');
+          }
+        }
+      }
+    }
+    i += seg;
+  }
+}
+
+static void
+sites_scan_range(ms_scanner_t *sc, const seq_t *seq, int from, int to, long idx, motif_p_t m, out_writer_t *out)
+{
+  int b;
+
+  for (b = from; b < to; b += WIN_BLOCK) {
+    int n = (to - b < WIN_BLOCK) ? to - b : WIN_BLOCK;
+    if (sc->opt.lpm)
+      lpm_sites_block(sc, seq, b, n, m, idx, out);
+    else
+      pwm_sites_block(sc, seq, b, n, m, idx, out);
+  }
+}
+
+/* Score the windows [from, to) against all motifs in one pass: windows are
+   unpacked once per block and scanned by every motif group.  One score per
+   motif is reported: the sum of probabilities, or the best score with -b
+   and --pwm. */
+static void
+multi_scan_range(ms_scanner_t *sc, const seq_t *seq, int from, int to)
+{
+  const ms_context_t *ctx = sc->ctx;
+  int i, b, k, g;
+
+  for (b = from; b < to; b += WIN_BLOCK) {
+    int n = (to - b < WIN_BLOCK) ? to - b : WIN_BLOCK;
+    int avail = seq->len - b < n + ctx->maxLen - 1 ? seq->len - b : n + ctx->maxLen - 1;
+    seq_unpack(seq, b, avail, sc->code_buf);
+    for (i = avail; i < n + ctx->maxLen - 1; i++)
+      sc->code_buf[i] = 0;
+    for (g = 0; g < ctx->groupCnt; g++) {
+      motif_group_p_t grp = &sc->groups[g];
+      const double *lpm_max = sc->group_lpm_win[0];
+      const int *pwm_max = sc->group_pwm_win[0];
+      if (sc->opt.lpm) {
+        lpm_scan_group(sc->code_buf, n, grp->lpm_fwd, grp->maxLen, sc->group_lpm_win[0]);
+        if (!sc->opt.forward) {
+          lpm_scan_group(sc->code_buf, n, grp->lpm_rev, grp->maxLen, sc->group_lpm_win[1]);
+          if (sc->opt.bestscore) {
+            lpm_merge_strands(sc->group_lpm_win[0], sc->group_lpm_win[1], n * MOTIF_GROUP, sc->group_lpm_win[1], NULL);
+            lpm_max = sc->group_lpm_win[1];
+          }
+        }
+      } else {
+        pwm_scan_group(sc->code_buf, n, grp->pwm_fwd, grp->maxLen, sc->group_pwm_win[0]);
+        if (!sc->opt.forward) {
+          pwm_scan_group(sc->code_buf, n, grp->pwm_rev, grp->maxLen, sc->group_pwm_win[1]);
+          pwm_merge_strands(sc->group_pwm_win[0], sc->group_pwm_win[1], n * MOTIF_GROUP, sc->group_pwm_win[1], NULL);
+          pwm_max = sc->group_pwm_win[1];
+        }
+      }
+      for (i = 0; i < grp->cnt; i++) {
+        int idx = (int)(grp->m[i] - sc->motifs);
+        /* Windows of this motif that fit in the sequence */
+        int last = seq->len - grp->m[i]->len - b + 1;
+        int cnt = last < n ? last : n;
+        for (k = 0; k < cnt; k++) {
+          int at = k*MOTIF_GROUP + i;
+          if (!sc->opt.lpm) {
+            if (pwm_max[at] > sc->multi_pwm[idx])
+              sc->multi_pwm[idx] = pwm_max[at];
+          } else if (sc->opt.bestscore) {
+            if (lpm_max[at] > sc->multi_lpm[idx])
+              sc->multi_lpm[idx] = lpm_max[at];
+          } else if (sc->opt.forward) {
+            sc->multi_lpm[idx] = sc->multi_lpm[idx] + sc->group_lpm_win[0][at];
+          } else {
+            sc->multi_lpm[idx] = sc->multi_lpm[idx] + sc->group_lpm_win[0][at] + sc->group_lpm_win[1][at];
+          }
+        }
+      }
+    }
+  }
+}
+
+static void
+multi_write(ms_scanner_t *sc, const seq_t *seq, out_writer_t *out)
+{
+  const ms_context_t *ctx = sc->ctx;
+  int i;
+
+  if (sc->opt.binary) {
+    for (i = 0; i < ctx->motifCnt; i++)
+      write_score(sc, out, sc->opt.lpm ? sc->multi_lpm[i] : sc->multi_pwm[i]);
+    return;
+  }
+  if (sc->opt.nohdr == 0)
+    out_str(out, seq->hdr);
+  for (i = 0; i < ctx->motifCnt; i++) {
+    if (i > 0 || sc->opt.nohdr == 0)
+      out_char(out, '\t');
+    if (sc->opt.lpm)
+      out_double(out, sc->multi_lpm[i]);
+    else
+      out_int(out, sc->multi_pwm[i]);
+  }
+  out_char(out, '\n');
+}
+
+/* Length of the shortest windows scanned: those of the last windows of a
+   sequence */
+static int
+scan_len(const ms_scanner_t *sc)
+{
+  if (!sc->opt.sites && sc->ctx->motifCnt > 1)
+    return sc->ctx->minLen;
+  return sc->motifs[0].len;
+}
+
+/* Start the scan of a sequence */
+static void
+scan_begin(ms_scanner_t *sc)
+{
+  int i;
+
+  sc->acc.lpm = 0.0;
+  sc->acc.lpm_strand = '+';
+  sc->acc.pwm = pwm_floor(sc);
+  sc->acc.pwm_pos = 0;
+  sc->acc.pwm_rev = 0;
+  sc->acc.tag_set = 0;
+  sc->best_pos_len = out_fmt_int(sc->best_pos, 0);
+  sc->pos_off = 0;
+  for (i = 0; i < sc->ctx->motifCnt && sc->ctx->motifCnt > 1; i++) {
+    sc->multi_lpm[i] = 0.0;
+    sc->multi_pwm[i] = MIN_SCORE;
+  }
+}
+
+/* Scan the windows [from, to) of seq, in order; sites are written as they
+   are found */
+static void
+scan_windows(ms_scanner_t *sc, const seq_t *seq, int from, int to, long idx, out_writer_t *out)
+{
+  if (sc->opt.sites)
+    sites_scan_range(sc, seq, from, to, idx, &sc->motifs[0], out);
+  else if (sc->ctx->motifCnt > 1)
+    multi_scan_range(sc, seq, from, to);
+  else if (sc->opt.lpm)
+    lpm_scan_range(sc, seq, from, to, &sc->motifs[0]);
+  else
+    pwm_scan_range(sc, seq, from, to, &sc->motifs[0]);
+}
+
+/* Write the score line(s) of a sequence once all its windows are scanned */
+static void
+scan_end(ms_scanner_t *sc, const seq_t *seq, out_writer_t *out)
+{
+  if (sc->opt.sites)
+    return;
+  if (sc->ctx->motifCnt > 1)
+    multi_write(sc, seq, out);
+  else if (!sc->opt.lpm)
+    pwm_write_best(sc, seq, &sc->motifs[0], sc->acc.pwm, sc->acc.pwm_pos, sc->acc.pwm_rev, out);
+  else if (sc->opt.bestscore)
+    lpm_write_best(sc, seq, sc->acc.lpm, sc->acc.lpm_strand, out);
+  else
+    lpm_write_sum(sc, seq, sc->acc.lpm, out);
+}
+
+/* Score one sequence (number idx of the scored ones) and write its score
+   line(s) to out */
+static void
+score_seq(ms_scanner_t *sc, seq_p_t seq, long idx, out_writer_t *out)
+{
+  if (sc->opt.debug != 0)
+    print_seq_codes(seq, !sc->opt.sites && (sc->opt.lpm || sc->ctx->motifCnt > 1) ? ">SEQ:  " : "> ");
+  if (sc->opt.lpm && sc->opt.seq_norm)
+    seq_background(sc, seq);
+  scan_begin(sc);
+  scan_windows(sc, seq, 0, seq->len - scan_len(sc) + 1, idx, out);
+  scan_end(sc, seq, out);
+}
+
+/* Whether seq can be scored by the batched kernels: no N, and at most one
+   block of windows */
+static int
+soa_seq(const ms_context_t *ctx, const seq_t *seq)
+{
+  int nwin = seq->len - ctx->motifs[0].len + 1;
+
+  return ctx->soa_ok && seq->nrun_cnt == 0 && nwin > 0 && nwin <= WIN_BLOCK;
+}
+
+/* Per-read results of the batched windows.  The strands are merged and
+   the best score (sum) of every lane is taken across lanes, then only the
+   windows holding a lane's best score are visited in order, so that hits,
+   ties and strands come out as in lpm_scan_range/pwm_scan_range. */
+static void
+soa_reduce_lpm(ms_scanner_t *sc, seq_t *seqs, int cnt, int nwin, motif_p_t m, out_writer_t *out)
+{
+  const double *fwd = sc->soa_lpm[0], *win = sc->soa_lpm[0];
+  size_t n = (size_t)nwin * SOA_LANES, at;
+  double top[SOA_LANES];
+  int k, s;
+
+  for (s = 0; s < SOA_LANES; s++)
+    top[s] = 0.0;
+  if (!sc->opt.bestscore) {
+    for (at = 0; at < n; at += SOA_LANES) {
+      for (s = 0; s < SOA_LANES; s++) {
+        if (sc->opt.forward)
+          top[s] = top[s] + fwd[at + s];
+        else
+          top[s] = top[s] + fwd[at + s] + sc->soa_lpm[1][at + s];
+      }
+    }
+    for (s = 0; s < cnt; s++)
+      lpm_write_sum(sc, &seqs[s], top[s], out);
+    return;
+  }
+  if (!sc->opt.forward) {
+    lpm_merge_strands(sc->soa_lpm[0], sc->soa_lpm[1], (int)n, sc->soa_lpm[1], NULL);
+    win = sc->soa_lpm[1];
+  }
+  for (at = 0; at < n; at += SOA_LANES)
+    for (s = 0; s < SOA_LANES; s++)
+      top[s] = win[at + s] > top[s] ? win[at + s] : top[s];
+  for (s = 0; s < cnt; s++) {
+    double best_score = 0.0;
+    char strand = '+';
+    sc->best_pos_len = out_fmt_int(sc->best_pos, 0);
+    if (top[s] > 0.0 && top[s] * (1.0 + BOUND_SLACK) >= sc->opt.min_score) {
+      for (k = 0; k < nwin; k++) {
+        at = (size_t)k * SOA_LANES + s;
+        if (!(win[at] * (1.0 + BOUND_SLACK) < top[s]))
+          lpm_hit(sc, &seqs[s], m, win[at], k, &best_score, &strand);
+      }
+    }
+    lpm_write_best(sc, &seqs[s], best_score, strand, out);
+  }
+}
+
+static void
+soa_reduce_pwm(ms_scanner_t *sc, seq_t *seqs, int cnt, int nwin, motif_p_t m, out_writer_t *out)
+{
+  const int *fwd = sc->soa_pwm[0], *win = sc->soa_pwm[0];
+  size_t n = (size_t)nwin * SOA_LANES, at;
+  int floor = pwm_floor(sc);
+  int top[SOA_LANES];
+  int k, s;
+
+  if (!sc->opt.forward) {
+    pwm_merge_strands(sc->soa_pwm[0], sc->soa_pwm[1], (int)n, sc->soa_pwm[1], NULL);
+    win = sc->soa_pwm[1];
+  }
+  for (s = 0; s < SOA_LANES; s++)
+    top[s] = floor;
+  for (at = 0; at < n; at += SOA_LANES)
+    for (s = 0; s < SOA_LANES; s++)
+      top[s] = win[at + s] > top[s] ? win[at + s] : top[s];
+  for (s = 0; s < cnt; s++) {
+    int match_pos = 0, strand = 0;
+    if (top[s] > floor) {
+      for (k = 0; win[(size_t)k * SOA_LANES + s] != top[s]; k++)
+        ;
+      at = (size_t)k * SOA_LANES + s;
+      match_pos = k;
+      strand = win[at] != fwd[at];
+    }
+    pwm_write_best(sc, &seqs[s], m, top[s], match_pos, strand, out);
+  }
+}
+
+/* Score cnt (at most SOA_LANES) N-free reads of the same length with the
+   batched kernels */
+static void
+score_soa(ms_scanner_t *sc, seq_t *seqs, int cnt, out_writer_t *out)
+{
+  motif_p_t m = &sc->motifs[0];
+  int len = seqs[0].len, nwin = len - m->len + 1;
+  int i, s;
+
+  memset(sc->soa_codes, 0, (size_t)len * SOA_LANES);
+  for (s = 0; s < cnt; s++) {
+    seq_unpack(&seqs[s], 0, len, sc->code_buf);
+    for (i = 0; i < len; i++)
+      sc->soa_codes[(size_t)i * SOA_LANES + s] = (unsigned char)sc->code_buf[i];
+  }
+  if (sc->opt.lpm) {
+    lpm_soa_scan(sc->soa_codes, nwin, m->lpm_fwd, m->len, sc->soa_lpm[0]);
+    if (!sc->opt.forward)
+      lpm_soa_scan(sc->soa_codes, nwin, m->lpm_rev, m->len, sc->soa_lpm[1]);
+  } else {
+    pwm_soa_scan(sc->soa_codes, nwin, m->pwm_fwd, m->len, sc->soa_pwm[0]);
+    if (!sc->opt.forward)
+      pwm_soa_scan(sc->soa_codes, nwin, m->pwm_rev, m->len, sc->soa_pwm[1]);
+  }
+  if (sc->opt.lpm)
+    soa_reduce_lpm(sc, seqs, cnt, nwin, m, out);
+  else
+    soa_reduce_pwm(sc, seqs, cnt, nwin, m, out);
+}
+
+/* Score cnt non-empty sequences (numbered from idx) in order.  Runs of at
+   least SOA_MIN_SEQS reads of the same length, such as the SELEX reads
+   after filter_fasta or fixed-width peaks, are scored SOA_LANES at a time
+   by the batched kernels; the other sequences one by one. */
+static void
+score_seqs(ms_scanner_t *sc, seq_t *seqs, int cnt, long idx, out_writer_t *out)
+{
+  int i = 0;
+
+  while (i < cnt) {
+    int run = 0;
+    if (soa_seq(sc->ctx, &seqs[i])) {
+      for (run = 1; i + run < cnt && run < SOA_LANES; run++)
+        if (seqs[i + run].len != seqs[i].len || !soa_seq(sc->ctx, &seqs[i + run]))
+          break;
+    }
+    if (run >= SOA_MIN_SEQS) {
+      score_soa(sc, seqs + i, run, out);
+      i += run;
+    } else {
+      score_seq(sc, &seqs[i], idx + i, out);
+      i++;
+    }
+  }
+}
+
+/* Carve n bytes out of the arena; with no block yet, only count them */
+static void *
+arena_alloc(arena_t *a, size_t n)
+{
+  void *p = (a->base != NULL) ? a->base + a->used : NULL;
+
+  a->used += (n + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+  return p;
+}
+
+/* Lay out the scoring buffers of a scanner in its arena */
+static void
+scanner_carve(ms_scanner_t *sc, int clone)
+{
+  const ms_context_t *ctx = sc->ctx;
+  int k;
+
+  sc->code_buf = arena_alloc(&sc->arena, ((size_t)WIN_BLOCK + ctx->maxLen) * sizeof(int));
+  sc->tag_rcomp = arena_alloc(&sc->arena, ((size_t)ctx->maxLen / SEQ_WORD_BASES + 2) * sizeof(uint64_t));
+  sc->tag_match = arena_alloc(&sc->arena, ((size_t)ctx->maxLen + 1) * sizeof(char));
+  if (ctx->soa_ok) {
+    sc->soa_codes = arena_alloc(&sc->arena, ((size_t)WIN_BLOCK + ctx->maxLen) * SOA_LANES);
+    for (k = 0; k < 2; k++) {
+      if (sc->opt.lpm)
+        sc->soa_lpm[k] = arena_alloc(&sc->arena, (size_t)WIN_BLOCK * SOA_LANES * sizeof(double));
+      else
+        sc->soa_pwm[k] = arena_alloc(&sc->arena, (size_t)WIN_BLOCK * SOA_LANES * sizeof(int));
+    }
+  }
+  if (ctx->motifCnt > 1) {
+    sc->multi_lpm = arena_alloc(&sc->arena, (size_t)ctx->motifCnt * sizeof(double));
+    sc->multi_pwm = arena_alloc(&sc->arena, (size_t)ctx->motifCnt * sizeof(int));
+    for (k = 0; k < 2; k++) {
+      if (sc->opt.lpm)
+        sc->group_lpm_win[k] = arena_alloc(&sc->arena, (size_t)WIN_BLOCK * MOTIF_GROUP * sizeof(double));
+      else
+        sc->group_pwm_win[k] = arena_alloc(&sc->arena, (size_t)WIN_BLOCK * MOTIF_GROUP * sizeof(int));
+    }
+  }
+  if (clone) {
+    motif_t *m = arena_alloc(&sc->arena, (size_t)ctx->motifCnt * sizeof(motif_t));
+    motif_group_t *g = arena_alloc(&sc->arena, (size_t)ctx->groupCnt * sizeof(motif_group_t));
+    if (m != NULL) {
+      memcpy(m, ctx->motifs, (size_t)ctx->motifCnt * sizeof(motif_t));
+      if (ctx->groupCnt > 0)
+        memcpy(g, ctx->groups, (size_t)ctx->groupCnt * sizeof(motif_group_t));
+    }
+    for (k = 0; k < ctx->motifCnt; k++) {
+      double *fwd = arena_alloc(&sc->arena, (size_t)ctx->motifs[k].len * NUCL * sizeof(double));
+      double *rev = arena_alloc(&sc->arena, (size_t)ctx->motifs[k].len * NUCL * sizeof(double));
+      if (m != NULL) {
+        m[k].lpm_fwd = fwd;
+        m[k].lpm_rev = rev;
+      }
+    }
+    for (k = 0; k < ctx->groupCnt; k++) {
+      size_t size = (size_t)ctx->groups[k].maxLen * NUCL * MOTIF_GROUP;
+      double *fwd = arena_alloc(&sc->arena, size * sizeof(double));
+      double *rev = arena_alloc(&sc->arena, size * sizeof(double));
+      if (g != NULL) {
+        int i;
+        for (i = 0; i < g[k].cnt; i++)
+          g[k].m[i] = m + (g[k].m[i] - ctx->motifs);
+        g[k].lpm_fwd = fwd;
+        g[k].lpm_rev = rev;
+      }
+    }
+    if (m != NULL) {
+      sc->motifs = m;
+      sc->groups = ctx->groupCnt > 0 ? g : NULL;
+    }
+  }
+}
+
+/* Allocate the scoring buffers of a scanner.  With -q the score tables are
+   rebuilt for every sequence, so the scanner makes its own copies of the
+   motif and group tables. */
+ms_scanner_t *
+ms_scanner_new(const ms_context_t *ctx)
+{
+  ms_scanner_t *sc;
+  int clone = ctx->opt.lpm && ctx->opt.seq_norm;
+  void *base;
+
+  if (!ctx->prepared) {
+    fprintf(stderr, "Motif context used before ms_prepare\n");
+    return NULL;
+  }
+  if ((sc = calloc(1, sizeof(ms_scanner_t))) == NULL)
+    seq_oom();
+  sc->ctx = ctx;
+  sc->opt = ctx->opt;
+  memcpy(sc->bg, ctx->bg, sizeof(sc->bg));
+  sc->motifs = ctx->motifs;
+  sc->groups = ctx->groups;
+  sc->best_pos_size = BEST_HIT_POS;
+  if ((sc->best_pos = malloc(sc->best_pos_size * sizeof(char))) == NULL)
+    seq_oom();
+  scanner_carve(sc, clone);
+  sc->arena.size = sc->arena.used;
+  if (posix_memalign(&base, ARENA_ALIGN, sc->arena.size) != 0)
+    seq_oom();
+  sc->arena.base = base;
+  sc->arena.used = 0;
+  scanner_carve(sc, clone);
+  if (clone)
+    build_lpm_tables(sc);
+  seq_init(&sc->seq);
+  sc->seq.hdr = sc->hdr;
+  seq_init(&sc->stream);
+  return sc;
+}
+
+void
+ms_scanner_free(ms_scanner_t *sc)
+{
+  if (sc == NULL)
+    return;
+  free(sc->best_pos);
+  free(sc->arena.base);
+  seq_free(&sc->seq);
+  seq_free(&sc->stream);
+  free(sc);
+}
+
+void
+ms_score_seqs(ms_scanner_t *sc, seq_t *seqs, int cnt, long idx, out_writer_t *out)
+{
+  score_seqs(sc, seqs, cnt, idx, out);
+}
+
+/* The values are those of the binary output, stored instead of written */
+int
+ms_score_values(ms_scanner_t *sc, seq_t *seqs, int cnt, double *scores)
+{
+  int binary = sc->opt.binary;
+
+  if (sc->opt.sites) {
+    fprintf(stderr, "Site reports have no score values (one per motif and sequence)\n");
+    return -1;
+  }
+  sc->opt.binary = 1;
+  sc->scores = scores;
+  score_seqs(sc, seqs, cnt, 0, NULL);
+  sc->opt.binary = binary;
+  sc->scores = NULL;
+  return 0;
+}
+
+int
+ms_score(ms_scanner_t *sc, const char *seq, size_t len, double *scores)
+{
+  if (len > INT_MAX) {
+    fprintf(stderr, "Sequence too long (%zu bases)\n", len);
+    return -1;
+  }
+  seq_clear(&sc->seq);
+  seq_reserve(&sc->seq, (int)len);
+  seq_append_text(&sc->seq, seq, len);
+  return ms_score_values(sc, &sc->seq, 1, scores);
+}
+
+/*
+  Streaming scan.
+
+  The bases of a streamed sequence are appended to the stream buffer as
+  its text comes in.  Once STREAM_BASES bases are waiting, every window
+  that lies entirely in the buffer is scanned, and the bases before the
+  first window left (the last maxLen-1 bases, give or take the rounding to
+  a packed word) are dropped.  The best PWM match is decoded from the
+  buffer as soon as it is found, and positions are reported from the start
+  of the sequence (pos_off), so the output is that of the whole sequence.
+*/
+int
+ms_streamable(const ms_context_t *ctx)
+{
+  return !(ctx->opt.lpm && ctx->opt.seq_norm) && !ctx->opt.debug;
+}
+
+/* Scan the windows of the stream buffer up to to, then drop the bases
+   before it */
+static void
+stream_scan(ms_scanner_t *sc, int to, out_writer_t *out)
+{
+  seq_t *seq = &sc->stream;
+  int best = sc->acc.pwm;
+  int drop;
+
+  if (to <= sc->stream_start)
+    return;
+  scan_windows(sc, seq, sc->stream_start, to, sc->stream_idx, out);
+  if (!sc->opt.lpm && !sc->opt.sites && sc->ctx->motifCnt == 1 && sc->acc.pwm > best) {
+    /* New best PWM hit, still in the buffer */
+    set_tag_match(sc, sc->tag_match, seq, sc->acc.pwm_pos, sc->motifs[0].len, sc->acc.pwm_rev);
+    sc->acc.pwm_pos += sc->pos_off;
+    sc->acc.tag_set = 1;
+  }
+  drop = to / SEQ_WORD_BASES * SEQ_WORD_BASES;
+  seq_drop(seq, drop);
+  sc->pos_off += drop;
+  sc->stream_start = to - drop;
+}
+
+int
+ms_stream_begin(ms_scanner_t *sc, const char *hdr, long idx)
+{
+  if (!ms_streamable(sc->ctx)) {
+    fprintf(stderr, "Sequences cannot be streamed with a sequence-based background or debugging output\n");
+    return -1;
+  }
+  scan_begin(sc);
+  seq_clear(&sc->stream);
+  sc->stream.hdr = (char *)hdr;
+  sc->stream_start = 0;
+  sc->stream_idx = idx;
+  return 0;
+}
+
+int
+ms_stream_text(ms_scanner_t *sc, const char *text, size_t len, out_writer_t *out)
+{
+  seq_t *seq = &sc->stream;
+
+  if (len > (size_t)(INT_MAX - sc->pos_off - seq->len)) {
+    fprintf(stderr, "Sequence %s too long (more than %d bases)\n", seq->hdr, INT_MAX);
+    return -1;
+  }
+  seq_append_text(seq, text, len);
+  if (seq->len - sc->stream_start >= STREAM_BASES + sc->ctx->maxLen)
+    stream_scan(sc, seq->len - sc->ctx->maxLen + 1, out);
+  return 0;
+}
+
+int
+ms_stream_end(ms_scanner_t *sc, out_writer_t *out)
+{
+  seq_t *seq = &sc->stream;
+  int len = sc->pos_off + seq->len;
+
+  stream_scan(sc, seq->len - scan_len(sc) + 1, out);
+  if (len > 0) {
+    /* The whole sequence, as far as the score lines go */
+    seq_t whole = *seq;
+    whole.len = len;
+    scan_end(sc, &whole, out);
+  }
+  sc->acc.tag_set = 0;
+  sc->pos_off = 0;
+  return len;
+}
+
+int
+ms_batchable(const ms_context_t *ctx, const seq_t *seq)
+{
+  return soa_seq(ctx, seq);
+}
+
+void
+ms_write_header(const ms_context_t *ctx, out_writer_t *out)
+{
+  write_binary_header(out, ctx->opt.sites ? 4 : ctx->motifCnt);
+}
+
+/*
+  Motif context.
+*/
+void
+ms_options_init(ms_options_t *opt)
+{
+  memset(opt, 0, sizeof(ms_options_t));
+  opt->lpm = 1;
+  opt->min_score = -HUGE_VAL;
+}
+
+ms_context_t *
+ms_create(const ms_options_t *opt)
+{
+  ms_context_t *ctx;
+  int i;
+
+  if (opt->kmer < 0 || opt->kmer > MS_KMER_MAX) {
+    fprintf(stderr, "Invalid k-mer length %d (it should be between 0 and %d)\n", opt->kmer, MS_KMER_MAX);
+    return NULL;
+  }
+  pthread_once(&kernel_once, select_default_kernels);
+  if ((ctx = calloc(1, sizeof(ms_context_t))) == NULL)
+    seq_oom();
+  ctx->opt = *opt;
+  if (!ctx->opt.lpm)
+    ctx->opt.seq_norm = 0;
+  for (i = 0; i < NUCL-1; i++)
+    ctx->bg[i] = 1.0;
+  ctx->bg[NUCL-1] = 0.25;
+  return ctx;
+}
+
+void
+ms_destroy(ms_context_t *ctx)
+{
+  int i, k;
+
+  if (ctx == NULL)
+    return;
+  for (k = 0; k < ctx->motifCnt; k++) {
+    motif_p_t m = &ctx->motifs[k];
+    for (i = 0; i < NUCL; i++) {
+      free(m->lpm[i]);
+      free(m->pwm[i]);
+    }
+    free(m->lpm_fwd);
+    free(m->lpm_rev);
+    free(m->pwm_fwd);
+    free(m->pwm_rev);
+    free(m->kmer_fwd.lpm);
+    free(m->kmer_fwd.pwm);
+    free(m->kmer_rev.lpm);
+    free(m->kmer_rev.pwm);
+    free(m->name);
+  }
+  free(ctx->motifs);
+  for (k = 0; k < ctx->groupCnt; k++) {
+    free(ctx->groups[k].lpm_fwd);
+    free(ctx->groups[k].lpm_rev);
+    free(ctx->groups[k].pwm_fwd);
+    free(ctx->groups[k].pwm_rev);
+  }
+  free(ctx->groups);
+  free(ctx);
+}
+
+int
+ms_load_file(ms_context_t *ctx, const char *path)
+{
+  FILE *f;
+  int ret;
+
+  if (ctx->prepared) {
+    fprintf(stderr, "Motif context already prepared\n");
+    return -1;
+  }
+  if ((f = fopen(path, "r")) == NULL) {
+    fprintf(stderr, "Could not open file %s: %s(%d)\n",
+            path, strerror(errno), errno);
+    return -1;
+  }
+  if (ctx->opt.debug != 0)
+    fprintf(stderr, "Processing file %s\n", path);
+  ret = read_profile(ctx, f, path);
+  fclose(f);
+  return ret;
+}
+
+int
+ms_load_text(ms_context_t *ctx, const char *name, const char *text, size_t len)
+{
+  FILE *f;
+  int ret;
+
+  if (ctx->prepared) {
+    fprintf(stderr, "Motif context already prepared\n");
+    return -1;
+  }
+  if (len == 0) {
+    fprintf(stderr, "Motif %s is empty\n", name);
+    return -1;
+  }
+  if ((f = fmemopen((void *)text, len, "r")) == NULL) {
+    fprintf(stderr, "Could not read motif %s: %s(%d)\n", name, strerror(errno), errno);
+    return -1;
+  }
+  ret = read_profile(ctx, f, name);
+  fclose(f);
+  return ret;
+}
+
+void
+ms_set_background(ms_context_t *ctx, const double freq[4])
+{
+  int i;
+
+  for (i = 0; i < NUCL-1; i++)
+    ctx->bg[i] = freq[i];
+  ctx->bg_set = 1;
+}
+
+int
+ms_prepare(ms_context_t *ctx)
+{
+  double bprob = 0.25;
+  int i, k;
+
+  if (ctx->prepared)
+    return 0;
+  if (ctx->motifCnt == 0) {
+    fprintf(stderr, "No motif to score\n");
+    return -1;
+  }
+  ctx->maxLen = 0;
+  ctx->minLen = INT_MAX;
+  for (k = 0; k < ctx->motifCnt; k++) {
+    motif_p_t m = &ctx->motifs[k];
+    if (m->len > ctx->maxLen)
+      ctx->maxLen = m->len;
+    if (m->len < ctx->minLen)
+      ctx->minLen = m->len;
+    /* Fill 5th pwm column for the N nucleotide (0.25) */
+    if (ctx->opt.lpm) {
+      for (i = 0; i < m->len; i++) {
+          m->lpm[4][i] = bprob;
+      }
+      if (ctx->opt.pseudo_weight != 0.0) {
+        /* Re-normalize the matrix by adding a pseudo-weight to the bease frequencies */
+        for (int j = 0; j < m->len; j++) {
+          double sum = 0.0;
+          for (int i = 0; i < NUCL-1; i++)
+            sum += m->lpm[i][j] + ctx->opt.pseudo_weight;
+          for (int i = 0; i < NUCL-1; i++)
+            m->lpm[i][j] = (m->lpm[i][j] + ctx->opt.pseudo_weight)/sum;
+        }
+      }
+    } else {
+      for (i = 0; i < m->len; i++) {
+          m->pwm[4][i] = INT_MIN;
+      } 
+    }
+  }
+  /* Precompute the LPM/background or PWM score tables */
+  for (k = 0; k < ctx->motifCnt; k++) {
+    motif_p_t m = &ctx->motifs[k];
+    if (ctx->opt.lpm) {
+      m->lpm_fwd = malloc((size_t)m->len * NUCL * sizeof(double));
+      m->lpm_rev = malloc((size_t)m->len * NUCL * sizeof(double));
+      if (m->lpm_fwd == NULL || m->lpm_rev == NULL)
+        seq_oom();
+      build_lpm_table(m, ctx->bg);
+    } else {
+      m->pwm_fwd = malloc((size_t)m->len * NUCL * sizeof(int));
+      m->pwm_rev = malloc((size_t)m->len * NUCL * sizeof(int));
+      if (m->pwm_fwd == NULL || m->pwm_rev == NULL)
+        seq_oom();
+      build_pwm_table(m);
+    }
+  }
+  if (ctx->opt.kmer > 0 && ctx->motifCnt == 1 && !ctx->opt.seq_norm && ctx->motifs[0].len > ctx->opt.kmer) {
+    /* Precompute the k-mer lookup tables */
+    build_kmer_tables(&ctx->motifs[0], ctx->opt.kmer, ctx->opt.lpm);
+  }
+  if (ctx->motifCnt > 1) {
+    /* Group the motifs for single-pass scoring */
+    ctx->groupCnt = (ctx->motifCnt + MOTIF_GROUP - 1) / MOTIF_GROUP;
+    if ((ctx->groups = calloc((size_t)ctx->groupCnt, sizeof(motif_group_t))) == NULL)
+      seq_oom();
+    for (k = 0; k < ctx->motifCnt; k++) {
+      motif_group_p_t g = &ctx->groups[k / MOTIF_GROUP];
+      g->m[g->cnt++] = &ctx->motifs[k];
+      if (ctx->motifs[k].len > g->maxLen)
+        g->maxLen = ctx->motifs[k].len;
+    }
+    for (k = 0; k < ctx->groupCnt; k++) {
+      motif_group_p_t g = &ctx->groups[k];
+      size_t size = (size_t)g->maxLen * NUCL * MOTIF_GROUP;
+      if (ctx->opt.lpm) {
+        g->lpm_fwd = malloc(size * sizeof(double));
+        g->lpm_rev = malloc(size * sizeof(double));
+        if (g->lpm_fwd == NULL || g->lpm_rev == NULL)
+          seq_oom();
+      } else {
+        g->pwm_fwd = malloc(size * sizeof(int));
+        g->pwm_rev = malloc(size * sizeof(int));
+        if (g->pwm_fwd == NULL || g->pwm_rev == NULL)
+          seq_oom();
+      }
+      build_group_table(g, ctx->opt.lpm);
+    }
+  }
+  if (ctx->opt.pvalue > 0.0 &&
+      pvalue_threshold(ctx, &ctx->motifs[0], ctx->opt.pvalue, &ctx->opt.threshold) != 0)
+    return -1;
+  /* Runs of same-length reads are batched when sequences are scored alike */
+  ctx->soa_ok = ctx->motifCnt == 1 && !ctx->opt.sites && !ctx->opt.seq_norm && !ctx->opt.bound &&
+    ctx->motifs[0].kmer_fwd.k == 0 && !ctx->opt.debug;
+  ctx->prepared = 1;
+  return 0;
+}
+
+int
+ms_motif_count(const ms_context_t *ctx)
+{
+  return ctx->motifCnt;
+}
+
+const char *
+ms_motif_name(const ms_context_t *ctx, int i)
+{
+  return ctx->motifs[i].name;
+}
+
+int
+ms_motif_length(const ms_context_t *ctx, int i)
+{
+  return ctx->motifs[i].len;
+}
+
+/* Site threshold (the one of the p-value once prepared) */
+double
+ms_threshold(const ms_context_t *ctx)
+{
+  return ctx->opt.threshold;
+}
+
+/* Matrices of the motifs, for the debugging output */
+void
+ms_print_motifs(const ms_context_t *ctx, FILE *f)
+{
+  int k;
+
+  for (k = 0; k < ctx->motifCnt; k++) {
+    motif_p_t m = &ctx->motifs[k];
+    fprintf(f, "Motif: %s\n", m->name);
+    fprintf(f, "Motif length: %d\n", m->len);
+    fprintf(f, "Weight Matrix: \n\n");
+    if (ctx->opt.lpm) {
+      double *p;
+      for (int i = 0; i < NUCL; i++) {
+        fprintf(f, "%c ", nucleotide[i]);
+        fprintf(f, "[");
+        /* processing the rows of the PWM */
+        for (p = m->lpm[i]; p < m->lpm[i] + m->len; p++)
+          fprintf(f, " %f ", (*p));
+        fprintf(f, "]\n");
+      }
+    } else {
+      int *p;
+      for (int i = 0; i < NUCL; i++) {
+        fprintf(f, "%c ", nucleotide[i]);
+        fprintf(f, "[");
+        /* processing the rows of the PWM */
+        for (p = m->pwm[i]; p < m->pwm[i] + m->len; p++)
+          fprintf(f, " %d ", (*p));
+        fprintf(f, "]\n");
+      }
+    }
+    fprintf(f, "\n");
+    fprintf(f, "Weight Matrix: vertical representation (columns represent the four nucleotides ACGT)\n\n");
+    int j = 0;
+    for (j = 0; j < m->len; j++) {
+      for ( int i = 0; i < NUCL-1; i++) {
+        if (ctx->opt.lpm) {
+          double pval = m->lpm[i][j];
+          fprintf(f, " %f ", pval);
+        } else {
+          int pval = m->pwm[i][j];
+          fprintf(f, " %d ", pval);
+        }
+      }
+      fprintf(f, "\n");
+    }
+    fprintf(f, "\n");
+  }
+  if (ctx->motifCnt > 1)
+    fprintf(f, "Scoring %d motifs in %d group(s) of up to %d\n", ctx->motifCnt, ctx->groupCnt, MOTIF_GROUP);
+}
+
+/* Scanning setup (kernel, lookup tables, bounds), for the debugging output */
+void
+ms_print_scan(const ms_context_t *ctx, FILE *f)
+{
+  const motif_t *m = &ctx->motifs[0];
+
+  fprintf(f, "Scanning kernel: %s\n", kernel_name);
+  if (m->kmer_fwd.k > 0)
+    fprintf(f, "k-mer lookup tables: k=%d, %d lookups per window\n", m->kmer_fwd.k, m->kmer_fwd.ngrp);
+  if (ctx->motifCnt == 1 && ctx->opt.bound && m->kmer_fwd.k == 0 && m->bound_fwd.ok &&
+      (ctx->opt.forward || m->bound_rev.ok))
+    fprintf(f, "Branch and bound on the first %d columns\n", m->bound_fwd.cols);
+}
+
+int
+ms_select_kernel(const char *name)
+{
+  pthread_once(&kernel_once, select_default_kernels);
+  return select_kernels(name);
+}
+
+const char *
+ms_kernel_name(void)
+{
+  return kernel_name;
+}
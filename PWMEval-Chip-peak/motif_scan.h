@@ -0,0 +1,134 @@
+/*
+
+  Motif scanning library: the matrix parser, score tables, background
+  handling and window scanning kernels of pwm_scoring, for C and C++
+  programs that score sequences in-process.
+
+  A context (ms_context_t) holds the motifs of one scoring setup.  Motifs
+  are loaded into it (ms_load_file, ms_load_text), the background is set
+  (ms_set_background), then ms_prepare builds the score tables.  After
+  ms_prepare the context is read-only and may be shared by any number of
+  threads.  Sequences are scored through a scanner (ms_scanner_t), which
+  holds the scratch buffers of one thread: each thread creates its own.
+
+  Scores come out either as the output lines of pwm_scoring on an
+  out_writer_t (ms_score_seqs), or as values (ms_score_values, ms_score):
+  one per motif and sequence, the numbers of the binary output format.
+
+  Sequences are 2-bit packed (packed_seq.h): seq_init, then seq_clear,
+  seq_reserve and seq_append_text for every sequence.  Sequences too long
+  to be held in memory are streamed (ms_stream_begin).
+
+  Errors are reported on stderr and returned as -1 (or NULL); running out
+  of memory is fatal, as in the tools.
+
+  Build: gcc -O3 -std=gnu99 -pthread -c motif_scan.c, and link the program
+  with motif_scan.o -lm.
+
+*/
+#ifndef MOTIF_SCAN_H
+#define MOTIF_SCAN_H
+
+#include <stdio.h>
+
+#include "packed_seq.h"
+#include "out_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MS_API_VERSION 2
+#define MS_KMER_MAX 8              /* Longest k-mer of the lookup tables */
+#define MS_SCORE_MAGIC "PWMSCORE"  /* Binary score output header */
+#define MS_BATCH_LANES 16          /* Reads scored together by the batched kernels */
+
+typedef struct _ms_options_t {
+  int lpm;                   /* Letter probability matrices (1) or integer PWMs (0) */
+  int bestscore;             /* Best single match instead of sum of probabilities */
+  int forward;               /* Forward strand only */
+  int seq_norm;              /* Sequence-based background (LPM) */
+  int kmer;                  /* k-mer lookup tables (0 = off) */
+  int bound;                 /* Best single matches by branch and bound */
+  int binary;                /* Binary output (ms_score_seqs) */
+  int nohdr;                 /* No FASTA header in the output lines */
+  int debug;                 /* Debugging output on stderr */
+  double min_score;          /* Lowest reported best match (-HUGE_VAL = none) */
+  int sites;                 /* Report all sites scoring at least threshold */
+  double threshold;
+  double pvalue;             /* Site threshold from a p-value (0 = off) */
+  double pseudo_weight;      /* LPM pseudo-weight (0 = none) */
+} ms_options_t;
+
+typedef struct _ms_context_t ms_context_t;
+typedef struct _ms_scanner_t ms_scanner_t;
+
+/* Default options: sum of probabilities of LPMs on both strands */
+void ms_options_init(ms_options_t *opt);
+
+ms_context_t *ms_create(const ms_options_t *opt);
+void ms_destroy(ms_context_t *ctx);
+
+/* Load the matrices of a motif file, or of a matrix file held in memory
+   (name stands for the file name).  Returns the number of motifs read. */
+int ms_load_file(ms_context_t *ctx, const char *path);
+int ms_load_text(ms_context_t *ctx, const char *name, const char *text, size_t len);
+
+/* Background frequencies of A, C, G and T (LPM); without a background the
+   LPM scores are not normalized */
+void ms_set_background(ms_context_t *ctx, const double freq[4]);
+
+/* Build the score tables; the context is read-only afterwards */
+int ms_prepare(ms_context_t *ctx);
+
+int ms_motif_count(const ms_context_t *ctx);
+const char *ms_motif_name(const ms_context_t *ctx, int i);
+int ms_motif_length(const ms_context_t *ctx, int i);
+double ms_threshold(const ms_context_t *ctx);
+void ms_print_motifs(const ms_context_t *ctx, FILE *f);
+void ms_print_scan(const ms_context_t *ctx, FILE *f);
+
+/* Window scanning kernel of the process: auto, scalar, avx2 or avx512
+   (auto unless selected).  Not to be called while sequences are scored. */
+int ms_select_kernel(const char *name);
+const char *ms_kernel_name(void);
+
+ms_scanner_t *ms_scanner_new(const ms_context_t *ctx);
+void ms_scanner_free(ms_scanner_t *sc);
+
+/* Binary output header (ms_score_seqs with the binary option) */
+void ms_write_header(const ms_context_t *ctx, out_writer_t *out);
+
+/* Whether ms_score_seqs batches seq with the following reads of the same
+   length */
+int ms_batchable(const ms_context_t *ctx, const seq_t *seq);
+
+/* Score cnt non-empty sequences (numbered from idx) and write their
+   output lines to out */
+void ms_score_seqs(ms_scanner_t *sc, seq_t *seqs, int cnt, long idx, out_writer_t *out);
+
+/* Score cnt sequences into scores[cnt * motif count], sequence by
+   sequence (not with the sites option) */
+int ms_score_values(ms_scanner_t *sc, seq_t *seqs, int cnt, double *scores);
+
+/* Same for one sequence given as text */
+int ms_score(ms_scanner_t *sc, const char *seq, size_t len, double *scores);
+
+/* Streaming scan of a sequence too long to be held at once, such as a
+   chromosome: its text is given piece by piece (ms_stream_text) and its
+   windows are scanned as it comes in, keeping a bounded buffer of bases.
+   The output is that of ms_score_seqs on the whole sequence, sites being
+   written as they are found.  hdr must stay valid until ms_stream_end,
+   which returns the length of the sequence (nothing is written for an
+   empty one).  Not available with a sequence-based background (seq_norm)
+   or debugging output (ms_streamable). */
+int ms_streamable(const ms_context_t *ctx);
+int ms_stream_begin(ms_scanner_t *sc, const char *hdr, long idx);
+int ms_stream_text(ms_scanner_t *sc, const char *text, size_t len, out_writer_t *out);
+int ms_stream_end(ms_scanner_t *sc, out_writer_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
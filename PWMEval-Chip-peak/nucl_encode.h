@@ -0,0 +1,140 @@
+/*
+
+  Nucleotide encoding and validation shared by pwm_scoring, seqshuffle
+  and filter_fasta.
+
+  Letters are encoded through a 256-entry table: A, C, G and T (in either
+  case) get codes 0 to 3, any other letter is an N (code 4), and all other
+  bytes (line breaks, blanks, digits, ...) are skipped.  On x86-64 CPUs
+  with AVX2, text is classified 32 bytes at a time, and the 2-bit codes of
+  32 bases are packed into a 64-bit word with two multiply-adds and a
+  shuffle; the AVX2 path is selected at run time.
+
+*/
+#ifndef NUCL_ENCODE_H
+#define NUCL_ENCODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NUCL_X86_SIMD 1
+#endif
+
+#define NUCL_SKIP 0xff   /* Not a letter: ignored */
+
+#define S NUCL_SKIP
+static const unsigned char nucl_code[256] = {
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, S, S, S, S, S,
+  S, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S
+};
+#undef S
+
+#ifdef NUCL_X86_SIMD
+static int nucl_simd = -1;   /* AVX2 available, -1 before the first check */
+
+static inline int
+nucl_have_avx2(void)
+{
+  if (nucl_simd < 0) {
+    __builtin_cpu_init();
+    nucl_simd = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  return nucl_simd;
+}
+
+/* Classify the 32 bytes at s: bit i of *acgt is set if byte i is an A, C,
+   G or T, bit i of *letter if it is a letter; *bits receives the 2-bit
+   codes of the 32 bytes, meaningful for the A, C, G and T only */
+__attribute__((target("avx2")))
+static inline void
+nucl_scan32_avx2(const char *s, uint32_t *acgt, uint32_t *letter, uint64_t *bits)
+{
+  __m256i v = _mm256_loadu_si256((const __m256i *)s);
+  __m256i u = _mm256_and_si256(v, _mm256_set1_epi8((char)0xDF));   /* Upper case */
+  __m256i t = _mm256_sub_epi8(u, _mm256_set1_epi8('A'));
+  __m256i is_acgt = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(u, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('C'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(u, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('T'))));
+  __m256i is_letter = _mm256_and_si256(_mm256_cmpgt_epi8(t, _mm256_set1_epi8(-1)),
+                                       _mm256_cmpgt_epi8(_mm256_set1_epi8(26), t));
+  /* A=0x41, C=0x43, G=0x47, T=0x54: code = bits 1-2 with G and T swapped */
+  __m256i c = _mm256_xor_si256(_mm256_and_si256(_mm256_srli_epi16(v, 1), _mm256_set1_epi8(3)),
+                               _mm256_and_si256(_mm256_srli_epi16(v, 2), _mm256_set1_epi8(1)));
+  /* 2 bases per 16 bits, then 4 bases per 32 bits, then gather the bytes */
+  c = _mm256_maddubs_epi16(c, _mm256_set1_epi16(0x0401));
+  c = _mm256_madd_epi16(c, _mm256_set1_epi32(0x00100001));
+  c = _mm256_shuffle_epi8(c, _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                              0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+  *acgt = (uint32_t)_mm256_movemask_epi8(is_acgt);
+  *letter = (uint32_t)_mm256_movemask_epi8(is_letter);
+  *bits = (uint64_t)(uint32_t)_mm256_cvtsi256_si32(c) |
+          ((uint64_t)(uint32_t)_mm256_extract_epi32(c, 4) << 32);
+}
+
+__attribute__((target("avx2")))
+static inline int
+nucl_only_acgt_avx2(const char *s, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32) {
+    __m256i u = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(s + i)), _mm256_set1_epi8((char)0xDF));
+    __m256i is_acgt = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(u, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('C'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(u, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('T'))));
+    if ((uint32_t)_mm256_movemask_epi8(is_acgt) != 0xFFFFFFFFu)
+      return 0;
+  }
+  for (; i < n; i++) {
+    if (nucl_code[(unsigned char)s[i]] > 3)
+      return 0;
+  }
+  return 1;
+}
+#endif
+
+/* Whether the n bytes at s are all A, C, G or T (in either case) */
+static inline int
+nucl_only_acgt(const char *s, size_t n)
+{
+  size_t i;
+
+#ifdef NUCL_X86_SIMD
+  if (nucl_have_avx2())
+    return nucl_only_acgt_avx2(s, n);
+#endif
+  for (i = 0; i < n; i++) {
+    if (nucl_code[(unsigned char)s[i]] > 3)
+      return 0;
+  }
+  return 1;
+}
+
+/* Number of letters other than A, C, G and T (the N of the packed
+   sequences) in the n bytes at s */
+static inline size_t
+nucl_count_other(const char *s, size_t n)
+{
+  size_t i, other = 0;
+
+  for (i = 0; i < n; i++)
+    other += nucl_code[(unsigned char)s[i]] == 4;
+  return other;
+}
+
+#endif
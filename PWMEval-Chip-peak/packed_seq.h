@@ -0,0 +1,407 @@
+/*
+
+  Packed nucleotide sequences shared by pwm_scoring and seqshuffle.
+
+  Nucleotides are stored with 2 bits per base (A=0, C=1, G=2, T=3), 32 bases
+  per 64-bit word; base i lives in bits 2*(i%32)..2*(i%32)+1 of word i/32.
+  Everything that is not A, C, G or T is an N (code 4): it is stored as an A
+  in the packed words and recorded in a sorted list of [start, end) runs,
+  which is empty for the vast majority of reads and peaks.
+
+  The word array always has one spare zero word past the last base, so that
+  64-bit windows can be extracted at any valid position without bound checks.
+
+*/
+#ifndef PACKED_SEQ_H
+#define PACKED_SEQ_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nucl_encode.h"
+
+#define SEQ_WORD_BASES 32
+#define SEQ_INIT_WORDS 128
+
+typedef struct _seq_t {
+  char *hdr;
+  uint64_t *bits;      /* 2-bit packed bases                    */
+  int len;             /* Number of bases                       */
+  int words;           /* Allocated words                       */
+  int *nrun;           /* N runs as [start, end) pairs          */
+  int nrun_cnt;        /* Number of N runs                      */
+  int nrun_size;       /* Allocated N runs                      */
+} seq_t, *seq_p_t;
+
+static const char seq_nucleotide[] = {'A','C','G','T','N'};
+
+static inline void
+seq_oom(void)
+{
+  fprintf(stderr, "Out of memory\n");
+  exit(1);
+}
+
+static inline void
+seq_init(seq_p_t seq)
+{
+  seq->hdr = NULL;
+  seq->len = 0;
+  seq->words = SEQ_INIT_WORDS;
+  seq->bits = (uint64_t *)calloc((size_t)seq->words, sizeof(uint64_t));
+  seq->nrun_cnt = 0;
+  seq->nrun_size = 16;
+  seq->nrun = (int *)malloc(2 * (size_t)seq->nrun_size * sizeof(int));
+  if (seq->bits == NULL || seq->nrun == NULL)
+    seq_oom();
+}
+
+static inline void
+seq_free(seq_p_t seq)
+{
+  free(seq->bits);
+  free(seq->nrun);
+  seq->bits = NULL;
+  seq->nrun = NULL;
+}
+
+static inline void
+seq_clear(seq_p_t seq)
+{
+  seq->len = 0;
+  seq->nrun_cnt = 0;
+  seq->bits[0] = 0;
+  seq->bits[1] = 0;
+}
+
+/* Make room for n bases (plus the spare word) */
+static inline void
+seq_reserve(seq_p_t seq, int n)
+{
+  int need = n / SEQ_WORD_BASES + 2;
+
+  if (need > seq->words) {
+    int words = seq->words;
+    while (words < need)
+      words *= 2;
+    seq->bits = (uint64_t *)realloc(seq->bits, (size_t)words * sizeof(uint64_t));
+    if (seq->bits == NULL)
+      seq_oom();
+    memset(seq->bits + seq->words, 0, (size_t)(words - seq->words) * sizeof(uint64_t));
+    seq->words = words;
+  }
+}
+
+/* Remove the first n bases, n a multiple of SEQ_WORD_BASES: the words
+   are moved down with the spare word, and the N runs shifted and clipped */
+static inline void
+seq_drop(seq_p_t seq, int n)
+{
+  int q = n / SEQ_WORD_BASES;
+  int k, r = 0;
+
+  if (n <= 0)
+    return;
+  memmove(seq->bits, seq->bits + q, (size_t)(seq->len / SEQ_WORD_BASES + 2 - q) * sizeof(uint64_t));
+  seq->len -= n;
+  for (k = 0; k < seq->nrun_cnt; k++) {
+    if (seq->nrun[2*k + 1] <= n)
+      continue;
+    seq->nrun[2*r] = seq->nrun[2*k] > n ? seq->nrun[2*k] - n : 0;
+    seq->nrun[2*r + 1] = seq->nrun[2*k + 1] - n;
+    r++;
+  }
+  seq->nrun_cnt = r;
+}
+
+/* Append an N at the end of the sequence, extending the last run if possible */
+static inline void
+seq_push_n(seq_p_t seq)
+{
+  if (seq->nrun_cnt > 0 && seq->nrun[2*seq->nrun_cnt - 1] == seq->len) {
+    seq->nrun[2*seq->nrun_cnt - 1]++;
+  } else {
+    if (seq->nrun_cnt == seq->nrun_size) {
+      seq->nrun_size *= 2;
+      seq->nrun = (int *)realloc(seq->nrun, 2 * (size_t)seq->nrun_size * sizeof(int));
+      if (seq->nrun == NULL)
+        seq_oom();
+    }
+    seq->nrun[2*seq->nrun_cnt] = seq->len;
+    seq->nrun[2*seq->nrun_cnt + 1] = seq->len + 1;
+    seq->nrun_cnt++;
+  }
+}
+
+/* Append one nucleotide code (0..4) */
+static inline void
+seq_push(seq_p_t seq, int n)
+{
+  int w = seq->len / SEQ_WORD_BASES;
+
+  if (w + 2 > seq->words)
+    seq_reserve(seq, seq->len + 1);
+  if (seq->len % SEQ_WORD_BASES == 0)
+    seq->bits[w + 1] = 0;
+  if (n == 4)
+    seq_push_n(seq);
+  else
+    seq->bits[w] |= (uint64_t)n << (2 * (seq->len % SEQ_WORD_BASES));
+  seq->len++;
+}
+
+/* Append the k (1..32) A/C/G/T bases packed in the low bits of x */
+static inline void
+seq_push_bits(seq_p_t seq, uint64_t x, int k)
+{
+  int w = seq->len / SEQ_WORD_BASES;
+  int sh = 2 * (seq->len % SEQ_WORD_BASES);
+
+  seq_reserve(seq, seq->len + k);
+  if (k < SEQ_WORD_BASES)
+    x &= ((uint64_t)1 << (2 * k)) - 1;
+  if (sh == 0) {
+    seq->bits[w] = x;
+  } else {
+    seq->bits[w] |= x << sh;
+    seq->bits[w + 1] = x >> (64 - sh);
+  }
+  seq->len += k;
+  /* Keep the words past the last base clear, as seq_push expects */
+  w = seq->len / SEQ_WORD_BASES;
+  seq->bits[w + 1] = 0;
+  if (seq->len % SEQ_WORD_BASES == 0)
+    seq->bits[w] = 0;
+}
+
+static inline int
+seq_append_text_scalar(seq_p_t seq, const char *s, size_t n)
+{
+  size_t i;
+  int other = 0;
+
+  for (i = 0; i < n; i++) {
+    int c = nucl_code[(unsigned char)s[i]];
+    if (c != NUCL_SKIP) {
+      seq_push(seq, c);
+      other |= (c == 4);
+    }
+  }
+  return other;
+}
+
+/* Append the letters of the text [s, s+n) to the sequence, skipping line
+   breaks and any other non-letter.  Runs of A, C, G and T are packed 32
+   bases at a time; stretches holding other letters (N) go base by base.
+   Returns nonzero if a letter other than A, C, G or T was seen. */
+static inline int
+seq_append_text(seq_p_t seq, const char *s, size_t n)
+{
+  size_t i = 0;
+  int other = 0;
+
+#ifdef NUCL_X86_SIMD
+  if (nucl_have_avx2()) {
+    for (; i + 32 <= n; i += 32) {
+      uint32_t acgt, letter;
+      uint64_t x;
+      nucl_scan32_avx2(s + i, &acgt, &letter, &x);
+      if (acgt == 0xFFFFFFFFu) {
+        seq_push_bits(seq, x, 32);
+      } else if (acgt == letter) {
+        /* Only A, C, G, T and separators: append each run of bases */
+        while (acgt != 0) {
+          int st = __builtin_ctz(acgt);
+          int len = __builtin_ctz(~(acgt >> st));
+          seq_push_bits(seq, x >> (2 * st), len);
+          acgt &= ~((((uint32_t)1 << len) - 1) << st);
+        }
+      } else {
+        other |= seq_append_text_scalar(seq, s + i, 32);
+      }
+    }
+  }
+#endif
+  other |= seq_append_text_scalar(seq, s + i, n - i);
+  return other;
+}
+
+/* The 32 bases starting at position i, base i in the lowest bits */
+static inline uint64_t
+seq_bits64(const uint64_t *bits, int i)
+{
+  int w = i / SEQ_WORD_BASES;
+  int sh = 2 * (i % SEQ_WORD_BASES);
+
+  return (bits[w] >> sh) | ((bits[w + 1] << 1) << (63 - sh));
+}
+
+/* 2-bit code of position i, ignoring N runs */
+static inline int
+seq_get2(const uint64_t *bits, int i)
+{
+  return (int)((bits[i / SEQ_WORD_BASES] >> (2 * (i % SEQ_WORD_BASES))) & 3);
+}
+
+static inline void
+seq_set2(uint64_t *bits, int i, int c)
+{
+  int sh = 2 * (i % SEQ_WORD_BASES);
+
+  bits[i / SEQ_WORD_BASES] = (bits[i / SEQ_WORD_BASES] & ~((uint64_t)3 << sh)) | ((uint64_t)c << sh);
+}
+
+/* Index of the first N run ending after position i */
+static inline int
+seq_nrun_after(const seq_t *seq, int i)
+{
+  int lo = 0, hi = seq->nrun_cnt;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (seq->nrun[2*mid + 1] <= i)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Number of N (non-ACGT) bases */
+static inline int
+seq_n_count(const seq_t *seq)
+{
+  int k, n = 0;
+
+  for (k = 0; k < seq->nrun_cnt; k++)
+    n += seq->nrun[2*k + 1] - seq->nrun[2*k];
+  return n;
+}
+
+/* Nucleotide code (0..4) of position i */
+static inline int
+seq_base(const seq_t *seq, int i)
+{
+  if (seq->nrun_cnt > 0) {
+    int r = seq_nrun_after(seq, i);
+    if (r < seq->nrun_cnt && seq->nrun[2*r] <= i)
+      return 4;
+  }
+  return seq_get2(seq->bits, i);
+}
+
+/* Unpack the codes (0..4) of positions [start, start+n) into out */
+static inline void
+seq_unpack(const seq_t *seq, int start, int n, int *out)
+{
+  int i, r;
+
+  for (i = 0; i < n; i++)
+    out[i] = seq_get2(seq->bits, start + i);
+  for (r = seq_nrun_after(seq, start); r < seq->nrun_cnt && seq->nrun[2*r] < start + n; r++) {
+    int s = seq->nrun[2*r] > start ? seq->nrun[2*r] : start;
+    int e = seq->nrun[2*r + 1] < start + n ? seq->nrun[2*r + 1] : start + n;
+    for (i = s; i < e; i++)
+      out[i - start] = 4;
+  }
+}
+
+/* Letters of positions [start, start+n) into out (not nul terminated) */
+static inline void
+seq_decode(const seq_t *seq, int start, int n, char *out)
+{
+  int i, r;
+
+  for (i = 0; i < n; i++)
+    out[i] = seq_nucleotide[seq_get2(seq->bits, start + i)];
+  for (r = seq_nrun_after(seq, start); r < seq->nrun_cnt && seq->nrun[2*r] < start + n; r++) {
+    int s = seq->nrun[2*r] > start ? seq->nrun[2*r] : start;
+    int e = seq->nrun[2*r + 1] < start + n ? seq->nrun[2*r + 1] : start + n;
+    for (i = s; i < e; i++)
+      out[i - start] = 'N';
+  }
+}
+
+/* Count A, C, G, T and N of the whole sequence, a word at a time */
+static inline void
+seq_count(const seq_t *seq, int cnt[5])
+{
+  const uint64_t lo_mask = 0x5555555555555555ULL;
+  int w, r;
+  int full = seq->len / SEQ_WORD_BASES;
+  int rest = seq->len % SEQ_WORD_BASES;
+
+  cnt[0] = cnt[1] = cnt[2] = cnt[3] = cnt[4] = 0;
+  for (w = 0; w <= full; w++) {
+    uint64_t x = seq->bits[w];
+    uint64_t valid = (w < full) ? lo_mask : (lo_mask & (((uint64_t)1 << (2 * rest)) - 1));
+    uint64_t lo = x & valid;
+    uint64_t hi = (x >> 1) & valid;
+    if (valid == 0)
+      break;
+    cnt[0] += __builtin_popcountll(~hi & ~lo & valid);
+    cnt[1] += __builtin_popcountll(~hi & lo);
+    cnt[2] += __builtin_popcountll(hi & ~lo);
+    cnt[3] += __builtin_popcountll(hi & lo);
+  }
+  /* N positions are stored as A */
+  for (r = 0; r < seq->nrun_cnt; r++) {
+    int n = seq->nrun[2*r + 1] - seq->nrun[2*r];
+    cnt[0] -= n;
+    cnt[4] += n;
+  }
+}
+
+/* Reverse complement of the 32 bases of a packed word */
+static inline uint64_t
+seq_revcomp64(uint64_t x)
+{
+  x = ~x;
+  x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+  x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+  return __builtin_bswap64(x);
+}
+
+/* Packed reverse complement of positions [start, start+n) into out,
+   which must hold n/32 + 1 words; N runs are not carried over */
+static inline void
+seq_revcomp(const seq_t *seq, int start, int n, uint64_t *out)
+{
+  int q;
+  int end = start + n;
+
+  for (q = 0; q * SEQ_WORD_BASES < n; q++) {
+    int hi = end - q * SEQ_WORD_BASES;
+    int lo = hi - SEQ_WORD_BASES;
+    if (lo >= start) {
+      out[q] = seq_revcomp64(seq_bits64(seq->bits, lo));
+    } else {
+      int k = hi - start;
+      out[q] = seq_revcomp64(seq_bits64(seq->bits, start)) >> (2 * (SEQ_WORD_BASES - k));
+    }
+  }
+  out[q] = 0;
+}
+
+/* Letters of the reverse complement of positions [start, start+n) into out
+   (not nul terminated), going through the packed reverse complement;
+   rc must hold n/32 + 1 words */
+static inline void
+seq_decode_revcomp(const seq_t *seq, int start, int n, uint64_t *rc, char *out)
+{
+  int i, r;
+
+  seq_revcomp(seq, start, n, rc);
+  for (i = 0; i < n; i++)
+    out[i] = seq_nucleotide[seq_get2(rc, i)];
+  for (r = seq_nrun_after(seq, start); r < seq->nrun_cnt && seq->nrun[2*r] < start + n; r++) {
+    int s = seq->nrun[2*r] > start ? seq->nrun[2*r] : start;
+    int e = seq->nrun[2*r + 1] < start + n ? seq->nrun[2*r + 1] : start + n;
+    for (i = s; i < e; i++)
+      out[n - 1 - (i - start)] = 'N';
+  }
+}
+
+#endif
@@ -0,0 +1,280 @@
+/*
+
+  Packed sequence files (.pseq) shared by seqpack, pwm_scoring, seqshuffle
+  and pwm_server.
+
+  A prepared sequence set is encoded once by seqpack, then mapped by the
+  tools instead of being parsed again.  Sequences are stored as they are
+  held in memory (packed_seq.h), so that a record is a view into the
+  mapping.  The file is a 64-byte header followed by these sections, each
+  padded to 8 bytes (little-endian data):
+
+    len        uint32[count]       Bases of each sequence
+    word_off   uint64[count + 1]   First packed word of each sequence
+    nrun_off   uint64[count + 1]   First N run of each sequence
+    hdr_off    uint64[count + 1]   First header byte of each sequence
+                                   (only with the PSEQ_HEADERS flag)
+    bits       uint64[words]       2-bit packed bases, len / 32 + 2 words
+                                   per sequence (spare zero words included)
+    nrun       int32[2 * nruns]    N runs as [start, end) pairs
+    hdr        char[hdr_bytes]     Headers (first word of the FASTA header
+                                   line), each terminated by a nul
+
+  The header holds a hash of everything after it (pseq_hash), that
+  identifies the dataset.  It is checked by seqpack -c; readers only check
+  the layout against the file size, and the bounds of each record as they
+  read it.
+
+*/
+#ifndef PSEQ_FILE_H
+#define PSEQ_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "packed_seq.h"
+
+#define PSEQ_MAGIC "PWMPSEQ\n"
+#define PSEQ_VERSION 1
+#define PSEQ_HEADERS 1             /* Flag: headers stored */
+#define PSEQ_HASH_SEED 0x70736571ULL
+#define PSEQ_PAD(n) (((uint64_t)(n) + 7) & ~(uint64_t)7)
+
+typedef struct _pseq_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t count;            /* Sequences                          */
+  uint64_t bases;            /* Bases of all sequences             */
+  uint64_t words;            /* Packed words                       */
+  uint64_t nruns;            /* N runs                             */
+  uint64_t hdr_bytes;        /* Header text, nuls included         */
+  uint64_t hash;             /* pseq_hash of the sections          */
+} pseq_header_t;
+
+enum { PSEQ_LEN, PSEQ_WORD_OFF, PSEQ_NRUN_OFF, PSEQ_HDR_OFF, PSEQ_BITS, PSEQ_NRUN, PSEQ_HDR, PSEQ_END };
+
+typedef struct _pseq_reader_t {
+  unsigned char *map;        /* Mapped file                        */
+  size_t map_size;
+  pseq_header_t hdr;
+  const uint32_t *len;
+  const uint64_t *word_off;
+  const uint64_t *nrun_off;
+  const uint64_t *hdr_off;   /* NULL without headers               */
+  const uint64_t *bits;
+  const int32_t *nrun;
+  const char *text;
+  uint64_t next;             /* Next record of pseq_next           */
+  const char *err;           /* Error message, NULL if none        */
+} pseq_reader_t;
+
+/* Offsets of the sections and of the end of the file.  Returns -1 for
+   sizes that cannot be those of a file */
+static inline int
+pseq_layout(const pseq_header_t *h, uint64_t off[PSEQ_END + 1])
+{
+  const uint64_t max = (uint64_t)1 << 56;
+
+  if (h->count >= max / 8 || h->words >= max / 8 || h->nruns >= max / 8 || h->hdr_bytes >= max)
+    return -1;
+  off[PSEQ_LEN] = sizeof(pseq_header_t);
+  off[PSEQ_WORD_OFF] = off[PSEQ_LEN] + PSEQ_PAD(4 * h->count);
+  off[PSEQ_NRUN_OFF] = off[PSEQ_WORD_OFF] + 8 * (h->count + 1);
+  off[PSEQ_HDR_OFF] = off[PSEQ_NRUN_OFF] + 8 * (h->count + 1);
+  off[PSEQ_BITS] = off[PSEQ_HDR_OFF] + ((h->flags & PSEQ_HEADERS) ? 8 * (h->count + 1) : 0);
+  off[PSEQ_NRUN] = off[PSEQ_BITS] + 8 * h->words;
+  off[PSEQ_HDR] = off[PSEQ_NRUN] + PSEQ_PAD(8 * h->nruns);
+  off[PSEQ_END] = off[PSEQ_HDR] + PSEQ_PAD(h->hdr_bytes);
+  return 0;
+}
+
+/* Hash of n bytes (a multiple of 8), continued from h (PSEQ_HASH_SEED to
+   start) */
+static inline uint64_t
+pseq_hash(uint64_t h, const void *data, size_t n)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, sizeof(w));
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+/* Whether path names a packed sequence file (standard input and other
+   non-regular files are not) */
+static inline int
+pseq_probe(const char *path)
+{
+  struct stat st;
+  char magic[8];
+  int fd, ret = 0;
+
+  if (path == NULL || strcmp(path, "-") == 0 || stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    return 0;
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return 0;
+  if (read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic))
+    ret = memcmp(magic, PSEQ_MAGIC, sizeof(magic)) == 0;
+  close(fd);
+  return ret;
+}
+
+static inline void
+pseq_close(pseq_reader_t *r)
+{
+  if (r->map != NULL)
+    munmap(r->map, r->map_size);
+  memset(r, 0, sizeof(pseq_reader_t));
+}
+
+/* Map a packed sequence file.  Returns 0, or -1 with the message in err
+   (and errno set for system errors) */
+static inline int
+pseq_open(pseq_reader_t *r, const char *path)
+{
+  uint64_t off[PSEQ_END + 1];
+  struct stat st;
+  void *map;
+  int fd;
+
+  memset(r, 0, sizeof(pseq_reader_t));
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+    r->err = strerror(errno);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  if ((size_t)st.st_size < sizeof(pseq_header_t)) {
+    close(fd);
+    r->err = "Not a packed sequence file";
+    return -1;
+  }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    r->err = strerror(errno);
+    return -1;
+  }
+  r->map = (unsigned char *)map;
+  r->map_size = (size_t)st.st_size;
+  memcpy(&r->hdr, r->map, sizeof(pseq_header_t));
+  if (memcmp(r->hdr.magic, PSEQ_MAGIC, 8) != 0) {
+    pseq_close(r);
+    r->err = "Not a packed sequence file";
+    return -1;
+  }
+  if (r->hdr.version != PSEQ_VERSION) {
+    pseq_close(r);
+    r->err = "Unsupported packed sequence file version";
+    return -1;
+  }
+  if (pseq_layout(&r->hdr, off) != 0 || off[PSEQ_END] != (uint64_t)r->map_size) {
+    pseq_close(r);
+    r->err = "Truncated or corrupt packed sequence file";
+    return -1;
+  }
+  r->len = (const uint32_t *)(r->map + off[PSEQ_LEN]);
+  r->word_off = (const uint64_t *)(r->map + off[PSEQ_WORD_OFF]);
+  r->nrun_off = (const uint64_t *)(r->map + off[PSEQ_NRUN_OFF]);
+  if (r->hdr.flags & PSEQ_HEADERS)
+    r->hdr_off = (const uint64_t *)(r->map + off[PSEQ_HDR_OFF]);
+  r->bits = (const uint64_t *)(r->map + off[PSEQ_BITS]);
+  r->nrun = (const int32_t *)(r->map + off[PSEQ_NRUN]);
+  r->text = (const char *)(r->map + off[PSEQ_HDR]);
+#ifdef MADV_SEQUENTIAL
+  madvise(map, r->map_size, MADV_SEQUENTIAL);
+#endif
+  return 0;
+}
+
+/* Record i as a read-only view into the mapping: seq is not to be freed
+   or modified.  Its hdr is NULL without headers.  Returns 0, or -1 for a
+   record out of bounds */
+static inline int
+pseq_get(pseq_reader_t *r, uint64_t i, seq_p_t seq)
+{
+  uint64_t w0, w1, n0, n1, k;
+  int32_t end = 0;
+
+  if (i >= r->hdr.count) {
+    r->err = "No such record";
+    return -1;
+  }
+  w0 = r->word_off[i];
+  w1 = r->word_off[i + 1];
+  n0 = r->nrun_off[i];
+  n1 = r->nrun_off[i + 1];
+  r->err = "Corrupt packed sequence file";
+  if (r->len[i] > INT_MAX || w0 > w1 || w1 > r->hdr.words || w1 - w0 > INT_MAX ||
+      w1 - w0 < r->len[i] / SEQ_WORD_BASES + 2 || n0 > n1 || n1 > r->hdr.nruns)
+    return -1;
+  for (k = n0; k < n1; k++) {
+    if (r->nrun[2*k] < end || r->nrun[2*k] >= r->nrun[2*k + 1] || r->nrun[2*k + 1] > (int32_t)r->len[i])
+      return -1;
+    end = r->nrun[2*k + 1];
+  }
+  seq->hdr = NULL;
+  if (r->hdr_off != NULL) {
+    uint64_t h0 = r->hdr_off[i], h1 = r->hdr_off[i + 1];
+    if (h0 >= h1 || h1 > r->hdr.hdr_bytes || r->text[h1 - 1] != '\0')
+      return -1;
+    seq->hdr = (char *)r->text + h0;
+  }
+  r->err = NULL;
+  seq->bits = (uint64_t *)(r->bits + w0);
+  seq->len = (int)r->len[i];
+  seq->words = (int)(w1 - w0);
+  seq->nrun = (int *)(r->nrun + 2 * n0);
+  seq->nrun_cnt = seq->nrun_size = (int)(n1 - n0);
+  return 0;
+}
+
+/* Next record as a view (see pseq_get).  Returns 1 if there is one, 0 at
+   the end of the file and -1 on error */
+static inline int
+pseq_next(pseq_reader_t *r, seq_p_t seq)
+{
+  if (r->next >= r->hdr.count)
+    return 0;
+  if (pseq_get(r, r->next, seq) != 0)
+    return -1;
+  r->next++;
+  return 1;
+}
+
+/* Copy a view into seq (seq_init'ed), keeping the header of seq */
+static inline void
+pseq_copy(const seq_t *view, seq_p_t seq)
+{
+  int words = view->len / SEQ_WORD_BASES + 2;
+
+  seq_clear(seq);
+  seq_reserve(seq, view->len);
+  memcpy(seq->bits, view->bits, (size_t)words * sizeof(uint64_t));
+  seq->len = view->len;
+  if (view->nrun_cnt > seq->nrun_size) {
+    seq->nrun_size = view->nrun_cnt;
+    seq->nrun = (int *)realloc(seq->nrun, 2 * (size_t)seq->nrun_size * sizeof(int));
+    if (seq->nrun == NULL)
+      seq_oom();
+  }
+  memcpy(seq->nrun, view->nrun, 2 * (size_t)view->nrun_cnt * sizeof(int));
+  seq->nrun_cnt = view->nrun_cnt;
+}
+
+#endif
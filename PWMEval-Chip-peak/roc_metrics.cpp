@@ -0,0 +1,278 @@
+#include <string>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <stdint.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "roc_auc.h"
+
+/*
+  ROC and PR metrics (roc_auc.h) of the binary score files written by
+  pwm_scoring, one result per score column.
+*/
+
+#define SCORE_MAGIC "PWMSCORE"   // Binary output of pwm_scoring
+
+static bool write_file(const std::string& filename, const std::string& data) {
+  FILE *f = fopen(filename.c_str(), "w");
+  if (f == NULL) {
+    std::cerr << "Failed to open " << filename << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) {
+    std::cerr << "Failed to write " << filename << ": " << strerror(errno) << std::endl;
+  }
+  return ok;
+}
+
+// Curve points table, with the header of the R write.table
+static bool store_curve(const std::string& filename, const std::vector<CurvePoint>& curve, const char *x_name, const char *y_name) {
+  std::string out;
+  out += x_name;
+  out += '\t';
+  out += y_name;
+  out += '\n';
+  for (size_t i = 0; i < curve.size(); ++i) {
+    append_number(out, curve[i].x);
+    out += '\t';
+    append_number(out, curve[i].y);
+    out += '\n';
+  }
+  return write_file(filename, out);
+}
+
+// A pwm_scoring binary output (see write_binary_header), mapped: its score
+// columns are gathered one at a time, so that memory grows with the number
+// of sequences and not with the number of motifs
+class ScoreFile {
+public:
+  ScoreFile() : map_(NULL), size_(0), ncols_(0), nrows_(0) {}
+  ~ScoreFile() {
+    if (map_ != NULL) {
+      munmap(map_, size_);
+    }
+  }
+
+  bool open(const char *filename) {
+    struct stat st;
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      std::cerr << "Failed to open " << filename << ": " << strerror(errno) << std::endl;
+      if (fd >= 0) {
+        close(fd);
+      }
+      return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+      std::cerr << "Not a regular file: " << filename << std::endl;
+      close(fd);
+      return false;
+    }
+    size_ = (size_t)st.st_size;
+    if (size_ >= 16) {
+      void *map = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      map_ = map == MAP_FAILED ? NULL : (unsigned char *)map;
+      if (map_ == NULL) {
+        std::cerr << "Failed to map " << filename << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+      }
+    }
+    close(fd);
+    if (map_ == NULL || memcmp(map_, SCORE_MAGIC, 8) != 0) {
+      std::cerr << "Not a binary score file: " << filename << std::endl;
+      return false;
+    }
+    ncols_ = (size_t)map_[8] | (size_t)map_[9] << 8 | (size_t)map_[10] << 16 | (size_t)map_[11] << 24;
+    if (ncols_ == 0) {
+      std::cerr << "Not a binary score file: " << filename << std::endl;
+      return false;
+    }
+    if ((size_ - 16) % (ncols_ * 8) != 0) {
+      std::cerr << "Truncated binary score file: " << filename << std::endl;
+      return false;
+    }
+    nrows_ = (size_ - 16) / (ncols_ * 8);
+    return true;
+  }
+
+  size_t columns() const { return ncols_; }
+
+  // Little-endian float64 scores of one column, one per sequence
+  void column(size_t col, std::vector<double>& out) const {
+    const unsigned char *p = map_ + 16 + col * 8;
+    out.resize(nrows_);
+    for (size_t i = 0; i < nrows_; ++i, p += ncols_ * 8) {
+      uint64_t bits = 0;
+      for (int k = 7; k >= 0; --k) {
+        bits = bits << 8 | p[k];
+      }
+      memcpy(&out[i], &bits, sizeof(double));
+    }
+  }
+
+private:
+  unsigned char *map_;
+  size_t size_;
+  size_t ncols_;
+  size_t nrows_;
+};
+
+// Curve file of a score column: with motif names, the file name is
+// suffixed with the name of the column (characters other than letters, digits,
+// '-', '_' and '.' replaced by '_')
+static std::string curve_filename(const std::string& filename, const std::string *name) {
+  if (name == NULL) {
+    return filename;
+  }
+  std::string out = filename + '.';
+  for (size_t i = 0; i < name->size(); ++i) {
+    char c = (*name)[i];
+    out += (isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.') ? c : '_';
+  }
+  return out;
+}
+
+static void usage(const char *name) {
+  std::cerr <<
+    "Usage: " << name << " [options] <positive scores> <negative scores>\n"
+    "   where options are:\n"
+    "     -t[--top] <fraction>    Only use the top <fraction> of the scores of each class\n"
+    "     -n[--name] <name>       Motif name of the next score column (reported as \"motif\")\n"
+    "     -r[--roc] <file>        Store the ROC curve points (fpr, tpr) in <file>\n"
+    "     -p[--pr] <file>         Store the PR curve points (recall, precision) in <file>\n"
+    "     -m[--max-points] <n>    Downsample the stored curves to at most <n> points [Default=all]\n"
+    "     -j[--json]              Print results as JSON (with the stored curves)\n"
+    "\n   Compute the ROC AUC, the PR AUC and its Davis-Goadrich variant, as PRROC does, of the\n"
+    "   binary scores written by pwm_scoring --output-format binary, one result per score column.\n"
+    "   With motif names (required for several columns), the curve files are named <file>.<name>.\n";
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static struct option long_options[] = {
+    {"top",        required_argument, 0, 't'},
+    {"name",       required_argument, 0, 'n'},
+    {"roc",        required_argument, 0, 'r'},
+    {"pr",         required_argument, 0, 'p'},
+    {"max-points", required_argument, 0, 'm'},
+    {"json",       no_argument,       0, 'j'},
+    {"help",       no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+  };
+  double top_fraction = 1;
+  bool top = false, json = false;
+  size_t max_points = 0;
+  std::vector<std::string> names;
+  std::string roc_filename, pr_filename;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "t:n:r:p:m:jh", long_options, NULL)) != -1) {
+    switch (c) {
+    case 't':
+      top = true;
+      top_fraction = atof(optarg);
+      if (!(top_fraction > 0 && top_fraction <= 1)) {
+        std::cerr << "Invalid top fraction \"" << optarg << "\" (it should be in ]0,1])" << std::endl;
+        return 1;
+      }
+      break;
+    case 'n':
+      names.push_back(optarg);
+      break;
+    case 'r':
+      roc_filename = optarg;
+      break;
+    case 'p':
+      pr_filename = optarg;
+      break;
+    case 'm':
+      max_points = (size_t)atol(optarg);
+      break;
+    case 'j':
+      json = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2) {
+    usage(argv[0]);
+  }
+
+  ScoreFile pos_file, neg_file;
+  if (!pos_file.open(argv[optind]) || !neg_file.open(argv[optind + 1])) {
+    return 1;
+  }
+  size_t ncols = pos_file.columns();
+  if (ncols != neg_file.columns()) {
+    std::cerr << "Different numbers of score columns: " << ncols << " and " << neg_file.columns() << std::endl;
+    return 1;
+  }
+  if (!names.empty() && names.size() != ncols) {
+    std::cerr << "Got " << names.size() << " motif names for " << ncols << " score columns" << std::endl;
+    return 1;
+  }
+
+  bool roc_curve = !roc_filename.empty(), pr_curve = !pr_filename.empty();
+  if ((roc_curve || pr_curve) && ncols > 1 && names.empty()) {
+    std::cerr << "Curves of " << ncols << " score columns need a --name for each (curve file suffix)" << std::endl;
+    return 1;
+  }
+  std::vector<double> pos, neg;
+  std::string out;
+  for (size_t col = 0; col < ncols; ++col) {
+    const std::string *name = names.empty() ? NULL : &names[col];
+    pos_file.column(col, pos);
+    neg_file.column(col, neg);
+    if (top) {
+      take_top_fraction(pos, top_fraction);
+      take_top_fraction(neg, top_fraction);
+    }
+    Metrics m = compute_metrics(pos, neg, roc_curve, pr_curve);
+    downsample(m.roc_curve, max_points);
+    downsample(m.pr_curve, max_points);
+    if (roc_curve && !store_curve(curve_filename(roc_filename, name), m.roc_curve, "fpr", "tpr")) {
+      return 1;
+    }
+    if (pr_curve && !store_curve(curve_filename(pr_filename, name), m.pr_curve, "recall", "precision")) {
+      return 1;
+    }
+
+    if (json) {
+      append_json(out, m, name, roc_curve, pr_curve);
+    } else {
+      const char *labels[2] = {"ROC ", "PR "};
+      double values[2] = {m.roc_auc, m.pr_auc};
+      for (int k = 0; k < 2; ++k) {
+        if (name != NULL) {
+          out += *name;
+          out += ' ';
+        }
+        out += labels[k];
+        append_number(out, values[k]);
+        out += '\n';
+      }
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    out.clear();
+  }
+  if (fflush(stdout) != 0) {
+    std::cerr << "Write error: " << strerror(errno) << std::endl;
+    return 1;
+  }
+  return 0;
+}
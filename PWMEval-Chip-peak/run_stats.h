@@ -0,0 +1,227 @@
+/*
+
+  Run statistics of pwm_scoring, seqshuffle and filter_fasta (--stats).
+
+  A run goes through phases: setup (options, motifs, opening the input),
+  then read, process (scoring, shuffling or filtering) and write, which
+  alternate record by record, and wait (reader idle while scoring threads
+  catch up).  The wall time of each phase is taken from the monotonic
+  clock at every switch, which costs a few tens of nanoseconds.  CPU
+  clocks cost a system call each, so CPU time is only measured per phase
+  where phases run on their own threads (setup, and the reader and the
+  scoring threads of pwm_scoring --threads); the user and system time of
+  the whole run are always reported.
+
+  Along with the records, bases, non-ACGT bases, longest record, input and
+  output bytes, throughput and peak RSS, the statistics are written at the
+  end of the run on stderr or in a file, as "name<TAB>value" lines or as a
+  JSON object.
+
+*/
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define STATS_NAME_MAX 132
+
+enum { STATS_SETUP, STATS_READ, STATS_PROCESS, STATS_WRITE, STATS_WAIT, STATS_PHASES };
+
+typedef struct _run_stats_t {
+  int enabled;
+  int json;                  /* JSON report instead of text        */
+  const char *path;          /* Report file, NULL for stderr       */
+  const char *tool;
+  const char *phase_name[STATS_PHASES];
+  int threads;
+  int phase;                 /* Current phase                      */
+  double start;              /* Monotonic time of stats_start      */
+  double cpu_start;          /* Process CPU time of stats_start    */
+  double mark;               /* Start of the current phase         */
+  double wall[STATS_PHASES];
+  double cpu[STATS_PHASES];  /* Negative when not measured         */
+  unsigned long long in_bytes;
+  unsigned long long out_bytes;
+  unsigned long long records;
+  unsigned long long bases;
+  unsigned long long other;  /* Non-ACGT bases                     */
+  unsigned long long longest;
+  char longest_name[STATS_NAME_MAX];
+} run_stats_t;
+
+static inline double
+stats_clock(clockid_t id)
+{
+  struct timespec t;
+
+  clock_gettime(id, &t);
+  return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+}
+
+/* Parse the argument of --stats (NULL, "text" or "json").  Returns 0, or
+   -1 for an unknown format */
+static inline int
+stats_parse(run_stats_t *st, const char *arg)
+{
+  st->enabled = 1;
+  if (arg == NULL || !strcmp(arg, "text")) {
+    st->json = 0;
+  } else if (!strcmp(arg, "json")) {
+    st->json = 1;
+  } else {
+    fprintf(stderr, "Unknown statistics format \"%s\" (text or json)\n", arg);
+    return -1;
+  }
+  return 0;
+}
+
+/* Start the setup phase; process names the process phase ("score", ...) */
+static inline void
+stats_start(run_stats_t *st, const char *tool, const char *process)
+{
+  int k;
+
+  st->tool = tool;
+  st->phase_name[STATS_SETUP] = "setup";
+  st->phase_name[STATS_READ] = "read";
+  st->phase_name[STATS_PROCESS] = process;
+  st->phase_name[STATS_WRITE] = "write";
+  st->phase_name[STATS_WAIT] = "wait";
+  for (k = 0; k < STATS_PHASES; k++) {
+    st->wall[k] = 0;
+    st->cpu[k] = -1;
+  }
+  st->threads = 1;
+  st->phase = STATS_SETUP;
+  st->start = st->mark = stats_clock(CLOCK_MONOTONIC);
+  st->cpu_start = stats_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/* Add the time since the last switch to the current phase; leaving the
+   setup measures its CPU time */
+static inline void
+stats_lap(run_stats_t *st)
+{
+  double now = stats_clock(CLOCK_MONOTONIC);
+
+  st->wall[st->phase] += now - st->mark;
+  if (st->phase == STATS_SETUP && st->cpu[STATS_SETUP] < 0)
+    st->cpu[STATS_SETUP] = stats_clock(CLOCK_PROCESS_CPUTIME_ID) - st->cpu_start;
+  st->mark = now;
+}
+
+/* Switch to another phase */
+static inline void
+stats_phase(run_stats_t *st, int phase)
+{
+  if (!st->enabled || phase == st->phase)
+    return;
+  stats_lap(st);
+  st->phase = phase;
+}
+
+/* Count a record of len bases, other of them non-ACGT */
+static inline void
+stats_record(run_stats_t *st, const char *name, size_t name_len, unsigned long long len, unsigned long long other)
+{
+  st->records++;
+  st->bases += len;
+  st->other += other;
+  if (len > st->longest || st->records == 1) {
+    st->longest = len;
+    if (name_len >= STATS_NAME_MAX)
+      name_len = STATS_NAME_MAX - 1;
+    memcpy(st->longest_name, name, name_len);
+    st->longest_name[name_len] = '\0';
+  }
+}
+
+static inline void
+stats_json_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+/* End the current phase and write the report.  Returns 0, or -1 if the
+   report file cannot be written */
+static inline int
+stats_report(run_stats_t *st)
+{
+  struct rusage ru;
+  double total, run, user, sys;
+  FILE *f = stderr;
+  int k, first = 1;
+
+  if (!st->enabled)
+    return 0;
+  stats_lap(st);
+  total = st->mark - st->start;
+  run = total - st->wall[STATS_SETUP];
+  getrusage(RUSAGE_SELF, &ru);
+  user = (double)ru.ru_utime.tv_sec + 1e-6 * (double)ru.ru_utime.tv_usec;
+  sys = (double)ru.ru_stime.tv_sec + 1e-6 * (double)ru.ru_stime.tv_usec;
+  if (run <= 0)
+    run = 1e-9;
+  if (st->path != NULL && (f = fopen(st->path, "w")) == NULL) {
+    fprintf(stderr, "Unable to open '%s': %s(%d)\n", st->path, strerror(errno), errno);
+    return -1;
+  }
+  if (st->json) {
+    fprintf(f, "{\"tool\": \"%s\", \"threads\": %d, \"phases\": {", st->tool, st->threads);
+    for (k = 0; k < STATS_PHASES; k++) {
+      if (k == STATS_WAIT && st->wall[k] == 0)
+        continue;
+      fprintf(f, "%s\"%s\": {\"wall_s\": %.6f", first ? "" : ", ", st->phase_name[k], st->wall[k]);
+      if (st->cpu[k] >= 0)
+        fprintf(f, ", \"cpu_s\": %.6f", st->cpu[k]);
+      fputc('}', f);
+      first = 0;
+    }
+    fprintf(f, "}, \"wall_s\": %.6f, \"cpu_user_s\": %.6f, \"cpu_sys_s\": %.6f, \"peak_rss_kb\": %ld, ",
+            total, user, sys, (long)ru.ru_maxrss);
+    fprintf(f, "\"input_bytes\": %llu, \"output_bytes\": %llu, \"records\": %llu, \"bases\": %llu, "
+            "\"non_acgt_bases\": %llu, \"longest_record\": {\"name\": ",
+            st->in_bytes, st->out_bytes, st->records, st->bases, st->other);
+    stats_json_string(f, st->longest_name);
+    fprintf(f, ", \"length\": %llu}, \"records_per_s\": %.1f, \"bases_per_s\": %.1f, \"input_bytes_per_s\": %.1f}\n",
+            st->longest, st->records / run, st->bases / run, st->in_bytes / run);
+  } else {
+    fprintf(f, "tool\t%s\nthreads\t%d\n", st->tool, st->threads);
+    for (k = 0; k < STATS_PHASES; k++) {
+      if (k == STATS_WAIT && st->wall[k] == 0)
+        continue;
+      fprintf(f, "wall_%s_s\t%.6f\n", st->phase_name[k], st->wall[k]);
+      if (st->cpu[k] >= 0)
+        fprintf(f, "cpu_%s_s\t%.6f\n", st->phase_name[k], st->cpu[k]);
+    }
+    fprintf(f, "wall_s\t%.6f\ncpu_user_s\t%.6f\ncpu_sys_s\t%.6f\npeak_rss_kb\t%ld\n",
+            total, user, sys, (long)ru.ru_maxrss);
+    fprintf(f, "input_bytes\t%llu\noutput_bytes\t%llu\nrecords\t%llu\nbases\t%llu\nnon_acgt_bases\t%llu\n",
+            st->in_bytes, st->out_bytes, st->records, st->bases, st->other);
+    fprintf(f, "longest_record\t%s\t%llu\n", st->longest_name, st->longest);
+    fprintf(f, "records_per_s\t%.1f\nbases_per_s\t%.1f\ninput_bytes_per_s\t%.1f\n",
+            st->records / run, st->bases / run, st->in_bytes / run);
+  }
+  if (f != stderr && fclose(f) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", st->path, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,238 @@
+#!/usr/bin/env bash
+# Benchmark the scoring modes of pwm_scoring on synthetic data, and check
+# every optimized kernel and scoring path against the scalar kernel.
+#
+#   bench.sh [-q] [-r <repeats>] [-o <results.tsv>] [<work_dir>]
+#
+# Reads and motifs are generated by bench_data (deterministic: same data on
+# every run), packed with seqpack so that the timings measure scoring rather
+# than FASTA parsing, and scored by:
+#   LPM sum of probabilities, LPM --best, --pwm (best hits) and --pwm
+#   sites of p-value at most 1e-4 (-P), on both strands and forward
+#   only (-f),
+# for every motif length, read length and dataset size below.  Each setup
+# is scored with -k scalar (the reference), then by every variant: the SIMD
+# kernels supported by the CPU, several threads (-t), k-mer tables (-K,
+# whose LPM sums may differ from the reference in the last digits) and
+# branch and bound (-B, --best only).  Binary scores are compared value by
+# value (bench_data compare), and the default text output of each variant
+# byte for byte (cmp) with that of the reference; only -K LPM sums are
+# compared with a tolerance.  The reference itself is checked against the
+# baseline pwm_scoring (built from the git revision BASELINE, the code
+# before the optimizations, which has no -P) run on the FASTA reads: the text output without headers must be the
+# same, LPM sums up to their last printed digit.  Any mismatch is reported
+# and fails the run.
+# Before the grid, LPM --best with non-uniform backgrounds (-q, -p) is run
+# by every variant on a short motif with repeated probabilities, where ties
+# are frequent, and compared byte for byte with the baseline, whose
+# products decide the ties.
+#
+# The results are a table of the best time of the repeats, Mbases/s and
+# Kseqs/s of every run.  Override the grid with the environment variables
+# MOTIF_LENGTHS, READ_LENGTHS and DATASET_BASES (bases per dataset, the
+# number of reads follows from the read length); CC and CFLAGS set the
+# compiler (the Dockerfile flags by default), BASELINE the baseline
+# revision [Default=0824936].  Requires bash 5 and git.
+set -e -u -o pipefail
+
+SRC_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:-"-O3 -W -Wall -pedantic -std=gnu99"}
+BASELINE=${BASELINE:-0824936}
+REPEATS=3
+RESULTS=
+QUICK=0
+
+while getopts "qr:o:h" opt; do
+  case $opt in
+    q) QUICK=1 ;;
+    r) REPEATS=$OPTARG ;;
+    o) RESULTS=$OPTARG ;;
+    *) sed -n '2,35s/^# \{0,1\}//p' "${BASH_SOURCE[0]}" >&2; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ "$QUICK" -eq 1 ]; then
+  MOTIF_LENGTHS=${MOTIF_LENGTHS:-"8 20"}
+  READ_LENGTHS=${READ_LENGTHS:-"30 300"}
+  DATASET_BASES=${DATASET_BASES:-"300000"}
+  REPEATS=1
+else
+  MOTIF_LENGTHS=${MOTIF_LENGTHS:-"8 15 25"}
+  READ_LENGTHS=${READ_LENGTHS:-"30 100 1000"}
+  DATASET_BASES=${DATASET_BASES:-"1000000 10000000"}
+fi
+THREADS=${THREADS:-4}
+
+WORK_DIR=${1:-$(mktemp -d)}
+mkdir -p "$WORK_DIR"
+RESULTS=${RESULTS:-"$WORK_DIR/results.tsv"}
+
+echo "Building in $WORK_DIR" >&2
+$CC $CFLAGS -pthread "$SRC_DIR/pwm_scoring.c" "$SRC_DIR/motif_scan.c" -o "$WORK_DIR/pwm_scoring" -lm -lz
+$CC $CFLAGS "$SRC_DIR/seqpack.c" -o "$WORK_DIR/seqpack" -lz
+$CC $CFLAGS "$SRC_DIR/bench_data.c" -o "$WORK_DIR/bench_data" -lm
+git -C "$SRC_DIR" show "$BASELINE:./pwm_scoring.c" > "$WORK_DIR/pwm_baseline.c"
+$CC $CFLAGS -w "$WORK_DIR/pwm_baseline.c" -o "$WORK_DIR/pwm_baseline" -lm
+
+# SIMD kernels of this CPU
+"$WORK_DIR/bench_data" -s 1 lpm 4 > "$WORK_DIR/probe.lpm"
+"$WORK_DIR/bench_data" -s 1 reads 1 10 > "$WORK_DIR/probe.fa"
+KERNELS=
+for kernel in avx2 avx512; do
+  if "$WORK_DIR/pwm_scoring" -k "$kernel" -m "$WORK_DIR/probe.lpm" "$WORK_DIR/probe.fa" > /dev/null 2>&1; then
+    KERNELS="$KERNELS $kernel"
+  fi
+done
+echo "SIMD kernels:${KERNELS:- none}" >&2
+FAILED=0
+
+# Ties of LPM --best under non-uniform backgrounds, against the baseline
+printf ">ties\n0.5\t0.3\t0.2\t0\n0.2\t0.3\t0.3\t0.2\n0.1\t0.4\t0.2\t0.3\n" > "$WORK_DIR/ties.lpm"
+"$WORK_DIR/bench_data" -s 3 -n 0.001 reads 2000 20:120 > "$WORK_DIR/ties.fa"
+"$WORK_DIR/bench_data" -s 3 -n 0.001 reads 2000 60 >> "$WORK_DIR/ties.fa"
+for bg in "-q" "-p 0.3,0.2,0.2,0.3" "-p 0.29,0.21,0.21,0.29"; do
+  for strand in "" "-f"; do
+    opts="-b $bg $strand -m $WORK_DIR/ties.lpm"
+    # shellcheck disable=SC2086
+    "$WORK_DIR/pwm_baseline" $opts "$WORK_DIR/ties.fa" > "$WORK_DIR/ties_ref.txt"
+    variants=("-k scalar" "-t $THREADS" "-B")
+    for kernel in $KERNELS; do
+      variants+=("-k $kernel")
+    done
+    # k-mer tables are not used with -q
+    [ "$bg" != "-q" ] && variants+=("-K 3")
+    for variant in "${variants[@]}"; do
+      # shellcheck disable=SC2086
+      "$WORK_DIR/pwm_scoring" $opts $variant "$WORK_DIR/ties.fa" > "$WORK_DIR/ties.txt"
+      if ! cmp -s "$WORK_DIR/ties_ref.txt" "$WORK_DIR/ties.txt"; then
+        echo "MISMATCH with the baseline: pwm_scoring $opts $variant" >&2
+        FAILED=$((FAILED + 1))
+      fi
+    done
+  done
+done
+echo "Baseline ties of LPM --best: $([ "$FAILED" -eq 0 ] && echo ok || echo "$FAILED mismatch(es)")" >&2
+
+# Best wall time of $REPEATS runs of the command, scores written to $OUT
+time_run() {
+  local best= start elapsed i
+  for ((i = 0; i < REPEATS; i++)); do
+    start=$EPOCHREALTIME
+    "$@" > "$OUT"
+    elapsed=$(awk -v a="$start" -v b="$EPOCHREALTIME" 'BEGIN { printf "%.6f", b - a }')
+    if [ -z "$best" ] || awk -v a="$elapsed" -v b="$best" 'BEGIN { exit !(a < b) }'; then
+      best=$elapsed
+    fi
+  done
+  echo "$best"
+}
+
+# Whether two text outputs are the same: byte for byte with a tolerance
+# $1 of 0, else up to a relative difference of $1 between numbers
+text_same() {
+  if [ "$1" = 0 ]; then
+    cmp -s "$2" "$3"
+    return
+  fi
+  awk -v tol="$1" -F '\t' '
+    NR == FNR { ref[FNR] = $0; n = FNR; next }
+    {
+      if (FNR > n || split(ref[FNR], r, "\t") != NF) exit 1
+      for (i = 1; i <= NF; i++) {
+        if ($i == r[i]) continue
+        if ($i !~ /^[-+.0-9eE]+$/ || r[i] !~ /^[-+.0-9eE]+$/) exit 1
+        d = $i - r[i]; m = r[i] < 0 ? -r[i] : r[i]
+        if (d > tol * m || -d > tol * m) exit 1
+      }
+    }
+    END { if (FNR != n) exit 1 }' "$2" "$3"
+}
+
+MODES=("lpm-sum lpm" "lpm-best lpm -b" "pwm-best pwm --pwm -b" "pwm-sites pwm --pwm -P 1e-4")
+STRANDS=("both" "forward -f")
+printf "mode\tstrand\tmotif_len\tread_len\treads\tvariant\tseconds\tMbases_per_s\tKseqs_per_s\tcheck\n" > "$RESULTS"
+
+for bases in $DATASET_BASES; do
+  for read_len in $READ_LENGTHS; do
+    reads=$((bases / read_len))
+    data="$WORK_DIR/reads_${read_len}_${reads}"
+    if [ ! -s "$data.pseq" ] || [ ! -s "$data.fa" ]; then
+      "$WORK_DIR/bench_data" -s "$read_len" -n 0.001 reads "$reads" "$read_len" > "$data.fa"
+      "$WORK_DIR/seqpack" -n "$data.fa" "$data.pseq"
+    fi
+    for motif_len in $MOTIF_LENGTHS; do
+      for kind in lpm pwm; do
+        "$WORK_DIR/bench_data" -s "$motif_len" "$kind" "$motif_len" > "$WORK_DIR/motif_$kind$motif_len.txt"
+      done
+      for mode in "${MODES[@]}"; do
+        read -r mode_name kind mode_opts <<< "$mode"
+        for strand in "${STRANDS[@]}"; do
+          read -r strand_name strand_opts <<< "$strand"
+          text_opts="$mode_opts $strand_opts -m $WORK_DIR/motif_$kind$motif_len.txt"
+          opts="-o binary $text_opts"
+          variants=("scalar -k scalar")
+          for kernel in $KERNELS; do
+            variants+=("$kernel -k $kernel")
+          done
+          variants+=("threads$THREADS -t $THREADS" "kmer5 -K 5")
+          if [ "$mode_name" = "lpm-best" ] || [ "$mode_name" = "pwm-best" ]; then
+            variants+=("bound -B")
+          fi
+          ref="$WORK_DIR/ref.bin"
+          ref_text="$WORK_DIR/ref.txt"
+          for variant in "${variants[@]}"; do
+            read -r variant_name variant_opts <<< "$variant"
+            OUT="$WORK_DIR/out.bin"
+            text_out="$WORK_DIR/out.txt"
+            if [ "$variant_name" = "scalar" ]; then
+              OUT=$ref
+              text_out=$ref_text
+            fi
+            # shellcheck disable=SC2086
+            seconds=$(time_run "$WORK_DIR/pwm_scoring" $opts $variant_opts "$data.pseq")
+            # shellcheck disable=SC2086
+            "$WORK_DIR/pwm_scoring" $text_opts $variant_opts "$data.pseq" > "$text_out"
+            check=reference
+            if [ "$variant_name" = "scalar" ] && [ "$mode_name" != "pwm-sites" ]; then
+              # The baseline names the reads, the packed file does not
+              text_tol=0
+              [ "$mode_name" = "lpm-sum" ] && text_tol=1e-5
+              # shellcheck disable=SC2086
+              "$WORK_DIR/pwm_baseline" -r $text_opts "$data.fa" > "$WORK_DIR/baseline.txt"
+              cut -f 2- "$ref_text" > "$WORK_DIR/ref_nohdr.txt"
+              if text_same "$text_tol" "$WORK_DIR/baseline.txt" "$WORK_DIR/ref_nohdr.txt"; then
+                check=baseline
+              else
+                check=MISMATCH
+                FAILED=$((FAILED + 1))
+              fi
+            elif [ "$variant_name" != "scalar" ]; then
+              # The text output has 6 significant digits
+              tol=0 text_tol=0
+              [ "$variant_name" = "kmer5" ] && [ "$mode_name" = "lpm-sum" ] && tol=1e-9 text_tol=1e-5
+              if "$WORK_DIR/bench_data" -e "$tol" compare "$ref" "$OUT" > /dev/null \
+                  && text_same "$text_tol" "$ref_text" "$text_out"; then
+                check=ok
+              else
+                check=MISMATCH
+                FAILED=$((FAILED + 1))
+              fi
+            fi
+            awk -v s="$seconds" -v b="$((reads * read_len))" -v n="$reads" \
+                -v row="$mode_name\t$strand_name\t$motif_len\t$read_len\t$reads\t$variant_name" -v c="$check" \
+                'BEGIN { printf "%s\t%s\t%.2f\t%.1f\t%s\n", row, s, b / s / 1e6, n / s / 1e3, c }' \
+              | tee -a "$RESULTS"
+          done
+        done
+      done
+    done
+  done
+done
+
+echo "Results in $RESULTS" >&2
+if [ "$FAILED" -gt 0 ]; then
+  echo "$FAILED run(s) differ from the scalar kernel (variants) or the baseline (scalar kernel)" >&2
+  exit 1
+fi
@@ -0,0 +1,258 @@
+/*
+
+  Deterministic synthetic data for bench.sh: random reads (FASTA), random
+  motifs (LPM or PWM), and comparison of binary score files.
+
+    bench_data [-s seed] [-n frac] reads <count> <len>[:<max_len>]
+    bench_data [-s seed] lpm|pwm <len>
+    bench_data [-e tol] compare <reference> <scores>
+
+  The same seed gives the same data on every platform (splitmix64, no
+  libc random).
+
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define SCORE_MAGIC "PWMSCORE"     /* motif_scan.h binary output */
+#define LINE_WIDTH 60
+
+typedef struct _options_t {
+  int help;
+  uint64_t seed;
+  double nfrac;              /* Fraction of N bases in the reads */
+  double tol;                /* Relative tolerance of compare (0 = exact) */
+} options_t;
+
+static options_t options;
+
+static uint64_t rng_state;
+
+static uint64_t
+rng_next(void)
+{
+  uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* Uniform in [0, 1[ */
+static double
+rng_unif(void)
+{
+  return (double)(rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int
+write_reads(long count, int min_len, int max_len)
+{
+  static const char bases[4] = {'A', 'C', 'G', 'T'};
+  char *line;
+  long i;
+
+  if ((line = malloc((size_t)max_len + 1)) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    int len = min_len + (int)(rng_next() % (uint64_t)(max_len - min_len + 1));
+    int k;
+    for (k = 0; k < len; k++) {
+      uint64_t r = rng_next();
+      line[k] = (options.nfrac > 0 && rng_unif() < options.nfrac) ? 'N' : bases[r & 3];
+    }
+    printf(">r%ld\n", i);
+    for (k = 0; k < len; k += LINE_WIDTH)
+      printf("%.*s\n", len - k < LINE_WIDTH ? len - k : LINE_WIDTH, line + k);
+  }
+  free(line);
+  return 0;
+}
+
+/* Columns of skewed random frequencies, with some zeros as in real
+   motifs; PWMs are their integer log-odds */
+static void
+write_motif(int lpm, int len)
+{
+  int j, k;
+
+  printf(">%s_%d_%llu\n", lpm ? "lpm" : "pwm", len, (unsigned long long)options.seed);
+  for (j = 0; j < len; j++) {
+    double v[4], sum = 0;
+    for (k = 0; k < 4; k++) {
+      double u = rng_unif();
+      v[k] = u * u * u;
+    }
+    if (j % 5 == 2)
+      v[rng_next() & 3] = 0.0;
+    for (k = 0; k < 4; k++)
+      sum += v[k];
+    for (k = 0; k < 4; k++) {
+      double f = sum > 0 ? v[k] / sum : 0.25;
+      if (lpm)
+        printf(k < 3 ? "%.6f\t" : "%.6f\n", f);
+      else
+        printf(k < 3 ? "%d " : "%d\n", (int)floor(100.0 * log((f + 0.01) / 0.26)));
+    }
+  }
+}
+
+static unsigned char *
+read_scores(const char *path, size_t *size)
+{
+  unsigned char *data = NULL;
+  size_t len = 0, alloc = 0, n;
+  FILE *f;
+
+  if ((f = fopen(path, "rb")) == NULL) {
+    fprintf(stderr, "Unable to open '%s': %s(%d)\n", path, strerror(errno), errno);
+    return NULL;
+  }
+  do {
+    if (len == alloc) {
+      alloc = alloc ? 2 * alloc : 1 << 16;
+      if ((data = realloc(data, alloc)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+      }
+    }
+    n = fread(data + len, 1, alloc - len, f);
+    len += n;
+  } while (n > 0);
+  fclose(f);
+  if (len < 16 || memcmp(data, SCORE_MAGIC, 8) != 0 || (len - 16) % 8 != 0) {
+    fprintf(stderr, "%s is not a binary score file\n", path);
+    free(data);
+    return NULL;
+  }
+  *size = len;
+  return data;
+}
+
+/* Compare two binary score files: identical bits, or values within the
+   relative tolerance.  Prints the number of values and the largest
+   difference; returns 0 if they match */
+static int
+compare_scores(const char *ref_path, const char *path)
+{
+  unsigned char *ref, *out;
+  size_t ref_size, size, i, bad = 0;
+  double max_diff = 0;
+  int ret = 0;
+
+  if ((ref = read_scores(ref_path, &ref_size)) == NULL)
+    return -1;
+  if ((out = read_scores(path, &size)) == NULL) {
+    free(ref);
+    return -1;
+  }
+  if (ref_size != size || memcmp(ref, out, 16) != 0) {
+    fprintf(stderr, "%s and %s differ in shape (%zu and %zu bytes)\n", ref_path, path, ref_size, size);
+    ret = -1;
+  } else {
+    for (i = 16; i < size; i += 8) {
+      double a, b, d;
+      if (memcmp(ref + i, out + i, 8) == 0)
+        continue;
+      memcpy(&a, ref + i, 8);
+      memcpy(&b, out + i, 8);
+      d = fabs(a - b);
+      if (!(d <= options.tol * fmax(1.0, fabs(a)))) {
+        if (bad++ == 0)
+          fprintf(stderr, "%s: value %zu is %.17g, reference %.17g\n", path, (i - 16) / 8, b, a);
+      }
+      if (d > max_diff || isnan(d))
+        max_diff = d;
+    }
+    if (bad > 0)
+      ret = -1;
+    printf("%zu\t%zu\t%g\n", (size - 16) / 8, bad, max_diff);
+  }
+  free(ref);
+  free(out);
+  return ret;
+}
+
+static int
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options] reads <count> <len>[:<max_len>]\n"
+          "       %s [options] lpm|pwm <len>\n"
+          "       %s [options] compare <reference> <scores>\n"
+          "      where options are:\n"
+          "        -e <tol>  compare: relative tolerance of the values [Default=0 (identical)]\n"
+          "        -h        Show this help text\n"
+          "        -n <frac> reads: fraction of N bases [Default=0]\n"
+          "        -s <seed> Random seed [Default=1]\n"
+          "\n\tWrite deterministic random reads (FASTA) or a random motif on standard\n"
+          "\toutput, or compare two binary score files of pwm_scoring (-o binary):\n"
+          "\tthen print the number of values, of mismatches and the largest difference.\n\n",
+          prog, prog, prog);
+  return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *cmd;
+
+  options.seed = 1;
+  while (1) {
+    int c = getopt(argc, argv, "e:hn:s:");
+    if (c == -1)
+      break;
+    switch (c) {
+    case 'e':
+      options.tol = atof(optarg);
+      break;
+    case 'h':
+      options.help = 1;
+      break;
+    case 'n':
+      options.nfrac = atof(optarg);
+      break;
+    case 's':
+      options.seed = strtoull(optarg, NULL, 10);
+      break;
+    case '?':
+      break;
+    default:
+      printf ("?? getopt returned character code 0%o ??\n", c);
+    }
+  }
+  if (options.help == 1 || optind >= argc)
+    return usage(argv[0]);
+  rng_state = options.seed;
+  cmd = argv[optind];
+  if (!strcmp(cmd, "reads") && argc - optind == 3) {
+    long count = atol(argv[optind + 1]);
+    char *sep;
+    int min_len = (int)strtol(argv[optind + 2], &sep, 10);
+    int max_len = *sep == ':' ? atoi(sep + 1) : min_len;
+    if (count < 0 || min_len < 1 || max_len < min_len) {
+      fprintf(stderr, "Invalid read count or length\n");
+      return 1;
+    }
+    return write_reads(count, min_len, max_len) == 0 ? 0 : 1;
+  }
+  if ((!strcmp(cmd, "lpm") || !strcmp(cmd, "pwm")) && argc - optind == 2) {
+    int len = atoi(argv[optind + 1]);
+    if (len < 1) {
+      fprintf(stderr, "Invalid motif length\n");
+      return 1;
+    }
+    write_motif(cmd[0] == 'l', len);
+    return 0;
+  }
+  if (!strcmp(cmd, "compare") && argc - optind == 3)
+    return compare_scores(argv[optind + 1], argv[optind + 2]) == 0 ? 0 : 1;
+  return usage(argv[0]);
+}
@@ -0,0 +1,472 @@
+/*
+
+  FASTA (and FASTQ) reader shared by pwm_scoring, seqshuffle, filter_fasta
+  and chrom_sizes.
+
+  Regular files are memory-mapped and records are handed out as slices of
+  the mapping, without copying: the header line (without the leading '>'
+  and the line feed) and the sequence text, that still contains the line
+  breaks (see fasta_next_line).  Record boundaries, i.e. '>' characters at
+  the start of a line, are found with memchr.  Standard input, pipes and
+  other non-mappable inputs are read in large chunks into a buffer that
+  always holds the whole current record; its slices are valid until the
+  next call to fasta_next.
+
+  Gzip-compressed input (plain or BGZF, recognised by its magic bytes) is
+  inflated on the fly by gz_reader.h and read like a stream.
+
+  Text before the first header is returned as a record with a NULL header.
+
+  When part_max is set, FASTA records whose text is longer are handed out
+  in parts of at most part_max bytes (fasta_next, then fasta_next_part
+  while part is set), so that a stream buffer holds a bounded piece of a
+  chromosome-scale record instead of the whole of it.  The header is then
+  only valid until the next part is read.
+
+  Input starting with '@' is read as FASTQ: records are handed out the same
+  way (header without the '@', sequence lines up to the '+' line), with the
+  quality text in qual.  Multi-line records are accepted, the quality lines
+  being counted up to the sequence length.  When min_qual is set, records
+  whose mean Phred quality (offset 33) is below it are skipped.
+
+*/
+#ifndef FASTA_READER_H
+#define FASTA_READER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "gz_reader.h"
+
+#define FASTA_CHUNK (1 << 20)   /* Read size of the streaming fallback */
+
+typedef struct _fasta_reader_t {
+  const char *next;          /* Start of the unread input          */
+  const char *end;           /* End of the available input         */
+  char *map;                 /* Mapped file, NULL when streaming   */
+  size_t map_size;
+  FILE *stream;              /* Streaming fallback                 */
+  gz_reader_t *gz;           /* Inflater of compressed input       */
+  char *buf;                 /* Stream buffer                      */
+  size_t buf_size;
+  int eof;                   /* Stream exhausted                   */
+  int sniffed;               /* Stream checked for gzip data       */
+  int format;                /* FASTA_FORMAT, FASTQ_FORMAT, or not yet known */
+  double min_qual;           /* FASTQ mean quality filter, 0 = off */
+  size_t part_max;           /* Longest FASTA text handed out at once, 0 = whole records */
+  int part;                  /* More parts of the current record follow */
+  int bol;                   /* r->next is at the start of a line  */
+  const char *err;           /* Read error message, NULL if none   */
+  /* Current record */
+  const char *hdr;           /* Header, NULL before the first '>'  */
+  size_t hdr_len;
+  const char *seq;           /* Sequence text, with line breaks    */
+  size_t seq_len;
+  const char *qual;          /* FASTQ quality text, with line breaks */
+  size_t qual_len;
+} fasta_reader_t;
+
+enum { FASTA_UNKNOWN, FASTA_FORMAT, FASTQ_FORMAT };
+
+static inline void fasta_close(fasta_reader_t *r);
+
+/* Open a FASTA file for reading; NULL or "-" stands for standard input.
+   Returns 0, or -1 with errno set */
+static inline int
+fasta_open(fasta_reader_t *r, const char *path)
+{
+  struct stat st;
+  int fd;
+
+  memset(r, 0, sizeof(fasta_reader_t));
+  if (path == NULL || strcmp(path, "-") == 0) {
+    r->stream = stdin;
+    return 0;
+  }
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    r->map_size = (size_t)st.st_size;
+    if (r->map_size > 0) {
+      void *map = mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        r->map = (char *)map;
+#ifdef MADV_SEQUENTIAL
+        madvise(map, r->map_size, MADV_SEQUENTIAL);
+#endif
+      }
+    }
+    if (r->map != NULL || r->map_size == 0) {
+      close(fd);
+      r->sniffed = 1;
+      if (gz_magic((const unsigned char *)r->map, r->map_size)) {
+        /* Inflated into the stream buffer, from the mapping */
+        if ((r->gz = gz_open((const unsigned char *)r->map, r->map_size, NULL)) == NULL) {
+          fasta_close(r);
+          errno = ENOMEM;
+          return -1;
+        }
+        return 0;
+      }
+      r->next = r->map;
+      r->end = r->map + r->map_size;
+      r->eof = 1;
+      return 0;
+    }
+  }
+  /* Not mappable: read it as a stream */
+  if ((r->stream = fdopen(fd, "r")) == NULL) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+static inline void
+fasta_close(fasta_reader_t *r)
+{
+  gz_close(r->gz);
+  if (r->map != NULL)
+    munmap(r->map, r->map_size);
+  if (r->stream != NULL && r->stream != stdin)
+    fclose(r->stream);
+  free(r->buf);
+  memset(r, 0, sizeof(fasta_reader_t));
+}
+
+/* First '>' at the start of a line in [p, end), or end; p must not be the
+   start of the input */
+static inline const char *
+fasta_find_record(const char *p, const char *end)
+{
+  const char *q = p;
+
+  while (q < end && (q = (const char *)memchr(q, '>', (size_t)(end - q))) != NULL) {
+    if (q[-1] == '\n')
+      return q;
+    q++;
+  }
+  return end;
+}
+
+/* Read one more chunk into the stream buffer, keeping the unread input
+   (moved to the start of the buffer).  Returns 0 at the end of the input */
+static inline int
+fasta_fill(fasta_reader_t *r)
+{
+  size_t keep = r->buf ? (size_t)(r->end - r->next) : 0;
+  size_t n;
+
+  if (r->eof)
+    return 0;
+  if (r->next != r->buf && keep > 0)
+    memmove(r->buf, r->next, keep);
+  if (keep + FASTA_CHUNK > r->buf_size) {
+    size_t size = r->buf_size ? r->buf_size : FASTA_CHUNK;
+    while (keep + FASTA_CHUNK > size)
+      size *= 2;
+    if ((r->buf = (char *)realloc(r->buf, size)) == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    r->buf_size = size;
+  }
+  if (r->gz == NULL) {
+    n = fread(r->buf + keep, 1, FASTA_CHUNK, r->stream);
+    if (n == 0 && ferror(r->stream))
+      r->err = strerror(errno);
+    if (!r->sniffed) {
+      /* First chunk of a stream: switch to the inflater if compressed */
+      r->sniffed = 1;
+      if (gz_magic((const unsigned char *)r->buf, n)) {
+        if ((r->gz = gz_open((const unsigned char *)r->buf, n, r->stream)) == NULL) {
+          fprintf(stderr, "Out of memory\n");
+          exit(1);
+        }
+      }
+    }
+  }
+  if (r->gz != NULL) {
+    long k = gz_read(r->gz, r->buf + keep, FASTA_CHUNK);
+    if (k < 0)
+      r->err = gz_error(r->gz);
+    n = k > 0 ? (size_t)k : 0;
+  }
+  if (n == 0)
+    r->eof = 1;
+  r->next = r->buf;
+  r->end = r->buf + keep + n;
+  return n > 0;
+}
+
+/* Parse the FASTQ record at r->next.  Returns 1 (and sets the record
+   fields) if it is complete, 0 if more input is needed and -1 if it is
+   malformed */
+static inline int
+fastq_parse(fasta_reader_t *r)
+{
+  const char *p = r->next, *end = r->end, *nl, *seq, *plus, *qual;
+  size_t seq_cnt = 0, qual_cnt = 0;
+
+  if (*p != '@')
+    return -1;
+  if ((nl = (const char *)memchr(p, '\n', (size_t)(end - p))) == NULL)
+    return r->eof ? -1 : 0;
+  /* Sequence lines, up to the '+' line */
+  for (seq = p = nl + 1; p >= end || *p != '+'; p = nl + 1) {
+    if (p >= end || (nl = (const char *)memchr(p, '\n', (size_t)(end - p))) == NULL)
+      return r->eof ? -1 : 0;
+    seq_cnt += (size_t)(nl - p);
+  }
+  plus = p;
+  if ((nl = (const char *)memchr(p, '\n', (size_t)(end - p))) == NULL)
+    return r->eof ? -1 : 0;
+  /* Quality lines, as many characters as bases */
+  for (qual = p = nl + 1; qual_cnt < seq_cnt; p = nl + 1) {
+    if (p >= end)
+      return r->eof ? -1 : 0;
+    if ((nl = (const char *)memchr(p, '\n', (size_t)(end - p))) == NULL) {
+      if (!r->eof)
+        return 0;
+      /* Last line without a line feed */
+      qual_cnt += (size_t)(end - p);
+      p = end;
+      break;
+    }
+    qual_cnt += (size_t)(nl - p);
+  }
+  if (qual_cnt != seq_cnt)
+    return -1;
+  r->hdr = r->next + 1;
+  r->hdr_len = (size_t)(seq - 1 - r->hdr);
+  r->seq = seq;
+  r->seq_len = (size_t)(plus - seq);
+  r->qual = qual;
+  r->qual_len = (size_t)(p - qual);
+  r->next = p;
+  return 1;
+}
+
+/* Mean Phred quality of the current FASTQ record */
+static inline double
+fastq_mean_qual(const fasta_reader_t *r)
+{
+  const unsigned char *p = (const unsigned char *)r->qual;
+  const unsigned char *end = p + r->qual_len;
+  unsigned long sum = 0, n = 0;
+
+  for (; p < end; p++)
+    if (*p > ' ') {
+      sum += (unsigned long)(*p - 33);
+      n++;
+    }
+  return n > 0 ? (double)sum / (double)n : 0.0;
+}
+
+/* fasta_next for FASTQ input */
+static inline int
+fastq_next(fasta_reader_t *r)
+{
+  int ret;
+
+  for (;;) {
+    /* Blank lines between records */
+    while (r->next < r->end && (*r->next == '\n' || *r->next == '\r'))
+      r->next++;
+    if (r->next >= r->end)
+      ret = 0;
+    else
+      ret = fastq_parse(r);
+    if (ret == 0) {
+      if (fasta_fill(r))
+        continue;
+      if (r->err != NULL)
+        return -1;
+      if (r->next >= r->end)
+        return 0;
+      ret = fastq_parse(r);  /* With r->eof set */
+    }
+    if (ret < 0) {
+      r->err = "Malformed FASTQ record";
+      return -1;
+    }
+    if (r->min_qual <= 0.0 || fastq_mean_qual(r) >= r->min_qual)
+      return 1;
+  }
+}
+
+/* Hand out the text from r->next up to the next record, or as much of it
+   as the buffer holds, at most part_max bytes */
+static inline int
+fasta_cut(fasta_reader_t *r)
+{
+  size_t avail = (size_t)(r->end - r->next);
+  const char *lim = r->next + (avail > r->part_max ? r->part_max : avail);
+  const char *stop, *rec_end;
+
+  /* The byte past the part tells whether the record goes on */
+  if (lim == r->end && !r->eof && lim > r->next)
+    lim--;
+  stop = lim < r->end ? lim + 1 : lim;
+
+  if (r->next >= r->end || (r->bol && *r->next == '>'))
+    rec_end = r->next;
+  else
+    rec_end = fasta_find_record(r->next + 1, stop);
+  r->part = rec_end == stop && lim < r->end;
+  if (r->part) {
+    rec_end = lim;
+    r->bol = lim[-1] == '\n';
+  }
+  r->seq = r->next;
+  r->seq_len = (size_t)(rec_end - r->next);
+  r->next = rec_end;
+  return 1;
+}
+
+/* Advance to the next part of the current record.  Returns 1 if there is
+   one, 0 if the record is complete and -1 on a read error */
+static inline int
+fasta_next_part(fasta_reader_t *r)
+{
+  if (!r->part)
+    return 0;
+  /* Parts of a stream are what the buffer holds: it is only refilled once
+     used up, so that nothing is moved */
+  if ((r->stream != NULL || r->gz != NULL) && r->end - r->next < 2) {
+    fasta_fill(r);
+    if (r->err != NULL)
+      return -1;
+  }
+  return fasta_cut(r);
+}
+
+/* fasta_next for FASTA input split in parts (part_max set) */
+static inline int
+fasta_next_split(fasta_reader_t *r)
+{
+  const char *nl;
+  int ret;
+
+  /* Skip the parts of the previous record that were not read */
+  while ((ret = fasta_next_part(r)) > 0)
+    ;
+  if (ret < 0)
+    return -1;
+  if (r->stream != NULL || r->gz != NULL) {
+    /* The header line, and the whole record or more than part_max bytes
+       of its text, in the buffer */
+    for (;;) {
+      size_t avail = r->buf ? (size_t)(r->end - r->next) : 0;
+      if (avail > 0 && (nl = (const char *)memchr(r->next, '\n', avail)) != NULL
+          && ((size_t)(r->end - nl - 1) > r->part_max || fasta_find_record(nl + 1, r->end) < r->end))
+        break;
+      if (!fasta_fill(r)) {
+        if (r->err != NULL)
+          return -1;
+        break;
+      }
+    }
+  }
+  if (r->next >= r->end)
+    return 0;
+  if (*r->next == '>') {
+    nl = (const char *)memchr(r->next, '\n', (size_t)(r->end - r->next));
+    if (nl == NULL)
+      nl = r->end;
+    r->hdr = r->next + 1;
+    r->hdr_len = (size_t)(nl - r->hdr);
+    r->next = nl < r->end ? nl + 1 : r->end;
+  } else {
+    r->hdr = NULL;
+    r->hdr_len = 0;
+  }
+  r->bol = 1;
+  return fasta_cut(r);
+}
+
+/* Advance to the next record.  Returns 1 if there is one, 0 at the end of
+   the input and -1 on a read error (described by r->err) */
+static inline int
+fasta_next(fasta_reader_t *r)
+{
+  const char *rec_end, *nl;
+  size_t scan = 1;           /* Offset of the next record search */
+
+  if (r->format == FASTA_UNKNOWN) {
+    /* The first character tells FASTQ from FASTA */
+    if ((r->stream != NULL || r->gz != NULL) && !fasta_fill(r) && r->err != NULL)
+      return -1;
+    r->format = r->next < r->end && *r->next == '@' ? FASTQ_FORMAT : FASTA_FORMAT;
+  }
+  if (r->format == FASTQ_FORMAT)
+    return fastq_next(r);
+  if (r->part_max > 0)
+    return fasta_next_split(r);
+  if (r->stream != NULL || r->gz != NULL) {
+    /* Make sure the whole record is in the buffer */
+    for (;;) {
+      size_t avail = r->buf ? (size_t)(r->end - r->next) : 0;
+      if (scan < avail) {
+        rec_end = fasta_find_record(r->next + scan, r->end);
+        if (rec_end < r->end)
+          break;
+        /* Resume the search at the start of the last (partial) line */
+        scan = avail;
+        while (scan > 1 && r->next[scan - 1] != '\n')
+          scan--;
+      }
+      if (!fasta_fill(r)) {
+        if (r->err != NULL)
+          return -1;
+        break;
+      }
+    }
+  }
+  if (r->next >= r->end)
+    return 0;
+  rec_end = fasta_find_record(r->next + 1, r->end);
+  if (*r->next == '>') {
+    nl = (const char *)memchr(r->next, '\n', (size_t)(rec_end - r->next));
+    if (nl == NULL)
+      nl = rec_end;
+    r->hdr = r->next + 1;
+    r->hdr_len = (size_t)(nl - r->hdr);
+    r->seq = nl < rec_end ? nl + 1 : rec_end;
+  } else {
+    r->hdr = NULL;
+    r->hdr_len = 0;
+    r->seq = r->next;
+  }
+  r->seq_len = (size_t)(rec_end - r->seq);
+  r->next = rec_end;
+  return 1;
+}
+
+/* Next line of a sequence slice [*p, end), without its line feed.
+   Returns 0 when the slice is exhausted */
+static inline int
+fasta_next_line(const char **p, const char *end, const char **line, size_t *len)
+{
+  const char *nl;
+
+  if (*p >= end)
+    return 0;
+  nl = (const char *)memchr(*p, '\n', (size_t)(end - *p));
+  if (nl == NULL)
+    nl = end;
+  *line = *p;
+  *len = (size_t)(nl - *p);
+  *p = nl < end ? nl + 1 : end;
+  return 1;
+}
+
+#endif
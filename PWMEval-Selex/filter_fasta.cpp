@@ -1,55 +1,102 @@
 #include <string>
 #include <iostream>
-#include <fstream>
 #include <cstdlib>
 #include <cctype>
 #include <cstring>
+#include <cerrno>
 
-bool has_only_acgt(const std::string& seq) {
-	for (size_t i = 0; i < seq.length(); ++i){
-		char letter = toupper(seq[i]);
-		if (!(letter == 'A' || letter == 'C' || letter == 'G' || letter == 'T')) {
-			return false;
-		}
-	}
-	return true;
+#include "fasta_reader.h"
+#include "nucl_encode.h"
+#include "run_stats.h"
+
+static run_stats_t stats;  // --stats
+
+bool has_only_acgt(const char* seq, size_t length) {
+	return nucl_only_acgt(seq, length);
 }
 
-void filter_fasta(std::istream& input, std::ostream& output, bool only_acgt = false, size_t seq_length = 0) {
-	bool skip = false;
-	std::string seq_id, seq;
-	while (input.good()) {
-		std::string line;
-		std::getline(input, line);
-		if (line.length() > 0) {
-			if (line[0] == '>') {
-				if (seq_id.length() > 0 || seq.length() > 0) {
-					skip = (only_acgt && !has_only_acgt(seq)) || ((seq_length != 0) && (seq.length() != seq_length));
-					if (!skip) {
-						output << seq_id << std::endl << seq << std::endl;
-					}
-					seq.clear();
-				}
-				seq_id = line;
-			} else {
-				seq += line;
+// Sequence lines of a record are written straight from the reader's slices
+void filter_fasta(fasta_reader_t& input, std::ostream& output, bool only_acgt = false, size_t seq_length = 0) {
+	int more;
+	stats_phase(&stats, STATS_READ);
+	while ((more = fasta_next(&input)) > 0) {
+		const char *p = input.seq, *end = input.seq + input.seq_len, *line;
+		size_t line_length, length = 0, other = 0;
+		bool skip = false;
+		stats_phase(&stats, STATS_PROCESS);
+		while (fasta_next_line(&p, end, &line, &line_length)) {
+			length += line_length;
+			if (only_acgt && !skip && !has_only_acgt(line, line_length)) {
+				skip = true;
+			}
+			if (stats.enabled) {
+				other += nucl_count_other(line, line_length);
+			}
+		}
+		if (input.hdr == NULL && length == 0) {
+			stats_phase(&stats, STATS_READ);
+			continue;
+		}
+		if (stats.enabled) {
+			size_t name_length = 0;
+			while (input.hdr != NULL && name_length < input.hdr_len && !isspace((unsigned char)input.hdr[name_length])) {
+				name_length++;
+			}
+			stats.in_bytes += input.hdr_len + input.seq_len + input.qual_len;
+			stats_record(&stats, input.hdr != NULL ? input.hdr : "", name_length, length, other);
+		}
+		skip = skip || ((seq_length != 0) && (length != seq_length));
+		if (!skip) {
+			stats_phase(&stats, STATS_WRITE);
+			if (input.hdr != NULL) {
+				output << '>';
+				output.write(input.hdr, input.hdr_len);
+			}
+			output << '\n';
+			p = input.seq;
+			while (fasta_next_line(&p, end, &line, &line_length)) {
+				output.write(line, line_length);
 			}
-		} 
+			output << '\n';
+			stats.out_bytes += (input.hdr != NULL ? input.hdr_len + 1 : 0) + length + 2;
+		}
+		stats_phase(&stats, STATS_READ);
 	}
-  if (seq_id.length() > 0 || seq.length() > 0) {
-    skip = (only_acgt && !has_only_acgt(seq)) || ((seq_length != 0) && (seq.length() != seq_length));
-    if (!skip) {
-      output << seq_id << std::endl << seq << std::endl;
-    }
-  }
+	if (more < 0) {
+		std::cerr << "Failed to read file: " << input.err << std::endl;
+		exit(1);
+	}
+}
+
+static void usage(const char *name) {
+  std::cerr << "Usage: " << name << " [--stats[=text|json]] [--stats-file=<file>] <filename or - for stdin> <sequence length = integer|no> <only acgt = yes|no> [<min mean quality = number|no>]" << std::endl;
+  std::cerr << "FASTA or FASTQ input (possibly gzipped); FASTA output. The mean quality filter applies to FASTQ reads." << std::endl;
+  std::cerr << "--stats reports run statistics on stderr at the end (phase wall times, CPU time, records, bases, non-ACGT bases," << std::endl;
+  std::cerr << "longest record, bytes, throughput, peak RSS); --stats-file writes them to a file instead." << std::endl;
+  exit(1);
 }
 
 int main(int argc, char **argv) {
   size_t seq_length;
   bool only_acgt;
+  double min_qual = 0;
+  stats_start(&stats, "filter_fasta", "filter");
+  // Statistics options come before the positional arguments
+  while (argc > 1 && !strncmp(argv[1], "--stats", 7)) {
+    if (!strncmp(argv[1], "--stats-file=", 13)) {
+      stats.enabled = 1;
+      stats.path = argv[1] + 13;
+    } else if (!strcmp(argv[1], "--stats")) {
+      stats_parse(&stats, NULL);
+    } else if (strncmp(argv[1], "--stats=", 8) || stats_parse(&stats, argv[1] + 8) != 0) {
+      usage(argv[0]);
+    }
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
   if (argc < 4) {
-    std::cerr << "Usage: " << argv[0] << " <filename or - for stdin> <sequence length = integer|no> <only acgt = yes|no>" << std::endl;
-    exit(1);
+    usage(argv[0]);
   }
   
   if (!strcmp(argv[2], "no")) {
@@ -63,18 +110,21 @@ int main(int argc, char **argv) {
   } else if (!strcmp(argv[3], "no")) {
     only_acgt = false;
   } else {
-    std::cerr << "Usage: " << argv[0] << " <filename or - for stdin> <sequence length = integer|no> <only acgt = yes|no>" << std::endl;
-    exit(1); 
+    usage(argv[0]);
   }
-	if (!strcmp(argv[1], "-")) {
-		filter_fasta(std::cin, std::cout, only_acgt, seq_length);
-	} else {
-		std::ifstream fasta_file(argv[1], std::ifstream::in);
-		if (fasta_file.fail()) {
-			std::cerr << "Failed to open file" << std::endl;
-			exit(1);
-		}
-		filter_fasta(fasta_file, std::cout, only_acgt, seq_length);
+
+  if (argc > 4 && strcmp(argv[4], "no")) {
+    min_qual = atof(argv[4]);
+  }
+	fasta_reader_t fasta_file;
+	if (fasta_open(&fasta_file, argv[1]) != 0) {
+		std::cerr << "Failed to open file" << std::endl;
+		exit(1);
 	}
-  return 0;
+	fasta_file.min_qual = min_qual;
+	filter_fasta(fasta_file, std::cout, only_acgt, seq_length);
+	stats_phase(&stats, STATS_WRITE);
+	std::cout.flush();
+	fasta_close(&fasta_file);
+  return stats_report(&stats) == 0 ? 0 : 1;
 }
@@ -0,0 +1,176 @@
+/*
+
+  Buffered output writer shared by pwm_scoring and seqshuffle.
+
+  Output is assembled in a large buffer with memcpy and hand-written
+  integer formatting, and written to the file descriptor with a few large
+  write calls instead of one stdio call per field or character.  A writer
+  opened on a negative descriptor is a memory buffer that grows as needed
+  and is never flushed (e.g. the output of a batch of sequences, copied to
+  the real output later with out_write).
+
+  Floating point values are formatted like printf's %g, so that the output
+  does not change.
+
+  A file writer counts the bytes it writes and, when timed is set, the
+  wall time of its write calls (--stats).
+
+*/
+#ifndef OUT_WRITER_H
+#define OUT_WRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#define OUT_BUF_SIZE (1 << 20)   /* Flush threshold of a file writer */
+#define OUT_MEM_INIT 4096        /* Initial size of a memory writer */
+#define OUT_NUM_MAX 32           /* Room needed by one formatted number */
+
+typedef struct _out_writer_t {
+  int fd;                    /* Destination, -1 for a memory buffer */
+  char *buf;
+  size_t len;                /* Bytes waiting in buf                */
+  size_t size;
+  unsigned long long written;  /* Bytes written to fd               */
+  int timed;                 /* Measure write_time                 */
+  double write_time;         /* Seconds spent in write calls       */
+} out_writer_t;
+
+static inline void
+out_oom(void)
+{
+  fprintf(stderr, "Out of memory\n");
+  exit(1);
+}
+
+static inline void
+out_init(out_writer_t *w, int fd)
+{
+  w->fd = fd;
+  w->buf = NULL;
+  w->len = w->size = 0;
+  w->written = 0;
+  w->timed = 0;
+  w->write_time = 0;
+  if (fd >= 0) {
+    w->size = OUT_BUF_SIZE;
+    if ((w->buf = (char *)malloc(w->size)) == NULL)
+      out_oom();
+  }
+}
+
+/* Write the buffered bytes out (file writers only).  A write error is
+   fatal, as for the tools' other I/O errors */
+static inline void
+out_flush(out_writer_t *w)
+{
+  struct timespec t0, t1;
+  size_t off = 0;
+
+  if (w->fd < 0)
+    return;
+  if (w->timed)
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+  while (off < w->len) {
+    ssize_t n = write(w->fd, w->buf + off, w->len - off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Write error: %s(%d)\n", strerror(errno), errno);
+      exit(1);
+    }
+    off += (size_t)n;
+  }
+  if (w->timed) {
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    w->write_time += (double)(t1.tv_sec - t0.tv_sec) + 1e-9 * (double)(t1.tv_nsec - t0.tv_nsec);
+  }
+  w->written += w->len;
+  w->len = 0;
+}
+
+static inline void
+out_close(out_writer_t *w)
+{
+  out_flush(w);
+  free(w->buf);
+  w->buf = NULL;
+  w->len = w->size = 0;
+}
+
+/* Make room for n more bytes and return where they go */
+static inline char *
+out_reserve(out_writer_t *w, size_t n)
+{
+  if (w->len + n > w->size) {
+    if (w->fd >= 0)
+      out_flush(w);
+    if (w->len + n > w->size) {
+      size_t size = w->size ? w->size : OUT_MEM_INIT;
+      while (w->len + n > size)
+        size *= 2;
+      if ((w->buf = (char *)realloc(w->buf, size)) == NULL)
+        out_oom();
+      w->size = size;
+    }
+  }
+  return w->buf + w->len;
+}
+
+static inline void
+out_write(out_writer_t *w, const void *p, size_t n)
+{
+  memcpy(out_reserve(w, n), p, n);
+  w->len += n;
+}
+
+static inline void
+out_str(out_writer_t *w, const char *s)
+{
+  out_write(w, s, strlen(s));
+}
+
+static inline void
+out_char(out_writer_t *w, char c)
+{
+  *out_reserve(w, 1) = c;
+  w->len++;
+}
+
+/* Format v in decimal at p (not nul terminated); returns the length */
+static inline size_t
+out_fmt_int(char *p, long v)
+{
+  char tmp[OUT_NUM_MAX];
+  unsigned long u = v < 0 ? 0UL - (unsigned long)v : (unsigned long)v;
+  size_t n = 0, len;
+
+  do {
+    tmp[n++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (v < 0)
+    tmp[n++] = '-';
+  for (len = 0; len < n; len++)
+    p[len] = tmp[n - 1 - len];
+  return n;
+}
+
+static inline void
+out_int(out_writer_t *w, long v)
+{
+  w->len += out_fmt_int(out_reserve(w, OUT_NUM_MAX), v);
+}
+
+/* Same text as printf("%g", x) */
+static inline void
+out_double(out_writer_t *w, double x)
+{
+  w->len += (size_t)snprintf(out_reserve(w, OUT_NUM_MAX), OUT_NUM_MAX, "%g", x);
+}
+
+#endif
@@ -3,6 +3,9 @@
   Score a set of nucloetide sequences in FASTA format based
   on matches to a sequence motif represented by a position 
   weight matrix (PWM) or a base probability matrix (LPM)
+
+  The command line tool: options, input and threads.  Motifs are loaded
+  and sequences scored by the motif scanning library (motif_scan.h).
   
   Giovanna Ambrosini, EPFL/SV, giovanna.ambrosini@epfl.ch
 
@@ -39,21 +42,25 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <assert.h>
-#include <float.h>
 #include <limits.h>
+#include <pthread.h>
 #ifdef DEBUG
 #include <mcheck.h>
 #endif
 
-#define BUF_SIZE 3072
-#define NUCL  5
-#define LINE_SIZE 1024
-#define MVAL_MAX 32
+#include "packed_seq.h"
+#include "fasta_reader.h"
+#include "pseq_file.h"
+#include "out_writer.h"
+#include "motif_scan.h"
+#include "run_stats.h"
 
+#define NUCL  5
 #define HDR_MAX 132
-#define BEST_HIT_POS 256
-/*#define MIN_SCORE -5000000 */
-#define MIN_SCORE INT_MIN
+#define BATCH_SEQS 256     /* Maximum number of sequences per batch (--threads) */
+#define BATCH_BASES (1 << 20) /* Maximum number of bases per batch (--threads) */
+#define LONG_RECORD (1 << 24) /* Records with more sequence text are scored as they are read */
+#define SEQ_LONG 2         /* read_seq: long record left in the reader */
 
 typedef struct _options_t {
   int help;
@@ -66,610 +73,432 @@ typedef struct _options_t {
   int nohdr;
   int bestscore;
   int forward;
+  int threads;
+  int kmer;
+  int binary;
+  int bound;
+  double min_score;
+  int sites;                 /* Number of --threshold/--pvalue options */
+  double threshold;
+  double pvalue;
+  double min_qual;           /* FASTQ mean quality filter (0 = off) */
 } options_t;
 
 static options_t options;
 
-static char nucleotide[] = {'A','C','G','T', 'N'};
 static double bg[] = {1.0,1.0,1.0,1.0,0.25};
+static ms_context_t *ctx;    /* Motifs and score tables */
 
-typedef struct _seq_t {
-  char *hdr;
-  int *seq;
-  int len;
-} seq_t, *seq_p_t;
-
-FILE *fasta_in;
+fasta_reader_t fasta_in;
+pseq_reader_t pseq_in;      /* Packed sequence file input, if mapped */
 
-int seqCnt;
-double **lpm;                /* Letter Probability Matrix  */
-int   **pwm;                 /* Position Weight Matrix     */
-int matLen = 10;             /* Matrix Length              */
+static run_stats_t stats;    /* --stats */
 
 double pseudo_weight = 0.0;  /* Optional pseudo-weight for Letter Probability Matrix */ 
 
-static int 
-read_profile(char *iFile)
+/* Set up a sequence record buffer, with its header.  Records of a packed
+   sequence file are views of the mapping (see read_packed): they own no
+   bases */
+static void
+record_init(seq_p_t seq)
 {
-  FILE *f = fopen(iFile, "r");
-  int l = 0;
-  char *s, *res, *buf;
-  size_t bLen = LINE_SIZE;
-  int p_len = matLen;
-  char mval[MVAL_MAX] = "";
-  int i;
-
-  if (f == NULL) {
-    fprintf(stderr, "Could not open file %s: %s(%d)\n",
-            iFile, strerror(errno), errno);
+  if (pseq_in.map != NULL)
+    memset(seq, 0, sizeof(*seq));
+  else
+    seq_init(seq);
+  if ((seq->hdr = malloc(HDR_MAX * sizeof(char))) == NULL)
+    seq_oom();
+}
+
+/* Free a record buffer of record_init, before pseq_close */
+static void
+record_free(seq_p_t seq)
+{
+  free(seq->hdr);
+  if (pseq_in.map == NULL)
+    seq_free(seq);
+}
+
+/* Read the next record of a packed sequence file (pseq_file.h), as
+   read_seq does; records without a stored header are named by their index.
+   The bases are not copied: seq is left a view of the mapping, as scoring
+   only reads them */
+static int
+read_packed(pseq_reader_t *input, seq_p_t seq, const char *iFile)
+{
+  seq_t rec;
+  int more;
+
+  if ((more = pseq_next(input, &rec)) <= 0) {
+    if (more < 0)
+      fprintf(stderr, "Error reading file %s: %s\n", iFile, input->err);
+    return more;
+  }
+  if (rec.hdr == NULL) {
+    snprintf(seq->hdr, HDR_MAX, "%llu", (unsigned long long)(input->next - 1));
+  } else if (strlen(rec.hdr) >= HDR_MAX) {
+    fprintf(stderr, "Fasta Header too long \"%s\" in file %s\n", rec.hdr, iFile);
     return -1;
+  } else {
+    strcpy(seq->hdr, rec.hdr);
   }
-  if (options.debug != 0)
-    fprintf(stderr, "Processing file %s\n", iFile);
+  rec.hdr = seq->hdr;
+  *seq = rec;
+  return 1;
+}
 
-  if ((s = malloc(bLen * sizeof(char))) == NULL) {
-    perror("process_sga: malloc");
-    return(-1);
+/* Read the next sequence record.  Returns 1 if there is one, 0 at the end
+   of the input and -1 on error.  A FASTA record longer than LONG_RECORD
+   is not loaded: only its header is copied, and SEQ_LONG is returned for
+   the record to be scored part by part (score_long_seq) */
+static int
+read_seq(fasta_reader_t *input, seq_p_t seq, const char *iFile)
+{
+  const char *s, *end;
+  size_t i;
+  int more;
+
+  stats_phase(&stats, STATS_READ);
+  if (pseq_in.map != NULL) {
+    if ((more = read_packed(&pseq_in, seq, iFile)) > 0 && stats.enabled)
+      stats_record(&stats, seq->hdr, strnlen(seq->hdr, HDR_MAX), (unsigned long long)seq->len, (unsigned long long)seq_n_count(seq));
+    return more;
   }
-  if (options.lpm) {
-    /* Read Matrix file line by line */
-    while ((res = fgets(s, (int) bLen, f)) != NULL) {
-      size_t cLen = strlen(s);
-  
-      while (cLen + 1 == bLen && s[cLen - 1] != '\n') {
-        bLen *= 2;
-        if ((s = realloc(s, bLen)) == NULL) {
-          perror("process_file: realloc");
-          exit(1);
-        }
-        res = fgets(s + cLen, (int) (bLen - cLen), f);
-        cLen = strlen(s);
-      }
-      if (s[cLen - 1] == '\n')
-        s[cLen - 1] = 0;
-  
-      if (s[cLen - 2] == '\r')
-        s[cLen - 2] = 0;
-  
-      buf = s;
-      /* Get PWM fields */
-      /* Get first character: if # or > skip line */
-      if (*buf == '#' || *buf == '>')
-        continue;
-      /* Read First column value */
-      while (isspace(*buf))
-        buf++;
-      i = 0;
-      while (isdigit(*buf) || *buf == '-' || *buf == '.' || *buf == 'e' || *buf == 'E') {
-        if (i >= MVAL_MAX) {
-          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
-          exit(1);
-       }
-        mval[i++] = *buf++;
-      }
-      mval[i] = 0;
-     if (strlen(mval) == 0) {
-        fprintf(stderr, "Matrix value for colum 1 (row %d) is missing, please check the matrix format (it should be LPM)\n", l);
-        return(-1);
-      }
-      lpm[0][l] = atof(mval);
-      while (isspace(*buf))
-        buf++;
-      /* Read Second column value */
-      i = 0;
-      while (isdigit(*buf) || *buf == '-' || *buf == '.' || *buf == 'e' || *buf == 'E') {
-        if (i >= MVAL_MAX) {
-          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
-          exit(1);
-       }
-        mval[i++] = *buf++;
-      }
-      mval[i] = 0;
-      if (strlen(mval) == 0) {
-        fprintf(stderr, "Matrix value for colum 2 (row %d) is missing, please check the matrix format (it should be LPM)\n", l);
-        return(-1);
-      }
-      lpm[1][l] = atof(mval);
-      while (isspace(*buf))
-        buf++;
-      /* Read Third column value */
-      i = 0;
-      while (isdigit(*buf) || *buf == '-' || *buf == '.' || *buf == 'e' || *buf == 'E') {
-        if (i >= MVAL_MAX) {
-          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
-          exit(1);
-       }
-        mval[i++] = *buf++;
-      }
-      mval[i] = 0;
-      if (strlen(mval) == 0) {
-        fprintf(stderr, "Matrix value for colum 3 (row %d) is missing, please check the matrix format (it should be LPM)\n", l);
-        return(-1);
-      }
-      lpm[2][l] = atof(mval);
-      while (isspace(*buf))
-        buf++;
-      /* Read fourth column value */
-      i = 0;
-      while (isdigit(*buf) || *buf == '-' || *buf == '.' || *buf == 'e' || *buf == 'E') {
-        if (i >= MVAL_MAX) {
-          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
-          exit(1);
-       }
-        mval[i++] = *buf++;
-      }
-      mval[i] = 0;
-      if (strlen(mval) == 0) {
-        fprintf(stderr, "Matrix value for colum 4 (row %d) is missing, please check the matrix format (it should be LPM)\n", l);
-        return(-1);
-      }
-      lpm[3][l] = atof(mval);
-#ifdef DEBUG
-      fprintf(stderr, "%3d   %f   %f   %f   %f\n", l, lpm[0][l], lpm[1][l], lpm[2][l], lpm[3][l]);
-#endif
-      if (l == p_len-1) {
-       /* Reallocate Matrix columns */
-        for ( int i = 0; i < NUCL; i++) {
-          lpm[i] = realloc(lpm[i], p_len*2*sizeof(double));
-          if (lpm[i] == NULL) {
-            fprintf(stderr, "Out of memory\n");
-            return 1;
-          }
-        }
-        p_len *= 2;
-      }
-      l++;
-    }
-  } else {  /* Integer PWM  */
-    /* Read Matrix file line by line */
-    while ((res = fgets(s, (int) bLen, f)) != NULL) {
-      size_t cLen = strlen(s);
-  
-      while (cLen + 1 == bLen && s[cLen - 1] != '\n') {
-        bLen *= 2;
-        if ((s = realloc(s, bLen)) == NULL) {
-          perror("process_file: realloc");
-          exit(1);
-        }
-        res = fgets(s + cLen, (int) (bLen - cLen), f);
-        cLen = strlen(s);
-      }
-      if (s[cLen - 1] == '\n')
-        s[cLen - 1] = 0;
-  
-      if (s[cLen - 2] == '\r')
-        s[cLen - 2] = 0;
-  
-      buf = s;
-      /* Get PWM fields */
-      /* Get first character: if # or > skip line */
-      if (*buf == '#' || *buf == '>')
-        continue;
-      /* Read First column value */
-      while (isspace(*buf))
-        buf++;
-      i = 0;
-      while (isdigit(*buf) || *buf == '-') {
-        if (i >= MVAL_MAX) {
-          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
-          exit(1);
-       }
-        mval[i++] = *buf++;
-      }
-      mval[i] = 0;
-     if (strlen(mval) == 0) {
-        fprintf(stderr, "Matrix value for colum 1 (row %d) is missing, please check the matrix format (it should be Integer)\n", l);
-        return(-1);
-      }
-      pwm[0][l] = atoi(mval);
-      while (isspace(*buf))
-        buf++;
-      /* Read Second column value */
-      i = 0;
-      while (isdigit(*buf) || *buf == '-') {
-        if (i >= MVAL_MAX) {
-          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
-          exit(1);
-       }
-        mval[i++] = *buf++;
-      }
-      mval[i] = 0;
-      if (strlen(mval) == 0) {
-        fprintf(stderr, "Matrix value for colum 2 (row %d) is missing, please check the matrix format (it should be Integer)\n", l);
-        return(-1);
-      }
-      pwm[1][l] = atoi(mval);
-      while (isspace(*buf))
-        buf++;
-      /* Read Third column value */
-      i = 0;
-      while (isdigit(*buf) || *buf == '-') {
-        if (i >= MVAL_MAX) {
-          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
-          exit(1);
-       }
-        mval[i++] = *buf++;
-      }
-      mval[i] = 0;
-      if (strlen(mval) == 0) {
-        fprintf(stderr, "Matrix value for colum 3 (row %d) is missing, please check the matrix format (it should be Integer)\n", l);
-        return(-1);
-      }
-      pwm[2][l] = atoi(mval);
-      while (isspace(*buf))
-        buf++;
-      /* Read fourth column value */
-      i = 0;
-      while (isdigit(*buf) || *buf == '-') {
-        if (i >= MVAL_MAX) {
-          fprintf(stderr, "Matrix value is too large \"%s\" \n", buf);
-          exit(1);
-       }
-        mval[i++] = *buf++;
-      }
-      mval[i] = 0;
-      if (strlen(mval) == 0) {
-        fprintf(stderr, "Matrix value for colum 4 (row %d) is missing, please check the matrix format (it should be Integer)\n", l);
-        return(-1);
-      }
-      pwm[3][l] = atoi(mval);
-#ifdef DEBUG
-      fprintf(stderr, "%3d   %7d   %7d   %7d   %7d\n", l, pwm[0][l], pwm[1][l], pwm[2][l], pwm[3][l]);
-#endif
-      if (l == p_len-1) {
-       /* Reallocate Matrix columns */
-        for ( int i = 0; i < NUCL; i++) {
-          pwm[i] = realloc(pwm[i], p_len*2*sizeof(int));
-          if (pwm[i] == NULL) {
-            fprintf(stderr, "Out of memory\n");
-            return 1;
-          }
-        }
-        p_len *= 2;
-      }
-      l++;
+  /* Skip the text before the first header */
+  while ((more = fasta_next(input)) > 0 && input->hdr == NULL)
+    ;
+  if (more <= 0) {
+    if (more < 0)
+      fprintf(stderr, "Error reading file %s: %s\n", iFile, input->err);
+    return more;
+  }
+  /* Get the header */
+  s = input->hdr;
+  end = input->hdr + input->hdr_len;
+  i = 0;
+  while (s < end && !isspace(*s)) {
+    if (i >= HDR_MAX) {
+      fprintf(stderr, "Fasta Header too long \"%.*s\" in file %s\n", (int)input->hdr_len, input->hdr, iFile);
+      return -1;
     }
+    seq->hdr[i++] = *s++;
+  } 
+  if (i < HDR_MAX)
+    seq->hdr[i] = 0;
+  if (input->part) {
+    stats.in_bytes += input->hdr_len;
+    return SEQ_LONG;
   }
-#ifdef DEBUG
-  fprintf(stderr, "PWM length: %d\n", l);
-#endif
-  fclose(f);
-  return l;
+  /* Gobble sequence  */ 
+  seq_clear(seq);
+  seq_reserve(seq, (int)input->seq_len);
+  seq_append_text(seq, input->seq, input->seq_len);
+  if (stats.enabled) {
+    stats.in_bytes += input->hdr_len + input->seq_len + input->qual_len;
+    stats_record(&stats, seq->hdr, i, (unsigned long long)seq->len, (unsigned long long)seq_n_count(seq));
+  }
+  return 1;
 }
 
-static void
-process_seq_lpm(seq_p_t seq, FILE *out)
+/* Score the record left in the reader by read_seq (SEQ_LONG) while it is
+   read, part by part: the scanner keeps a bounded piece of the sequence.
+   Returns 1, 0 for an empty record, or -1 on error */
+static int
+score_long_seq(ms_scanner_t *sc, fasta_reader_t *input, const char *hdr, long idx, const char *iFile, out_writer_t *out)
 {
-  int i;
-  int j;
-  int nucl_cnt[] = {0, 0, 0, 0, 0};
+  unsigned long long other = 0;
+  int more, len;
 
-  if (options.debug != 0) {
-    fprintf(stderr, ">SEQ:  ");
-    for (i = 0; i < seq->len; i++) {
-      fprintf(stderr, "%d", seq->seq[i]);
+  if (ms_stream_begin(sc, hdr, idx) != 0)
+    return -1;
+  do {
+    if (stats.enabled) {
+      stats.in_bytes += input->seq_len;
+      other += nucl_count_other(input->seq, input->seq_len);
     }
-    fprintf(stderr, "\n");
+    stats_phase(&stats, STATS_PROCESS);
+    if (ms_stream_text(sc, input->seq, input->seq_len, out) != 0)
+      return -1;
+    stats_phase(&stats, STATS_READ);
+  } while ((more = fasta_next_part(input)) > 0);
+  if (more < 0) {
+    fprintf(stderr, "Error reading file %s: %s\n", iFile, input->err);
+    return -1;
   }
+  stats_phase(&stats, STATS_PROCESS);
+  len = ms_stream_end(sc, out);
+  if (stats.enabled)
+    stats_record(&stats, hdr, strnlen(hdr, HDR_MAX), (unsigned long long)len, other);
+  return len > 0;
+}
 
-  if (options.seq_norm) {
-    for (i = 0; i < seq->len; i++) {
-      nucl_cnt[seq->seq[i]]++;
-      /* fprintf(stderr, "nucl_cnt[%d] = %d\n", seq->seq[i], nucl_cnt[seq->seq[i]]); */
-    }
-    if (options.forward) {
-      for (i = 0; i < NUCL-1; i++) {
-        if (options.debug != 0)
-          fprintf(stderr, "nucl_cnt[%d] = %d ; seq LEN = %d\n", i, nucl_cnt[i], seq->len); 
-        bg[i] = (double)nucl_cnt[i]/(double)seq->len;
-      }
-    } else {
-      double bcomp_at = (double) ((double)((double)((nucl_cnt[0]+nucl_cnt[3])/2)+(double)nucl_cnt[4]/4)/(double)seq->len);
-      bg[0] = bcomp_at;
-      bg[1] = (double) 0.5 - bcomp_at;
-      bg[2] = (double) 0.5 - bcomp_at;
-      bg[3] = bcomp_at;
-    }
-    if (options.debug != 0) {
-      fprintf(stderr, "Background nucleotide frequencies: ");
-      for (i = 0; i < NUCL; i++) {
-        fprintf(stderr, "bg[%i] = %f ", i, bg[i]);
-      }
-      fprintf(stderr, "\n\n");
+/*
+  Multithreaded scoring (--threads).
+
+  The input is read by the calling thread into batches of sequences that
+  are put in a ring of batch slots.  Worker threads claim the oldest batch
+  that is ready, so that a worker that is done picks up the next piece of
+  work whatever the length of the sequences, and score it into a private
+  memory stream.  Finished batches are written out strictly in input order
+  by the worker that completes the oldest one, so the output is identical
+  to the single-threaded one.  Long records (SEQ_LONG) are scored by the
+  reading thread, once the batches before them are written out.
+*/
+enum { BATCH_FREE, BATCH_READY, BATCH_RUNNING, BATCH_DONE };
+
+typedef struct _batch_t {
+  seq_t *seqs;
+  int cnt;                   /* Sequences in the batch  */
+  int size;                  /* Allocated sequences     */
+  out_writer_t out;          /* Score lines of the batch */
+  long first;                /* Index of the first sequence */
+  int state;
+} batch_t;
+
+typedef struct _pool_t {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  batch_t *slots;
+  int nslots;
+  long next_read;            /* Next batch to be filled  */
+  long next_take;            /* Next batch to be scored  */
+  long next_emit;            /* Next batch to be written */
+  int eof;
+  out_writer_t *out;
+} pool_t;
+
+static void *
+worker_main(void *arg)
+{
+  pool_t *pool = (pool_t *)arg;
+  ms_scanner_t *sc = ms_scanner_new(ctx);
+  double wall = 0, t0 = 0;
+
+  for (;;) {
+    batch_t *b;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->next_take == pool->next_read && !pool->eof)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    if (pool->next_take == pool->next_read) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
     }
+    b = &pool->slots[pool->next_take++ % pool->nslots];
+    b->state = BATCH_RUNNING;
+    pthread_mutex_unlock(&pool->lock);
+
+    b->out.len = 0;
+    if (stats.enabled)
+      t0 = stats_clock(CLOCK_MONOTONIC);
+    ms_score_seqs(sc, b->seqs, b->cnt, b->first, &b->out);
+    if (stats.enabled)
+      wall += stats_clock(CLOCK_MONOTONIC) - t0;
+
+    pthread_mutex_lock(&pool->lock);
+    b->state = BATCH_DONE;
+    while ((b = &pool->slots[pool->next_emit % pool->nslots])->state == BATCH_DONE) {
+      out_write(pool->out, b->out.buf, b->out.len);
+      b->state = BATCH_FREE;
+      pool->next_emit++;
+    }
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
   }
-  if (options.bestscore) { // Compute the single best score
-    double best_score = 0.0;
-    //int best_pos = 0;
-    char best_pos[BEST_HIT_POS] = "0";
-    char strand = '+';
-    for (i = 0; i <= seq->len-matLen; i++) {
-      double prod = 1.0;
-      double prod_rcomp = 1.0;
-      for (j = 0; j < matLen; j++) {
-        //printf ("i=%d , PWM[%d] [%d] = %.10f\n", i, seq->seq[i+j], j, lpm[seq->seq[i+j]][j]); 
-        prod = prod * lpm[seq->seq[i+j]][j]/bg[seq->seq[i+j]];
-        //printf ("PROD=%.10f\n", prod); 
-        if (!options.forward) {
-          int idx = 0;
-          if (seq->seq[i+j] == 4) {
-            idx = 4;
-          } else {
-            idx = 3-seq->seq[i+j];
-          }
-          //printf ("i=%d , RCPWM[%d] [%d] = %.10f\n", i, idx, matLen-j-1, lpm[idx][matLen-j-1]); 
-          prod_rcomp = prod_rcomp * lpm[idx][matLen-j-1]/bg[idx];
-          //printf ("RCProd=%.10f\n", prod_rcomp); 
-        }
-      }
-      //printf ("prod: %g \t rev prod : %g\n", prod, prod_rcomp);
-      double max = 0.0;
-      if (options.forward)
-        max = prod;
-      else 
-        max = prod > prod_rcomp ? prod : prod_rcomp;
-      //printf ("MAX: %g (pos=%d, strand=%c, BEST: %g)\n", max, i, strand, best_score);
-      if (max > best_score) {
-        best_score = max;
-        //best_pos = i;
-        sprintf(best_pos, "%d", i);
-        if (!options.forward) {
-          if (max == prod) {
-            strand = '+';
-          } else {
-            strand = '-';
-            //best_pos = i + matLen;
-            sprintf(best_pos, "%d", i + matLen);
-          }
-        }
-      } else if (max == best_score && max != 0.0) {
-        if (max == prod) {
-            char res[16];
-            sprintf(res, ",%d", i);
-            strcat(best_pos, res);
-        } else {
-            char res[16];
-            sprintf(res, ",%d", i + matLen);
-            strcat(best_pos, res);
-        }
-      }
-      //printf ("BEST SCORE (pos=%d, strand=%c): %f\n", i, strand, best_score);
-    }
-    if (options.debug != 0)
-      fprintf(stderr, "%s\t%e\t%d\t%s\t%c\n", seq->hdr, best_score, seq->len, best_pos, strand);
-
-    if (options.nohdr != 0)
-      fprintf(out, "%g\t%d\t%s\t%c\n", best_score, seq->len, best_pos, strand);
-    else
-      fprintf(out, "%s\t%g\t%d\t%s\t%c\n", seq->hdr, best_score, seq->len, best_pos, strand);
-  } else { // Compute sum of probabilities [both strands is the default]
-    double sum = 0.0;
-    for (i = 0; i <= seq->len-matLen; i++) {
-      double prod = 1.0;
-      double prod_rcomp = 1.0;
-      for (j = 0; j < matLen; j++) {
-        prod = prod * lpm[seq->seq[i+j]][j]/bg[seq->seq[i+j]];
-        if (!options.forward) {
-          int idx = 0;
-          if (seq->seq[i+j] == 4) {
-            idx = 4;
-          } else {
-            idx = 3-seq->seq[i+j];
-          }
-          prod_rcomp = prod_rcomp * lpm[idx][matLen-j-1]/bg[idx];
-        }
-      }
-      if (options.forward) 
-        sum = sum + prod;
-      else
-        sum = sum + prod + prod_rcomp;
-    }
-    if (options.debug != 0)
-      fprintf(stderr, "%s\t%e\n", seq->hdr, sum);
-
-    if (options.nohdr != 0)
-      fprintf(out, "%g\n", sum);
-    else
-      fprintf(out, "%s\t%g\n", seq->hdr, sum);
+  if (stats.enabled) {
+    /* Scoring time of the thread, its output written out included */
+    double cpu = stats_clock(CLOCK_THREAD_CPUTIME_ID);
+    pthread_mutex_lock(&pool->lock);
+    stats.wall[STATS_PROCESS] += wall;
+    stats.cpu[STATS_PROCESS] += cpu;
+    pthread_mutex_unlock(&pool->lock);
   }
+  ms_scanner_free(sc);
+  return NULL;
 }
 
-static void
-process_seq_pwm(seq_p_t seq, FILE *out)
+static int
+process_batches(ms_scanner_t *sc, fasta_reader_t *input, const char *iFile, long idx, out_writer_t *out)
 {
-  int i;
-  int j;
-  char *tag_match = NULL;
-  char *tag_match_pos = NULL;
-  char *tag_match_rcomp = NULL;
-  int score = 0;
-  int rev_score = 0;
-  int best_score = INT_MIN;
-  int match_pos = 0;
-  int strand = 0;
-
-  if (options.debug != 0) {
-    fprintf(stderr, "> ");
-    for (i = 0; i < seq->len; i++) {
-      fprintf(stderr, "%d", seq->seq[i]);
-    }
-    fprintf(stderr, "\n");
+  char hdr[HDR_MAX];
+  pool_t pool;
+  pthread_t *tid;
+  int i, k, ret = 0, more = 1;
+  double cpu = 0;
+
+  memset(&pool, 0, sizeof(pool));
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+  pool.nslots = 4 * options.threads;
+  pool.slots = calloc((size_t)pool.nslots, sizeof(batch_t));
+  tid = malloc((size_t)options.threads * sizeof(pthread_t));
+  if (pool.slots == NULL || tid == NULL)
+    seq_oom();
+  for (k = 0; k < pool.nslots; k++)
+    out_init(&pool.slots[k].out, -1);
+  pool.out = out;
+  if (stats.enabled) {
+    cpu = stats_clock(CLOCK_THREAD_CPUTIME_ID);
+    stats.cpu[STATS_PROCESS] = 0;
   }
-  if (seq->len < matLen) {
-    if (options.nohdr != 0)
-      fprintf(out, "%d\t%d\t%s\t%d\t%c\n", 0, 0, "NOTAG", MIN_SCORE, '0');
-    else
-      fprintf(out, "%s\t%d\t%d\t%s\t%d\t%c\n", seq->hdr, 0, 0, "NOTAG", MIN_SCORE, '0');
-    return;
+  for (k = 0; k < options.threads; k++) {
+    if ((errno = pthread_create(&tid[k], NULL, worker_main, &pool)) != 0) {
+      fprintf(stderr, "Could not create thread: %s(%d)\n", strerror(errno), errno);
+      exit(1);
+    }
   }
-  tag_match = (char *)malloc((matLen + 1) * sizeof(char));
-  tag_match_pos = (char *)malloc((matLen + 1) * sizeof(char));
-  tag_match_rcomp = (char *)malloc((matLen + 1) * sizeof(char));
-  int idx = 0;
-  for (i = 0; i <= seq->len-matLen; i++) {
-    score = 0;
-    rev_score = 0;
-    for (j = 0; j < matLen; j++) {
-      /* Positive strand */
-      score += pwm[seq->seq[i+j]][j];
-      tag_match_pos[j] = nucleotide[seq->seq[i+j]];
-      if (!options.forward) {
-        /* Reverse Strand */
-        idx = 0;
-        if (seq->seq[i+j] == 4) {
-           idx = 4;
-        } else {
-           idx = 3-seq->seq[i+j];
-        }
-        rev_score += pwm[idx][matLen-j-1];
-        tag_match_rcomp[matLen-j-1] = nucleotide[idx];
+  while (more > 0) {
+    batch_t *b = &pool.slots[pool.next_read % pool.nslots];
+    long bases = 0;
+
+    stats_phase(&stats, STATS_WAIT);
+    pthread_mutex_lock(&pool.lock);
+    while (b->state != BATCH_FREE)
+      pthread_cond_wait(&pool.cond, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    b->cnt = 0;
+    b->first = idx;
+    while (more > 0 && b->cnt < BATCH_SEQS && bases < BATCH_BASES) {
+      if (b->cnt == b->size) {
+        b->size = b->size ? 2 * b->size : 16;
+        if ((b->seqs = realloc(b->seqs, (size_t)b->size * sizeof(seq_t))) == NULL)
+          seq_oom();
+        for (i = b->cnt; i < b->size; i++)
+          record_init(&b->seqs[i]);
+      }
+      more = read_seq(input, &b->seqs[b->cnt], iFile);
+      if (more == SEQ_LONG) {
+        memcpy(hdr, b->seqs[b->cnt].hdr, HDR_MAX);
+        break;
       }
-    }
-    /* printf("i: %d j: %d\n", i, j); */
-    tag_match_pos[j] = '\0';
-    tag_match_rcomp[j] = '\0';
-    /* printf("tag_matches: (pos) %s  (rev) %s\n", tag_match_pos, tag_match_rcomp); */
-    /* printf("scores: pos %d  rev %d best %d\n", score, rev_score, best_score);  */
-   /* Get max score between the positive and negative strands */
-    int max = 0;
-    int k = 0;
-    if (options.forward) {
-      max = score;
-    } else { 
-      int c = score - rev_score;
-      k = (c >> 31) & 0x1;   /* check highest bit of integer c : 0 = positive, 1 = negative */
-      max = score - k * c;
-    }
-    /* printf("max: %d\n", max);  */
-    if (max > best_score) {
-      best_score = max;
-      match_pos = i;
-      strand = k;
-      if (k) {
-        strcpy(tag_match, tag_match_rcomp);
+      if (more > 0 && b->seqs[b->cnt].len != 0)
+        bases += b->seqs[b->cnt++].len;
+    }
+    if (more < 0)
+      ret = -1;
+    idx += b->cnt;
+    if (b->cnt > 0) {
+      pthread_mutex_lock(&pool.lock);
+      b->state = BATCH_READY;
+      pool.next_read++;
+      pthread_cond_broadcast(&pool.cond);
+      pthread_mutex_unlock(&pool.lock);
+    }
+    if (more == SEQ_LONG) {
+      stats_phase(&stats, STATS_WAIT);
+      pthread_mutex_lock(&pool.lock);
+      while (pool.next_emit != pool.next_read)
+        pthread_cond_wait(&pool.cond, &pool.lock);
+      pthread_mutex_unlock(&pool.lock);
+      if ((k = score_long_seq(sc, input, hdr, idx, iFile, out)) < 0) {
+        ret = -1;
+        more = -1;
       } else {
-        strcpy(tag_match, tag_match_pos);
+        idx += k;
       }
-      /* printf("New BEST SCORE: %d, pos %d, strand %d, match %s\n", best_score, match_pos, strand, tag_match); */
     }
   }
-  char str;
-  if (strand)
-    str = '-';
-  else
-    str = '+';
-  int match_end = match_pos + matLen;
-  if (options.debug != 0)
-    fprintf(stderr, "%s\t%d\t%d\t%s\t%d\t%c\n", seq->hdr, match_pos, match_end, tag_match, best_score, str);
-
-  if (options.nohdr != 0)
-    fprintf(out, "%d\t%d\t%s\t%d\t%c\n", match_pos, match_end, tag_match, best_score, str);
-  else
-    fprintf(out, "%s\t%d\t%d\t%s\t%d\t%c\n", seq->hdr, match_pos, match_end, tag_match, best_score, str);
-
-  free(tag_match);
-  free(tag_match_pos);
-  free(tag_match_rcomp);
+  stats_phase(&stats, STATS_WAIT);
+  pthread_mutex_lock(&pool.lock);
+  pool.eof = 1;
+  pthread_cond_broadcast(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+  for (k = 0; k < options.threads; k++)
+    pthread_join(tid[k], NULL);
+  /* The reading thread mostly reads, or waits without using the CPU */
+  if (stats.enabled)
+    stats.cpu[STATS_READ] = stats_clock(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  for (k = 0; k < pool.nslots; k++) {
+    for (i = 0; i < pool.slots[k].size; i++)
+      record_free(&pool.slots[k].seqs[i]);
+    free(pool.slots[k].seqs);
+    out_close(&pool.slots[k].out);
+  }
+  free(pool.slots);
+  free(tid);
+  pthread_cond_destroy(&pool.cond);
+  pthread_mutex_destroy(&pool.lock);
+  return ret;
 }
 
 static int
-process_file(FILE *input, char *iFile, FILE *out)
+process_file(fasta_reader_t *input, char *iFile, out_writer_t *out)
 {
-  char buf[BUF_SIZE], *res;
-  seq_t seq;
-  int mLen;
-
-  if (input == NULL) {
-    FILE *f = fopen(iFile, "r");
-    if (f == NULL) {
-      fprintf(stderr, "Could not open file %s: %s(%d)\n",
-  	    iFile, strerror(errno), errno);
-      return -1;
-    }
-    input = f;
-  }
+  ms_scanner_t *sc = ms_scanner_new(ctx);
+  seq_t seq, run[MS_BATCH_LANES];
+  long idx = 0;
+  int more, ret = 0, cnt = 0, k;
+
   if (options.debug != 0)
     fprintf(stderr, "Processing file %s\n", iFile);
-  while ((res = fgets(buf, BUF_SIZE, input)) != NULL
-	 && buf[0] != '>')
-    ;
-  if (res == NULL || buf[0] != '>') {
+  record_init(&seq);
+  for (k = 0; k < MS_BATCH_LANES; k++)
+    record_init(&run[k]);
+  if ((more = read_seq(input, &seq, iFile)) == 0)
     fprintf(stderr, "Could not find a sequence in file %s\n", iFile);
-    if (input != stdin) {
-      fclose(input);
-    }
-    return -1;
-  }
-  seq.hdr = malloc(HDR_MAX * sizeof(char));
-  seq.seq = malloc(BUF_SIZE * sizeof(int));
-  mLen = BUF_SIZE;
-  while (res != NULL) {
-    /* Get the header */
-    char *s = buf;
-    s += 1;
-    int i = 0;
-    while (*s && !isspace(*s)) {
-      if (i >= HDR_MAX) {
-        fprintf(stderr, "Fasta Header too long \"%s\" in file %s\n", res, iFile);
-        fclose(input);
-        return -1;
-      }
-      seq.hdr[i++] = *s++;
-    } 
-    if (i < HDR_MAX)
-      seq.hdr[i] = 0;
-    /* Gobble sequence  */ 
-    seq.len = 0;
-    while ((res = fgets(buf, BUF_SIZE, input)) != NULL && buf[0] != '>') {
-      char c;
-      int n;
-      s = buf;
-      while ((c = *s++) != 0) {
-	if (isalpha(c)) {
-	  c = (char) toupper(c);
-	  switch (c) {
-	  case 'A':
-            n = 0;
-            break;
-	  case 'C':
-            n = 1;
-            break;
-	  case 'G':
-            n = 2;
-            break;
-	  case 'T':
-            n = 3;
-            break;
-	  case 'N':
-            n = 4;
-	    break;
-	  default:
-            n = 4;
-	    ;
-	  }
-	  if (seq.len >= mLen) {
-	    mLen += BUF_SIZE;
-	    seq.seq = realloc(seq.seq, (size_t)mLen * sizeof(int));
-	  }
-	  seq.seq[seq.len++] = n;
-	}
-      }
-    }
-    /* We now have the (not nul terminated) sequence.
-       Process it: once forward, and once in reverse. */
-    if (seq.len != 0) {
-      if (options.lpm)
-        process_seq_lpm(&seq, out);
+  if (more <= 0) {
+    ret = -1;
+  } else if (options.threads > 1) {
+    /* Score the first record here, the rest in the thread pool */
+    if (more == SEQ_LONG) {
+      if ((k = score_long_seq(sc, input, seq.hdr, idx, iFile, out)) < 0)
+        ret = -1;
       else
-        process_seq_pwm(&seq, out);
+        idx += k;
+    } else if (seq.len != 0) {
+      stats_phase(&stats, STATS_PROCESS);
+      ms_score_seqs(sc, &seq, 1, idx++, out);
     }
+    if (ret == 0)
+      ret = process_batches(sc, input, iFile, idx, out);
+  } else {
+    do {
+      /* We now have the (not nul terminated) sequence.
+         Process it: once forward, and once in reverse.
+         Reads that may be batched are collected in run (see ms_batchable),
+         swapping buffers with seq.  Long records are scored as they
+         are read. */
+      if (more == SEQ_LONG) {
+        stats_phase(&stats, STATS_PROCESS);
+        ms_score_seqs(sc, run, cnt, idx, out);
+        idx += cnt;
+        cnt = 0;
+        if ((k = score_long_seq(sc, input, seq.hdr, idx, iFile, out)) < 0) {
+          more = -1;
+          break;
+        }
+        idx += k;
+        continue;
+      }
+      if (seq.len == 0)
+        continue;
+      if (cnt > 0 && (cnt == MS_BATCH_LANES || seq.len != run[0].len || !ms_batchable(ctx, &seq))) {
+        stats_phase(&stats, STATS_PROCESS);
+        ms_score_seqs(sc, run, cnt, idx, out);
+        idx += cnt;
+        cnt = 0;
+      }
+      if (ms_batchable(ctx, &seq)) {
+        seq_t tmp = run[cnt];
+        run[cnt++] = seq;
+        seq = tmp;
+      } else {
+        stats_phase(&stats, STATS_PROCESS);
+        ms_score_seqs(sc, &seq, 1, idx++, out);
+      }
+    } while ((more = read_seq(input, &seq, iFile)) > 0);
+    stats_phase(&stats, STATS_PROCESS);
+    ms_score_seqs(sc, run, cnt, idx, out);
+    if (more < 0)
+      ret = -1;
   }
-  free(seq.hdr);
-  free(seq.seq);
-  if (input != stdin) {
-    fclose(input);
-  }
-  return 0;
+  for (k = 0; k < MS_BATCH_LANES; k++)
+    record_free(&run[k]);
+  record_free(&seq);
+  ms_scanner_free(sc);
+  fasta_close(input);
+  pseq_close(&pseq_in);
+  return ret;
 }
 
 char** str_split(char* a_str, const char a_delim)
@@ -715,13 +544,20 @@ char** str_split(char* a_str, const char a_delim)
 int
 main(int argc, char *argv[])
 {
-  char *matFile = NULL;
+  out_writer_t out;
+  ms_options_t scan;
+  char **matFiles = NULL;
+  int matCnt = 0;
   char *bgProb = NULL;
+  char *kernel = NULL;
   char** tokens;
-  int i = 0;
+  int i = 0, k, motifCnt;
   double bprob = 0.25; 
   options.lpm = 1;
   options.pwm = 0;
+  options.threads = 1;
+  options.min_score = -HUGE_VAL;
+  stats_start(&stats, "pwm_scoring", "score");
 
   static struct option long_options[] =
       {
@@ -737,6 +573,17 @@ main(int argc, char *argv[])
           {"unorm",   no_argument,       0, 'u'},
           {"nohdr",   no_argument,       0, 'r'},
           {"pweight", required_argument, 0, 'w'},
+          {"kernel",  required_argument, 0, 'k'},
+          {"threads", required_argument, 0, 't'},
+          {"kmer",    required_argument, 0, 'K'},
+          {"output-format", required_argument, 0, 'o'},
+          {"bound",   no_argument,       0, 'B'},
+          {"min-score", required_argument, 0, 'S'},
+          {"threshold", required_argument, 0, 'T'},
+          {"pvalue",  required_argument, 0, 'P'},
+          {"min-quality", required_argument, 0, 'Q'},
+          {"stats",   optional_argument, 0, 1},
+          {"stats-file", required_argument, 0, 2},
           /* These options only set a flag. */
           {"lpm",     no_argument,       &options.lpm, 1},
           {"pwm",     no_argument,       &options.pwm, 1},
@@ -751,13 +598,16 @@ main(int argc, char *argv[])
 #endif
   while (1) {
     //int c = getopt(argc, argv, "dhl:m:p:qurw:");
-    int c = getopt_long(argc, argv, "bdhfm:p:uqrw:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "bBdhfk:K:m:o:p:P:Q:uqrS:t:T:w:", long_options, &option_index);
     if (c == -1)
       break;
     switch (c) {
     case 'b':
       options.bestscore = 1;
       break;
+    case 'B':
+      options.bound = 1;
+      break;
     case 'd':
       options.debug = 1;
       break;
@@ -767,8 +617,32 @@ main(int argc, char *argv[])
     case 'f':
       options.forward = 1;
       break;
+    case 'k':
+      kernel = optarg;
+      break;
+    case 'K':
+      options.kmer = atoi(optarg);
+      if (options.kmer < 0 || options.kmer > MS_KMER_MAX) {
+        fprintf(stderr, "Invalid k-mer length \"%s\" (it should be between 0 and %d)\n", optarg, MS_KMER_MAX);
+        return 1;
+      }
+      break;
     case 'm':
-      matFile = optarg;
+      if ((matFiles = realloc(matFiles, (size_t)(matCnt + 1) * sizeof(char *))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+      }
+      matFiles[matCnt++] = optarg;
+      break;
+    case 'o':
+      if (strcmp(optarg, "binary") == 0) {
+        options.binary = 1;
+      } else if (strcmp(optarg, "text") == 0) {
+        options.binary = 0;
+      } else {
+        fprintf(stderr, "Invalid output format \"%s\" (it should be text or binary)\n", optarg);
+        return 1;
+      }
       break;
     case 'p':
       bgProb = optarg;
@@ -777,15 +651,48 @@ main(int argc, char *argv[])
     case 'q':
       options.seq_norm = 1;
       break;
+    case 'Q':
+      options.min_qual = atof(optarg);
+      break;
     case 'u':
       options.norm = 1;
       break;
     case 'r':
       options.nohdr = 1;
       break;
+    case 't':
+      options.threads = atoi(optarg);
+      if (options.threads < 1) {
+        fprintf(stderr, "Invalid number of threads \"%s\"\n", optarg);
+        return 1;
+      }
+      break;
+    case 'S':
+      options.min_score = atof(optarg);
+      break;
+    case 'T':
+      options.sites++;
+      options.threshold = atof(optarg);
+      break;
+    case 'P':
+      options.sites++;
+      options.pvalue = atof(optarg);
+      if (!(options.pvalue > 0.0 && options.pvalue <= 1.0)) {
+        fprintf(stderr, "Invalid p-value \"%s\" (it should be in ]0,1])\n", optarg);
+        return 1;
+      }
+      break;
     case 'w':
       pseudo_weight = atof(optarg);
       break;
+    case 1:
+      if (stats_parse(&stats, optarg) != 0)
+        return 1;
+      break;
+    case 2:
+      stats.enabled = 1;
+      stats.path = optarg;
+      break;
     case 0:
       /* If this option set a flag, do nothing else now. */
       if (long_options[option_index].flag != 0)
@@ -796,95 +703,109 @@ main(int argc, char *argv[])
       printf ("?? getopt returned character code 0%o ??\n", c);
     }
   }
-  if (optind > argc || matFile == NULL) {
+  if (optind > argc || matCnt == 0) {
     fprintf(stderr,
-	    "Usage: %s [options] -m <matrix_file> [<] <fasta_file>\n"
+	    "Usage: %s [options] -m <matrix_file> [-m <matrix_file> ...] [<] <fasta_file>\n"
 	    "   where options are:\n"
 	    "     -b[--best]             Compute best single match scores\n"
+	    "     -B[--bound]            Find best single matches by branch and bound: the windows are scored on their first\n"
+	    "                            columns, and completed only if they may still beat the best match (or -S).  Same\n"
+	    "                            results; only worth it with a high -S, the full scan is usually faster otherwise\n"
 	    "     -d[--debug]            Produce debugging output\n"
 	    "     -h[--help]             Show this stuff\n"
 	    "     -f[--forward]          Scan sequences in forward direction [def=bidirectional]\n"
+	    "     -k[--kernel] <name>    Window scanning kernel: auto, scalar, avx2 or avx512 [Default=auto]\n"
+	    "                            The SIMD kernels give results identical to the scalar one\n"
+	    "     -K[--kmer] <k>         Score windows with lookup tables of <k>-mers (1-8, 4-6 recommended) [Default=0 (off)]\n"
+	    "                            The tables are built once per motif; not used with -q or several motifs.\n"
+	    "                            LPM sums may differ from the column by column ones in the last digits; best matches\n"
+	    "                            (-b) are those of the other kernels\n"
+	    "     -o[--output-format] <fmt> Score output format: text or binary [Default=text]\n"
+	    "                            binary: a 16-byte header (\"" MS_SCORE_MAGIC "\", number of columns, reserved) then one\n"
+	    "                            little-endian float64 per motif and sequence, row by row (scores only)\n"
 	    "     -u[--unorm]            Normalize pwm scores by a uniform background base composition (Default=0.25)\n"
+	    "     -P[--pvalue] <p>       Report all sites whose score has a p-value of at most <p> (as --threshold, with the\n"
+	    "                            score reached by random sequence (-u/-p background) with probability <p>)\n"
 	    "     -p[--prob] <bg freq>   Normalize pwm scores by library-dependent nucleotide frequencies <bg freq>: 0.29,0.21,0.21,0.29\n"
 	    "                            Note that nucleotide frequencies (<bg freq>) MUST BE comma-separated\n"
 	    "     -q[--seqnorm]          Normalize pwm scores by sequence-based nucleotide composition\n"
+	    "     -Q[--min-quality] <q>  FASTQ input: skip reads whose mean Phred quality (offset 33) is below <q> [Default=0]\n"
 	    "     -r[--nohdr]            Output raw scores (with no FASTA header)\n"
+	    "     -S[--min-score] <s>    Only report best single matches scoring at least <s> (others as no match) [Default=none]\n"
+	    "     -T[--threshold] <s>    Report all sites (windows, either strand) scoring at least <s>, one per line: sequence\n"
+	    "                            index (0-based), start, strand and score (binary: 4 float64 per site) [single motif]\n"
+	    "     -t[--threads] <n>      Score sequences with <n> threads [Default=1]\n"
+	    "                            The output is identical to (and in the same order as) the single-threaded one\n"
+	    "     --stats[=text|json]    Report run statistics on stderr at the end: wall time of the setup, read, score and\n"
+	    "                            write phases, CPU time, records, bases, non-ACGT bases, longest record, input and\n"
+	    "                            output bytes, throughput and peak RSS\n"
+	    "     --stats-file <file>    Write the run statistics to <file> instead of stderr (implies --stats)\n"
 	    "     --lpm                  Input matrix is a letter probability matrix (LPM) [Default]\n"
 	    "     --pwm                  Input matrix is a position weight matrix (PWM)\n"
 	    "     -w[--pweight]          Set a pseudo-weight to re-normalize the frequencies of the letter-probability matrix (LPM)\n"
-	    "                            Recommended value is 0.0001 [Default=0.0]\n"
-	    "\n   Score a set of nucleotide sequences in FASTA format (<fasta_file>), based on matches to a sequence motif\n"
+	    "                            Recommended value is 0.0001 [Default=0.0]\n",
+	    argv[0]);
+    fprintf(stderr,
+	    "\n   Score a set of nucleotide sequences in FASTA or FASTQ format (<fasta_file>, possibly gzipped, or packed by seqpack), based on matches to a sequence motif\n"
             "   represented by an INTEGER position weight matrix [--pwm] or a base probability matrix [--lpm] (<matrix_file>).\n"
             "   Note that the background normalization options (-u, -p, -q) are only valid for base probability matrices.\n"
-            "   For integer PWMs, only the best single match scores are reported, along with the position, strand, and sequence match.\n\n",
-	    argv[0]);
+            "   For integer PWMs, only the best single match scores are reported, along with the position, strand, and sequence match.\n"
+            "   Several motifs may be given, with repeated -m options and/or matrix files holding several matrices each\n"
+            "   introduced by a '>' header line: all motifs are then scored in a single pass over the sequences, and one\n"
+            "   tab-separated score column is reported per motif, in input order (sum of probabilities, or best scores\n"
+            "   with -b and --pwm; match positions and sequences are not reported).\n"
+            "   FASTA records of chromosome size are scored while they are read, in bounded memory (not with -q or -d).\n\n");
     return 1;
   }
   if (options.pwm)
     options.lpm = 0;
-  if (options.lpm) {
-    /* Allocate space for profile (LPM) */
-    lpm = (double **)calloc(NUCL, sizeof(double *)); /* Allocate rows */
-    if (lpm == NULL) {
-      fprintf(stderr, "Could not allocate matrix array: %s(%d)\n",
-        strerror(errno), errno);
-      return 1;
-    }
-    for (i = 0; i < NUCL; i++) {
-      lpm[i] = calloc((size_t)matLen, sizeof(double));  /* Allocate columns for ACGT + N */
-      if (lpm[i] == NULL) {
-        fprintf(stderr, "Out of memory\n");
-        return 1;
-      }
-    }
-  } else {
+  if (!options.lpm) {
     options.seq_norm = 0;
     options.norm = 0;
     options.lib_norm = 0;
-    pwm = (int **)calloc(NUCL, sizeof(int *)); /* Allocate rows */
-    if (pwm == NULL) {
-      fprintf(stderr, "Could not allocate matrix array: %s(%d)\n",
-          strerror(errno), errno);
+  }
+  ms_options_init(&scan);
+  scan.lpm = options.lpm;
+  scan.bestscore = options.bestscore;
+  scan.forward = options.forward;
+  scan.seq_norm = options.seq_norm;
+  scan.kmer = options.kmer;
+  scan.bound = options.bound;
+  scan.binary = options.binary;
+  scan.nohdr = options.nohdr;
+  scan.debug = options.debug;
+  scan.min_score = options.min_score;
+  scan.sites = options.sites > 0;
+  scan.threshold = options.threshold;
+  scan.pvalue = options.pvalue;
+  scan.pseudo_weight = pseudo_weight;
+  if ((ctx = ms_create(&scan)) == NULL)
+    return 1;
+  /* Read Matrices from files */
+  for (k = 0; k < matCnt; k++) {
+    if (ms_load_file(ctx, matFiles[k]) <= 0)
       return 1;
-    }
-    for (i = 0; i < NUCL; i++) {
-      pwm[i] = calloc((size_t)matLen, sizeof(int));  /* Allocate columns for ACGT + N */
-      if (pwm[i] == NULL) {
-        fprintf(stderr, "Out of memory\n");
-        return 1;
-      }
-    }
   }
-  /* Read Matrix from file */
-  if ((matLen = read_profile(matFile)) <= 0)
+  motifCnt = ms_motif_count(ctx);
+  if (options.sites && (motifCnt > 1 || options.bestscore || options.min_score > -HUGE_VAL ||
+                        options.sites > 1)) {
+    fprintf(stderr, "--threshold and --pvalue report the sites of a single motif (not with -b or -S, or each other)\n");
+    return 1;
+  }
+  if (options.pvalue > 0.0 && options.seq_norm) {
+    fprintf(stderr, "--pvalue does not apply to sequence-based backgrounds (-q)\n");
+    return 1;
+  }
+  if (options.min_score > -HUGE_VAL && (motifCnt > 1 || (options.lpm && !options.bestscore))) {
+    fprintf(stderr, "--min-score only applies to the best match of a single motif (--best or --pwm)\n");
     return 1;
-  /* Fill 5th pwm column for the N nucleotide (0.25) */
-  if (options.lpm) {
-    for (i = 0; i < matLen; i++) {
-        lpm[4][i] = bprob;
-    }
-    if (pseudo_weight != 0.0) {
-      /* Re-normalize the matrix by adding a pseudo-weight to the bease frequencies */
-      for (int j = 0; j < matLen; j++) {
-        double sum = 0.0;
-        for (int i = 0; i < NUCL-1; i++)
-          sum += lpm[i][j] + pseudo_weight;
-        for (int i = 0; i < NUCL-1; i++)
-          lpm[i][j] = (lpm[i][j] + pseudo_weight)/sum;
-      }
-    }
-  } else {
-    for (i = 0; i < matLen; i++) {
-        pwm[4][i] = INT_MIN;
-    } 
   }
   /* Treat background nucleotide frequencies */
   if (options.norm) {
-    for (int j = 0; j < matLen; j++) {
-      for (i = 0; i < NUCL-1; i++) {
-        bg[i] = bprob;
-      }
+    for (i = 0; i < NUCL-1; i++) {
+      bg[i] = bprob;
     }
+    ms_set_background(ctx, bg);
   } else if (options.lib_norm) {
     tokens = str_split(bgProb, ',');
     if (tokens) {
@@ -900,69 +821,38 @@ main(int argc, char *argv[])
       }
       free(tokens);
     }
+    ms_set_background(ctx, bg);
   }
-  if (argc > optind) {
-      if(!strcmp(argv[optind],"-")) {
-          fasta_in = stdin;
-      } else {
-          fasta_in = fopen(argv[optind], "r");
-          if (fasta_in == NULL) {
-              fprintf(stderr, "Unable to open '%s': %s(%d)\n",
-                  argv[optind], strerror(errno), errno);
-             exit(EXIT_FAILURE);
-          }
-          if (options.debug)
-             fprintf(stderr, "Processing file %s\n", argv[optind]);
-      }
-  } else {
-      fasta_in = stdin;
+  /* Precompute the LPM/background or PWM score tables */
+  if (ms_prepare(ctx) != 0)
+    return 1;
+  if (ms_select_kernel(kernel) != 0)
+    return 1;
+  if (argc > optind && pseq_probe(argv[optind])) {
+    if (pseq_open(&pseq_in, argv[optind]) != 0) {
+      fprintf(stderr, "Unable to open '%s': %s\n", argv[optind], pseq_in.err);
+      exit(EXIT_FAILURE);
+    }
+    stats.in_bytes = pseq_in.map_size;
+  } else if (fasta_open(&fasta_in, argc > optind ? argv[optind] : NULL) != 0) {
+      fprintf(stderr, "Unable to open '%s': %s(%d)\n",
+          argv[optind], strerror(errno), errno);
+      exit(EXIT_FAILURE);
   }
+  fasta_in.min_qual = options.min_qual;
+  if (ms_streamable(ctx))
+    fasta_in.part_max = LONG_RECORD;
 
   if (options.debug != 0) {
-    if (fasta_in != stdin) {
+    if (pseq_in.map != NULL) {
+      fprintf(stderr, "Packed Sequence File : %s (%llu sequences, hash %016llx)\n", argv[optind],
+              (unsigned long long)pseq_in.hdr.count, (unsigned long long)pseq_in.hdr.hash);
+    } else if (fasta_in.stream != stdin) {
       fprintf(stderr, "Fasta File : %s\n", argv[optind]);
     } else {
       fprintf(stderr, "Sequence File from STDIN\n");
     }
-    fprintf(stderr, "Motif length: %d\n", matLen);
-    fprintf(stderr, "Weight Matrix: \n\n");
-    if (options.lpm) {
-      double *p;
-      for (int i = 0; i < NUCL; i++) {
-        fprintf(stderr, "%c ", nucleotide[i]);
-        fprintf(stderr, "[");
-        /* processing the rows of the PWM */
-        for (p = lpm[i]; p < lpm[i] + matLen; p++)
-          fprintf(stderr, " %f ", (*p));
-        fprintf(stderr, "]\n");
-      }
-    } else {
-      int *p;
-      for (int i = 0; i < NUCL; i++) {
-        fprintf(stderr, "%c ", nucleotide[i]);
-        fprintf(stderr, "[");
-        /* processing the rows of the PWM */
-        for (p = pwm[i]; p < pwm[i] + matLen; p++)
-          fprintf(stderr, " %d ", (*p));
-        fprintf(stderr, "]\n");
-      }
-    }
-    fprintf(stderr, "\n");
-    fprintf(stderr, "Weight Matrix: vertical representation (columns represent the four nucleotides ACGT)\n\n");
-    int j = 0;
-    for (j = 0; j < matLen; j++) {
-      for ( int i = 0; i < NUCL-1; i++) {
-        if (options.lpm) {
-          double pval = lpm[i][j];
-          fprintf(stderr, " %f ", pval);
-        } else {
-          int pval = pwm[i][j];
-          fprintf(stderr, " %d ", pval);
-        }
-      }
-      fprintf(stderr, "\n");
-    }
-    fprintf(stderr, "\n");
+    ms_print_motifs(ctx, stderr);
 
     if (options.lib_norm) {
       fprintf(stderr, "Background nucleotide frequencies:[%s]\n", bgProb);
@@ -980,21 +870,39 @@ main(int argc, char *argv[])
     if (options.forward) {
       fprintf(stderr, "Scanning sequences in forward direction only\n");
     }
+    if (options.threads > 1)
+      fprintf(stderr, "Scoring threads: %d\n", options.threads);
+    ms_print_scan(ctx, stderr);
+    if (options.min_score > -HUGE_VAL)
+      fprintf(stderr, "Minimum best match score: %g\n", options.min_score);
+    if (options.sites)
+      fprintf(stderr, "Reporting all sites scoring at least %g\n", ms_threshold(ctx));
     fprintf(stderr, "\n");
   }
   
-  if (process_file(fasta_in, argv[optind++], stdout) != 0)
+  out_init(&out, STDOUT_FILENO);
+  out.timed = stats.enabled;
+  stats.threads = options.threads;
+  if (options.binary)
+    ms_write_header(ctx, &out);
+  if (process_file(&fasta_in, argv[optind++], &out) != 0) {
+    out_close(&out);
     return 1;
-  
-  if (options.lpm) {
-    for (i = 0; i < NUCL; i++)
-      free(lpm[i]);
-    free(lpm);
+  }
+  if (options.threads == 1) {
+    /* The output buffer was flushed while scoring */
+    stats.wall[STATS_PROCESS] -= out.write_time;
+    stats.wall[STATS_WRITE] += out.write_time;
   } else {
-    for (i = 0; i < NUCL; i++)
-      free(pwm[i]);
-    free(pwm);
+    stats.wall[STATS_WRITE] += out.write_time;
   }
-
-  return 0;
+  stats_phase(&stats, STATS_WRITE);
+  out.timed = 0;
+  out_close(&out);
+  stats.out_bytes = out.written;
+  ms_destroy(ctx);
+  free(matFiles);
+
+  return stats_report(&stats) == 0 ? 0 : 1;
 }
+
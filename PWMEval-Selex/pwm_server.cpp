@@ -0,0 +1,961 @@
+#include <string>
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "packed_seq.h"
+#include "fasta_reader.h"
+#include "pseq_file.h"
+#include "motif_scan.h"
+#include "roc_auc.h"
+
+/*
+  Scoring server: the positive and negative sequences are read and packed
+  once at startup (packed sequence files are mapped and used in place),
+  then motifs are scored against them on request, over HTTP on a
+  Unix-domain socket or a localhost TCP port.  This saves the process
+  start, the sequence parsing and the score files of an evaluate run per
+  motif when a queue submits motifs by the thousand.
+
+    POST /metrics   ROC and PR AUCs of the motif(s) in the request body,
+                    as printed by roc_metrics (text, or JSON with json=1)
+    POST /scores    Score of every sequence, one line per sequence
+    GET  /          Loaded datasets
+
+  The request body is a motif file, as given to pwm_scoring -m.  Each
+  request gets its own motif context (motif_scan.h); its sequences are cut
+  into chunks that go to a shared pool of scoring threads, so that a single
+  request uses every core and concurrent requests share them.  The scores
+  are those of pwm_scoring --output-format binary with the same options.
+*/
+
+#define REQUEST_HEAD_MAX (64 << 10)     // Request line and headers
+#define REQUEST_BODY_MAX (16 << 20)     // Motif files
+#define CHUNK_BASES_MIN (1 << 16)       // Smallest chunk of sequences (bases)
+#define IO_TIMEOUT 60                   // Seconds without progress on a connection
+
+struct Options {
+  ms_options_t scan;
+  double bg[4];
+  bool bg_set;
+  int threads;
+  int connections;
+};
+
+static Options options;
+
+// Sequences of both sets (positive first): views of packed sequence files,
+// or sequences read from FASTA/FASTQ into two arenas
+static std::vector<seq_t> seqs;
+static std::vector<uint64_t> seq_bits;
+static std::vector<int> seq_nruns;
+static std::vector<std::pair<size_t, size_t> > arena_seqs;
+static pseq_reader_t packed[2];
+static size_t n_pos = 0, n_neg = 0, n_bases = 0;
+
+// Chunk boundaries: chunk k holds the sequences [chunks[k], chunks[k + 1])
+static std::vector<size_t> chunks;
+
+struct Job {
+  const ms_context_t *ctx;
+  unsigned long id;          // Scanner reuse key (contexts may share addresses)
+  size_t motifs;
+  double *scores;            // scores[seq * motifs + motif]
+  size_t pending;            // Chunks not scored yet
+  bool failed;
+};
+
+struct Chunk {
+  Job *job;
+  size_t first, count;
+};
+
+struct Pool {
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  std::deque<Chunk> queue;
+  unsigned long next_id;
+  int clients;               // Open connections
+};
+
+static Pool pool;
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int) {
+  stop = 1;
+}
+
+// Each worker keeps the scanner of the last job it took a chunk of
+static void *worker(void *) {
+  ms_scanner_t *sc = NULL;
+  unsigned long sc_id = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&pool.lock);
+    while (pool.queue.empty()) {
+      pthread_cond_wait(&pool.work, &pool.lock);
+    }
+    Chunk chunk = pool.queue.front();
+    pool.queue.pop_front();
+    pthread_mutex_unlock(&pool.lock);
+
+    Job *job = chunk.job;
+    if (sc == NULL || sc_id != job->id) {
+      ms_scanner_free(sc);
+      sc = ms_scanner_new(job->ctx);
+      sc_id = job->id;
+    }
+    bool ok = ms_score_values(sc, &seqs[chunk.first], (int)chunk.count, job->scores + chunk.first * job->motifs) == 0;
+
+    pthread_mutex_lock(&pool.lock);
+    job->failed = job->failed || !ok;
+    if (--job->pending == 0) {
+      pthread_cond_broadcast(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+  }
+  return NULL;
+}
+
+// Score all the sequences with the motifs of ctx, on the pool
+static bool score_all(const ms_context_t *ctx, std::vector<double>& scores) {
+  Job job;
+  job.ctx = ctx;
+  job.motifs = (size_t)ms_motif_count(ctx);
+  scores.assign(seqs.size() * job.motifs, 0.0);
+  job.scores = scores.empty() ? NULL : &scores[0];
+  job.pending = chunks.size() - 1;
+  job.failed = false;
+
+  pthread_mutex_lock(&pool.lock);
+  job.id = ++pool.next_id;
+  for (size_t k = 0; k + 1 < chunks.size(); ++k) {
+    Chunk chunk = {&job, chunks[k], chunks[k + 1] - chunks[k]};
+    pool.queue.push_back(chunk);
+  }
+  pthread_cond_broadcast(&pool.work);
+  while (job.pending > 0) {
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return !job.failed;
+}
+
+// Chunks of about total / (8 * threads) bases, so that one request keeps
+// every thread busy to the end
+static void make_chunks() {
+  size_t target = n_bases / (8 * (size_t)options.threads), bases = 0;
+  if (target < CHUNK_BASES_MIN) {
+    target = CHUNK_BASES_MIN;
+  }
+  chunks.push_back(0);
+  for (size_t i = 0; i < seqs.size(); ++i) {
+    bases += (size_t)seqs[i].len;
+    if (bases >= target && (i + 1 - chunks.back()) % MS_BATCH_LANES == 0) {
+      chunks.push_back(i + 1);
+      bases = 0;
+    }
+  }
+  if (chunks.back() != seqs.size()) {
+    chunks.push_back(seqs.size());
+  }
+}
+
+// The non-empty sequences of a packed sequence file, used in place
+static bool load_packed(const char *filename, pseq_reader_t& input, size_t& count) {
+  seq_t view;
+  int more;
+
+  if (pseq_open(&input, filename) != 0) {
+    std::cerr << "Unable to open '" << filename << "': " << input.err << std::endl;
+    return false;
+  }
+  count = 0;
+  while ((more = pseq_next(&input, &view)) > 0) {
+    if (view.len != 0) {
+      view.hdr = NULL;
+      seqs.push_back(view);
+      n_bases += (size_t)view.len;
+      ++count;
+    }
+  }
+  if (more < 0) {
+    std::cerr << "Error reading file " << filename << ": " << input.err << std::endl;
+    return false;
+  }
+  if (count == 0) {
+    std::cerr << "Could not find a sequence in file " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Read the non-empty sequences of a FASTA/FASTQ file (or a packed file)
+// into the arenas; the pointers of the new sequences are set by
+// fix_pointers
+static bool load_sequences(const char *filename, double min_qual, pseq_reader_t& packed_input, size_t& count) {
+  fasta_reader_t input;
+  seq_t seq;
+  int more;
+
+  if (pseq_probe(filename)) {
+    return load_packed(filename, packed_input, count);
+  }
+  size_t first = seqs.size();
+  if (fasta_open(&input, filename) != 0) {
+    std::cerr << "Unable to open '" << filename << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+  input.min_qual = min_qual;
+  seq_init(&seq);
+  count = 0;
+  while ((more = fasta_next(&input)) > 0) {
+    if (input.hdr == NULL) {
+      continue;
+    }
+    if (input.seq_len > INT_MAX) {
+      std::cerr << "Sequence too long in file " << filename << std::endl;
+      more = -2;
+      break;
+    }
+    seq_clear(&seq);
+    seq_reserve(&seq, (int)input.seq_len);
+    seq_append_text(&seq, input.seq, input.seq_len);
+    if (seq.len == 0) {
+      continue;
+    }
+    // Exactly the words and runs used, pointers stored as arena offsets
+    seq_t packed;
+    packed.hdr = NULL;
+    packed.len = seq.len;
+    packed.words = seq.len / SEQ_WORD_BASES + 2;
+    packed.bits = (uint64_t *)(uintptr_t)seq_bits.size();
+    seq_bits.insert(seq_bits.end(), seq.bits, seq.bits + packed.words);
+    packed.nrun_cnt = packed.nrun_size = seq.nrun_cnt;
+    packed.nrun = (int *)(uintptr_t)seq_nruns.size();
+    seq_nruns.insert(seq_nruns.end(), seq.nrun, seq.nrun + 2 * seq.nrun_cnt);
+    seqs.push_back(packed);
+    n_bases += (size_t)seq.len;
+    ++count;
+  }
+  if (more == -1) {
+    std::cerr << "Error reading file " << filename << ": " << input.err << std::endl;
+  }
+  seq_free(&seq);
+  fasta_close(&input);
+  arena_seqs.push_back(std::make_pair(first, seqs.size()));
+  if (more == 0 && count == 0) {
+    std::cerr << "Could not find a sequence in file " << filename << std::endl;
+    return false;
+  }
+  return more == 0;
+}
+
+static void fix_pointers() {
+  for (size_t k = 0; k < arena_seqs.size(); ++k) {
+    for (size_t i = arena_seqs[k].first; i < arena_seqs[k].second; ++i) {
+      seqs[i].bits = &seq_bits[0] + (uintptr_t)seqs[i].bits;
+      seqs[i].nrun = seq_nruns.empty() ? NULL : &seq_nruns[0] + (uintptr_t)seqs[i].nrun;
+    }
+  }
+}
+
+/* HTTP */
+
+struct Request {
+  std::string method, path;
+  std::map<std::string, std::string> query;
+  std::string body;
+};
+
+struct Response {
+  int status;
+  std::string content_type;
+  std::string body;
+  Response() : status(200), content_type("text/plain") {  }
+};
+
+static Response error_response(int status, const std::string& message) {
+  Response res;
+  res.status = status;
+  res.body = message + "\n";
+  return res;
+}
+
+static const char *status_text(int status) {
+  switch (status) {
+  case 200: return "OK";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 408: return "Request Timeout";
+  case 411: return "Length Required";
+  case 413: return "Payload Too Large";
+  case 431: return "Request Header Fields Too Large";
+  default: return "Internal Server Error";
+  }
+}
+
+static bool send_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+static void send_response(int fd, const Response& res) {
+  char head[256];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                   res.status, status_text(res.status), res.content_type.c_str(), res.body.size());
+  if (send_all(fd, head, (size_t)n)) {
+    send_all(fd, res.body.data(), res.body.size());
+  }
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = (char)tolower((unsigned char)c);
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static std::string url_decode(const std::string& s) {
+  std::string out;
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '+') {
+      out += ' ';
+    } else if (s[i] == '%' && i + 2 < s.size() && hex_digit(s[i + 1]) >= 0 && hex_digit(s[i + 2]) >= 0) {
+      out += (char)(hex_digit(s[i + 1]) * 16 + hex_digit(s[i + 2]));
+      i += 2;
+    } else {
+      out += s[i];
+    }
+  }
+  return out;
+}
+
+static void parse_query(const std::string& query, std::map<std::string, std::string>& params) {
+  size_t start = 0;
+  while (start < query.size()) {
+    size_t end = query.find('&', start);
+    if (end == std::string::npos) {
+      end = query.size();
+    }
+    std::string item = query.substr(start, end - start);
+    size_t eq = item.find('=');
+    if (!item.empty()) {
+      if (eq == std::string::npos) {
+        params[url_decode(item)] = "";
+      } else {
+        params[url_decode(item.substr(0, eq))] = url_decode(item.substr(eq + 1));
+      }
+    }
+    start = end + 1;
+  }
+}
+
+static bool header_is(const std::string& line, const char *name, std::string& value) {
+  size_t len = strlen(name);
+  if (line.size() <= len || line[len] != ':' || strncasecmp(line.c_str(), name, len) != 0) {
+    return false;
+  }
+  size_t start = line.find_first_not_of(" \t", len + 1);
+  value = start == std::string::npos ? "" : line.substr(start);
+  return true;
+}
+
+// Read one request; returns 0, or the status of the error response
+static int read_request(int fd, Request& req) {
+  std::string data;
+  char buf[16384];
+  size_t head_end;
+
+  while ((head_end = data.find("\r\n\r\n")) == std::string::npos) {
+    if (data.size() > REQUEST_HEAD_MAX) {
+      return 431;
+    }
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 408 : 400;
+    }
+    data.append(buf, (size_t)n);
+  }
+
+  std::string head = data.substr(0, head_end);
+  size_t line_end = head.find("\r\n");
+  std::string line = head.substr(0, line_end);
+  size_t sp1 = line.find(' '), sp2 = line.rfind(' ');
+  if (sp1 == std::string::npos || sp2 == sp1) {
+    return 400;
+  }
+  req.method = line.substr(0, sp1);
+  std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  size_t qm = target.find('?');
+  req.path = url_decode(target.substr(0, qm));
+  if (qm != std::string::npos) {
+    parse_query(target.substr(qm + 1), req.query);
+  }
+
+  size_t length = 0;
+  bool has_length = false, expect_continue = false;
+  while (line_end != std::string::npos) {
+    size_t start = line_end + 2;
+    line_end = head.find("\r\n", start);
+    line = head.substr(start, line_end == std::string::npos ? std::string::npos : line_end - start);
+    std::string value;
+    if (header_is(line, "Content-Length", value)) {
+      char *end;
+      errno = 0;
+      unsigned long long v = strtoull(value.c_str(), &end, 10);
+      if (value.empty() || *end != '\0' || errno != 0) {
+        return 400;
+      }
+      if (v > REQUEST_BODY_MAX) {
+        return 413;
+      }
+      length = (size_t)v;
+      has_length = true;
+    } else if (header_is(line, "Transfer-Encoding", value)) {
+      return 411;
+    } else if (header_is(line, "Expect", value)) {
+      expect_continue = strcasecmp(value.c_str(), "100-continue") == 0;
+    }
+  }
+  if (req.method == "POST" && !has_length) {
+    return 411;
+  }
+
+  req.body = data.substr(head_end + 4);
+  if (expect_continue && req.body.size() < length) {
+    static const char reply[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    send_all(fd, reply, sizeof(reply) - 1);
+  }
+  while (req.body.size() < length) {
+    ssize_t n = recv(fd, buf, std::min(sizeof(buf), length - req.body.size()), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 408 : 400;
+    }
+    req.body.append(buf, (size_t)n);
+  }
+  req.body.resize(length);
+  return 0;
+}
+
+/* Requests */
+
+static bool query_flag(const Request& req, const char *name) {
+  std::map<std::string, std::string>::const_iterator it = req.query.find(name);
+  return it != req.query.end() && it->second != "0" && it->second != "false" && it->second != "no";
+}
+
+static bool query_number(const Request& req, const char *name, double& value, std::string& error) {
+  std::map<std::string, std::string>::const_iterator it = req.query.find(name);
+  if (it == req.query.end()) {
+    return true;
+  }
+  char *end;
+  value = strtod(it->second.c_str(), &end);
+  if (it->second.empty() || *end != '\0') {
+    error = std::string("Invalid ") + name + " \"" + it->second + "\"";
+    return false;
+  }
+  return true;
+}
+
+// Motif context of the request body (pseudo-weight from the query)
+static ms_context_t *request_motifs(const Request& req, std::string& error) {
+  ms_options_t scan = options.scan;
+  if (!query_number(req, "pweight", scan.pseudo_weight, error)) {
+    return NULL;
+  }
+  ms_context_t *ctx = ms_create(&scan);
+  if (ctx == NULL) {
+    error = "Invalid scoring options";
+    return NULL;
+  }
+  if (ms_load_text(ctx, "request", req.body.data(), req.body.size()) <= 0) {
+    error = "Could not read a motif from the request body (see the server log)";
+    ms_destroy(ctx);
+    return NULL;
+  }
+  if (options.bg_set) {
+    ms_set_background(ctx, options.bg);
+  }
+  if (ms_prepare(ctx) != 0) {
+    error = "Could not prepare the motif (see the server log)";
+    ms_destroy(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+// One line per sequence: set (pos or neg) and one score per motif
+static Response handle_scores(const Request& req) {
+  std::string error;
+  ms_context_t *ctx = request_motifs(req, error);
+  if (ctx == NULL) {
+    return error_response(400, error);
+  }
+  std::vector<double> scores;
+  bool ok = score_all(ctx, scores);
+  size_t motifs = (size_t)ms_motif_count(ctx);
+  ms_destroy(ctx);
+  if (!ok) {
+    return error_response(500, "Scoring failed (see the server log)");
+  }
+  Response res;
+  res.body.reserve(seqs.size() * (4 + 16 * motifs));
+  for (size_t i = 0; i < seqs.size(); ++i) {
+    res.body += i < n_pos ? "pos" : "neg";
+    for (size_t k = 0; k < motifs; ++k) {
+      res.body += '\t';
+      append_number(res.body, scores[i * motifs + k]);
+    }
+    res.body += '\n';
+  }
+  return res;
+}
+
+// Same output as roc_metrics on the binary scores of both sets
+static Response handle_metrics(const Request& req) {
+  std::string error;
+  double top_fraction = 1, max_points = 0;
+  bool top = req.query.count("top") > 0;
+  if (!query_number(req, "top", top_fraction, error) || !query_number(req, "max_points", max_points, error)) {
+    return error_response(400, error);
+  }
+  if (top && !(top_fraction > 0 && top_fraction <= 1)) {
+    return error_response(400, "Invalid top fraction (it should be in ]0,1])");
+  }
+  bool json = query_flag(req, "json");
+  bool roc_curve = json && query_flag(req, "roc"), pr_curve = json && query_flag(req, "pr");
+
+  ms_context_t *ctx = request_motifs(req, error);
+  if (ctx == NULL) {
+    return error_response(400, error);
+  }
+  std::vector<double> scores;
+  bool ok = score_all(ctx, scores);
+  size_t motifs = (size_t)ms_motif_count(ctx);
+  std::vector<std::string> names;
+  if (req.query.count("name") > 0 && motifs == 1) {
+    names.push_back(req.query.find("name")->second);
+  } else if (motifs > 1) {
+    for (size_t k = 0; k < motifs; ++k) {
+      names.push_back(ms_motif_name(ctx, (int)k));
+    }
+  }
+  ms_destroy(ctx);
+  if (!ok) {
+    return error_response(500, "Scoring failed (see the server log)");
+  }
+
+  Response res;
+  if (json) {
+    res.content_type = "application/json";
+  }
+  std::vector<double> pos(n_pos), neg(n_neg);
+  for (size_t k = 0; k < motifs; ++k) {
+    pos.resize(n_pos);
+    neg.resize(n_neg);
+    for (size_t i = 0; i < n_pos; ++i) {
+      pos[i] = scores[i * motifs + k];
+    }
+    for (size_t i = 0; i < n_neg; ++i) {
+      neg[i] = scores[(n_pos + i) * motifs + k];
+    }
+    if (top) {
+      take_top_fraction(pos, top_fraction);
+      take_top_fraction(neg, top_fraction);
+    }
+    Metrics m = compute_metrics(pos, neg, roc_curve, pr_curve);
+    downsample(m.roc_curve, (size_t)max_points);
+    downsample(m.pr_curve, (size_t)max_points);
+
+    const std::string *name = names.empty() ? NULL : &names[k];
+    if (json) {
+      append_json(res.body, m, name, roc_curve, pr_curve);
+    } else {
+      const char *labels[2] = {"ROC ", "PR "};
+      double values[2] = {m.roc_auc, m.pr_auc};
+      for (int j = 0; j < 2; ++j) {
+        if (name != NULL) {
+          res.body += *name;
+          res.body += ' ';
+        }
+        res.body += labels[j];
+        append_number(res.body, values[j]);
+        res.body += '\n';
+      }
+    }
+  }
+  return res;
+}
+
+static Response handle_info() {
+  char buf[256];
+  Response res;
+  snprintf(buf, sizeof(buf), "positive\t%zu\nnegative\t%zu\nbases\t%zu\nthreads\t%d\nkernel\t%s\n",
+           n_pos, n_neg, n_bases, options.threads, ms_kernel_name());
+  res.body = buf;
+  return res;
+}
+
+static Response handle_request(const Request& req) {
+  if (req.path == "/metrics" || req.path == "/scores") {
+    if (req.method != "POST") {
+      return error_response(405, "Motifs are POSTed to " + req.path);
+    }
+    return req.path == "/metrics" ? handle_metrics(req) : handle_scores(req);
+  }
+  if (req.path == "/" || req.path == "/info") {
+    if (req.method != "GET") {
+      return error_response(405, "Use GET " + req.path);
+    }
+    return handle_info();
+  }
+  return error_response(404, "Unknown path " + req.path + " (use /metrics, /scores or /info)");
+}
+
+static void *connection(void *arg) {
+  int fd = (int)(intptr_t)arg;
+  struct timeval timeout = {IO_TIMEOUT, 0};
+  Request req;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  int status = read_request(fd, req);
+  if (status != 0) {
+    send_response(fd, error_response(status, status_text(status)));
+  } else {
+    send_response(fd, handle_request(req));
+  }
+  close(fd);
+
+  pthread_mutex_lock(&pool.lock);
+  pool.clients--;
+  pthread_cond_broadcast(&pool.done);
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+static int listen_unix(const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path too long: " << path << std::endl;
+    return -1;
+  }
+  // A socket left over by a previous server
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+    std::cerr << "Could not listen on " << path << ": " << strerror(errno) << std::endl;
+    return -1;
+  }
+  return fd;
+}
+
+// Loopback only: the server is not meant to be exposed
+static int listen_tcp(int port) {
+  struct sockaddr_in addr;
+  int one = 1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd >= 0) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  }
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+    std::cerr << "Could not listen on 127.0.0.1:" << port << ": " << strerror(errno) << std::endl;
+    return -1;
+  }
+  return fd;
+}
+
+static void usage(const char *name) {
+  std::cerr <<
+    "Usage: " << name << " [options] -s <socket> | -l <port> <positive sequences> <negative sequences>\n"
+    "   where options are:\n"
+    "     -s[--socket] <path>      Listen on the Unix-domain socket <path>\n"
+    "     -l[--listen] <port>      Listen on 127.0.0.1:<port>\n"
+    "     -t[--threads] <n>        Scoring threads [Default=number of CPUs]\n"
+    "     -c[--connections] <n>    Requests handled at the same time [Default=16]\n"
+    "     -b[--best]               Compute best single match scores\n"
+    "     -f[--forward]            Scan sequences in forward direction [def=bidirectional]\n"
+    "     -k[--kernel] <name>      Window scanning kernel: auto, scalar, avx2 or avx512 [Default=auto]\n"
+    "     -K[--kmer] <k>           Score windows with lookup tables of <k>-mers [Default=0 (off)]\n"
+    "     -u[--unorm]              Normalize pwm scores by a uniform background base composition\n"
+    "     -p[--prob] <bg freq>     Normalize pwm scores by library-dependent nucleotide frequencies: 0.29,0.21,0.21,0.29\n"
+    "     -q[--seqnorm]            Normalize pwm scores by sequence-based nucleotide composition\n"
+    "     -Q[--min-quality] <q>    FASTQ input: skip reads whose mean Phred quality is below <q> [Default=0]\n"
+    "     -w[--pweight] <w>        Pseudo-weight of the letter-probability matrices [Default=0.0]\n"
+    "     --lpm                    Motifs are letter probability matrices (LPM) [Default]\n"
+    "     --pwm                    Motifs are integer position weight matrices (PWM)\n"
+    "\n   Read the positive and negative sequences (FASTA or FASTQ, possibly gzipped, or packed by seqpack) once, then score the motifs\n"
+    "   POSTed over HTTP as pwm_scoring with the same options would:\n"
+    "     POST /metrics[?top=<fraction>&json=1&roc=1&pr=1&max_points=<n>&name=<name>&pweight=<w>]\n"
+    "                              ROC and PR AUCs, as printed by roc_metrics (one result per motif)\n"
+    "     POST /scores[?pweight=<w>]  One line per sequence: pos or neg, then one score per motif\n"
+    "     GET /info                Loaded sequences\n"
+    "   The request body is a motif file, e.g.\n"
+    "     curl --unix-socket <socket> --data-binary @motif.pfm 'http://localhost/metrics?top=0.1&json=1'\n";
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static int pwm = 0;
+  static struct option long_options[] = {
+    {"socket",      required_argument, 0, 's'},
+    {"listen",      required_argument, 0, 'l'},
+    {"threads",     required_argument, 0, 't'},
+    {"connections", required_argument, 0, 'c'},
+    {"best",        no_argument,       0, 'b'},
+    {"forward",     no_argument,       0, 'f'},
+    {"kernel",      required_argument, 0, 'k'},
+    {"kmer",        required_argument, 0, 'K'},
+    {"unorm",       no_argument,       0, 'u'},
+    {"prob",        required_argument, 0, 'p'},
+    {"seqnorm",     no_argument,       0, 'q'},
+    {"min-quality", required_argument, 0, 'Q'},
+    {"pweight",     required_argument, 0, 'w'},
+    {"help",        no_argument,       0, 'h'},
+    {"lpm",         no_argument,       &pwm, 0},
+    {"pwm",         no_argument,       &pwm, 1},
+    {0, 0, 0, 0}
+  };
+  const char *socket_path = NULL, *kernel = NULL;
+  int port = 0, c;
+  double min_qual = 0;
+  bool norm = false;
+
+  ms_options_init(&options.scan);
+  options.scan.binary = 1;
+  options.scan.nohdr = 1;
+  options.bg_set = false;
+  options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  options.connections = 16;
+  if (options.threads < 1) {
+    options.threads = 1;
+  }
+
+  while ((c = getopt_long(argc, argv, "s:l:t:c:bfk:K:up:qQ:w:h", long_options, NULL)) != -1) {
+    switch (c) {
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'l':
+      port = atoi(optarg);
+      if (port < 1 || port > 65535) {
+        std::cerr << "Invalid port \"" << optarg << "\"" << std::endl;
+        return 1;
+      }
+      break;
+    case 't':
+      options.threads = atoi(optarg);
+      if (options.threads < 1) {
+        std::cerr << "Invalid number of threads \"" << optarg << "\"" << std::endl;
+        return 1;
+      }
+      break;
+    case 'c':
+      options.connections = atoi(optarg);
+      if (options.connections < 1) {
+        std::cerr << "Invalid number of connections \"" << optarg << "\"" << std::endl;
+        return 1;
+      }
+      break;
+    case 'b':
+      options.scan.bestscore = 1;
+      break;
+    case 'f':
+      options.scan.forward = 1;
+      break;
+    case 'k':
+      kernel = optarg;
+      break;
+    case 'K':
+      options.scan.kmer = atoi(optarg);
+      if (options.scan.kmer < 0 || options.scan.kmer > MS_KMER_MAX) {
+        std::cerr << "Invalid k-mer length \"" << optarg << "\" (it should be between 0 and " << MS_KMER_MAX << ")" << std::endl;
+        return 1;
+      }
+      break;
+    case 'u':
+      norm = true;
+      break;
+    case 'p':
+      if (sscanf(optarg, "%lf,%lf,%lf,%lf", &options.bg[0], &options.bg[1], &options.bg[2], &options.bg[3]) != 4) {
+        std::cerr << "Please, specify correct library-dependent nucleotide frequencies <bg freq>: they MUST BE comma-separated!" << std::endl;
+        return 1;
+      }
+      options.bg_set = true;
+      break;
+    case 'q':
+      options.scan.seq_norm = 1;
+      break;
+    case 'Q':
+      min_qual = atof(optarg);
+      break;
+    case 'w':
+      options.scan.pseudo_weight = atof(optarg);
+      break;
+    case 0:
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2 || (socket_path == NULL) == (port == 0)) {
+    usage(argv[0]);
+  }
+  if (pwm) {
+    options.scan.lpm = 0;
+    options.scan.seq_norm = 0;
+    options.bg_set = false;
+  } else if (norm && !options.bg_set) {
+    for (int i = 0; i < 4; ++i) {
+      options.bg[i] = 0.25;
+    }
+    options.bg_set = true;
+  }
+  if (ms_select_kernel(kernel) != 0) {
+    return 1;
+  }
+
+  size_t pos_bases;
+
+  if (!load_sequences(argv[optind], min_qual, packed[0], n_pos)) {
+    return 1;
+  }
+  pos_bases = n_bases;
+  if (!load_sequences(argv[optind + 1], min_qual, packed[1], n_neg)) {
+    return 1;
+  }
+  fix_pointers();
+  make_chunks();
+
+  int listen_fd = socket_path != NULL ? listen_unix(socket_path) : listen_tcp(port);
+  if (listen_fd < 0) {
+    return 1;
+  }
+  std::cerr << "Loaded " << n_pos << " positive (" << pos_bases << " bases) and " << n_neg << " negative ("
+            << n_bases - pos_bases << " bases) sequences; " << options.threads << " scoring threads, listening on ";
+  if (socket_path != NULL) {
+    std::cerr << socket_path << std::endl;
+  } else {
+    std::cerr << "127.0.0.1:" << port << std::endl;
+  }
+
+  // SIGINT and SIGTERM are blocked in every thread, and only let through
+  // while the main thread waits for a connection (ppoll)
+  struct sigaction sa;
+  sigset_t signals, waiting;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &waiting);
+  fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.work, NULL);
+  pthread_cond_init(&pool.done, NULL);
+  pool.next_id = 0;
+  pool.clients = 0;
+  for (int k = 0; k < options.threads; ++k) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, worker, NULL) != 0) {
+      std::cerr << "Could not start the scoring threads" << std::endl;
+      return 1;
+    }
+    pthread_detach(tid);
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  while (!stop) {
+    pthread_mutex_lock(&pool.lock);
+    while (pool.clients >= options.connections) {
+      pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    if (ppoll(&pfd, 1, NULL, &waiting) < 0) {
+      continue;
+    }
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+        std::cerr << "accept: " << strerror(errno) << std::endl;
+      }
+      continue;
+    }
+    pthread_t tid;
+    pthread_mutex_lock(&pool.lock);
+    pool.clients++;
+    pthread_mutex_unlock(&pool.lock);
+    if (pthread_create(&tid, &attr, connection, (void *)(intptr_t)fd) != 0) {
+      send_response(fd, error_response(500, "Could not handle the request"));
+      close(fd);
+      pthread_mutex_lock(&pool.lock);
+      pool.clients--;
+      pthread_mutex_unlock(&pool.lock);
+    }
+  }
+  close(listen_fd);
+  if (socket_path != NULL) {
+    unlink(socket_path);
+  }
+  return 0;
+}
@@ -0,0 +1,235 @@
+/*
+
+  ROC and PR metrics of motif scores, shared by roc_metrics and pwm_server.
+
+  The metrics are those of PRROC (roc.curve and pr.curve) on the positive
+  and negative scores of each motif:
+
+  - ROC AUC: trapezoidal area under the ROC curve, with one point per
+    distinct score (tied scores of both classes make one diagonal step);
+  - PR AUC: integral of the continuous interpolation of the PR curve
+    between those points (Keilwagen et al., 2014);
+  - PR AUC (Davis-Goadrich): trapezoidal area over the interpolated points
+    of every intermediate true positive count (Davis and Goadrich, 2006).
+
+  The scores of each class are sorted once (O(n log n)); the top fraction
+  of a class is selected beforehand in linear time with nth_element.
+
+*/
+#ifndef ROC_AUC_H
+#define ROC_AUC_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+struct CurvePoint {
+  double x, y;
+  CurvePoint(double x, double y) : x(x), y(y) {  }
+};
+
+struct Metrics {
+  double roc_auc;
+  double pr_auc;
+  double pr_auc_dg;
+  std::vector<CurvePoint> roc_curve;   // (fpr, tpr)
+  std::vector<CurvePoint> pr_curve;    // (recall, precision)
+};
+
+struct Scored {
+  double score;
+  bool positive;
+  Scored(double score, bool positive) : score(score), positive(positive) {  }
+};
+
+// Decreasing order, NaN last (as R's order)
+static bool greater_score(double a, double b) {
+  return a > b || (std::isnan(b) && !std::isnan(a));
+}
+
+static bool same_score(double a, double b) {
+  return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+static bool scored_before(const Scored& a, const Scored& b) {
+  return greater_score(a.score, b.score);
+}
+
+// Keep the round(top_fraction * n) largest values (at least one), in no
+// particular order: the values of sort(values, decreasing=TRUE)[1:N] in R
+static void take_top_fraction(std::vector<double>& values, double top_fraction) {
+  size_t n = (size_t)std::nearbyint(top_fraction * (double)values.size());  // Half to even, as R
+  if (n < 1) {
+    n = 1;
+  }
+  if (n >= values.size()) {
+    return;
+  }
+  std::nth_element(values.begin(), values.begin() + (n - 1), values.end(), greater_score);
+  values.resize(n);
+}
+
+static Metrics compute_metrics(const std::vector<double>& pos, const std::vector<double>& neg, bool roc_curve, bool pr_curve) {
+  Metrics m;
+  std::vector<Scored> all;
+  double n_pos = (double)pos.size(), n_neg = (double)neg.size();
+  double tp = 0, fp = 0, tp_prev = 0, fp_prev = 0;
+
+  all.reserve(pos.size() + neg.size());
+  for (size_t i = 0; i < pos.size(); ++i) {
+    all.push_back(Scored(pos[i], true));
+  }
+  for (size_t i = 0; i < neg.size(); ++i) {
+    all.push_back(Scored(neg[i], false));
+  }
+  std::sort(all.begin(), all.end(), scored_before);
+
+  m.roc_auc = m.pr_auc = m.pr_auc_dg = 0;
+  if (roc_curve) {
+    m.roc_curve.push_back(CurvePoint(0, 0));
+  }
+  for (size_t i = 0, j; i < all.size(); i = j) {
+    // One step per distinct score
+    for (j = i; j < all.size() && same_score(all[j].score, all[i].score); ++j) {
+      if (all[j].positive) {
+        tp += 1;
+      } else {
+        fp += 1;
+      }
+    }
+    m.roc_auc += (fp - fp_prev) * (tp + tp_prev) / 2;
+    if (tp > tp_prev) {
+      // Interpolation: fp = fp_prev + h (x - tp_prev), precision = x / (a x + b)
+      double h = (fp - fp_prev) / (tp - tp_prev), a = 1 + h, b = fp_prev - h * tp_prev;
+      double prec_prev = tp_prev + fp_prev > 0 ? tp_prev / (tp_prev + fp_prev) : 1 / a;
+      m.pr_auc += (tp - tp_prev) / a;
+      if (b != 0) {
+        // a tp + b = tp + fp, a tp_prev + b = tp_prev + fp_prev
+        m.pr_auc -= b / (a * a) * std::log((tp + fp) / (tp_prev + fp_prev));
+      }
+      if (pr_curve && m.pr_curve.empty()) {
+        m.pr_curve.push_back(CurvePoint(0, prec_prev));
+      }
+      for (double x = tp_prev + 1; x <= tp; x += 1) {
+        double prec = x / (x + fp_prev + h * (x - tp_prev));
+        m.pr_auc_dg += (prec_prev + prec) / 2;
+        prec_prev = prec;
+      }
+      if (pr_curve) {
+        m.pr_curve.push_back(CurvePoint(tp / n_pos, tp / (tp + fp)));
+      }
+    }
+    if (roc_curve) {
+      m.roc_curve.push_back(CurvePoint(fp / n_neg, tp / n_pos));
+    }
+    tp_prev = tp;
+    fp_prev = fp;
+  }
+  m.roc_auc /= n_pos * n_neg;
+  m.pr_auc /= n_pos;
+  m.pr_auc_dg /= n_pos;
+  return m;
+}
+
+// At most max_points points, evenly spaced along the curve (ends included)
+static void downsample(std::vector<CurvePoint>& curve, size_t max_points) {
+  if (max_points < 2 || curve.size() <= max_points) {
+    return;
+  }
+  std::vector<CurvePoint> points;
+  points.reserve(max_points);
+  for (size_t k = 0; k < max_points; ++k) {
+    points.push_back(curve[(size_t)std::floor((double)k * (double)(curve.size() - 1) / (double)(max_points - 1) + 0.5)]);
+  }
+  curve.swap(points);
+}
+
+// Numbers as R prints them (15 significant digits)
+static void append_number(std::string& out, double x) {
+  char buf[32];
+  if (std::isnan(x)) {
+    out += "NaN";
+  } else if (std::isinf(x)) {
+    out += x > 0 ? "Inf" : "-Inf";
+  } else {
+    snprintf(buf, sizeof(buf), "%.15g", x);
+    out += buf;
+  }
+}
+
+static void append_json_string(std::string& out, const std::string& s) {
+  char buf[8];
+  out += '"';
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += (char)c;
+    } else if (c < 0x20) {
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += (char)c;
+    }
+  }
+  out += '"';
+}
+
+static void append_json_curve(std::string& out, const char *name, const std::vector<CurvePoint>& curve, const char *x_name, const char *y_name) {
+  out += '"';
+  out += name;
+  out += "\":[";
+  for (size_t i = 0; i < curve.size(); ++i) {
+    if (i > 0) {
+      out += ',';
+    }
+    // Same key order as the R points lists: y first
+    out += "{\"";
+    out += y_name;
+    out += "\":";
+    append_number(out, curve[i].y);
+    out += ",\"";
+    out += x_name;
+    out += "\":";
+    append_number(out, curve[i].x);
+    out += '}';
+  }
+  out += ']';
+}
+
+// {"metrics":{...},"supplementary":{...}}, as the evaluate scripts print it
+static void append_json(std::string& out, const Metrics& m, const std::string *name, bool roc_curve, bool pr_curve) {
+  out += "{\"metrics\":{";
+  if (name != NULL) {
+    out += "\"motif\":";
+    append_json_string(out, *name);
+    out += ',';
+  }
+  out += "\"roc_auc\":";
+  append_number(out, m.roc_auc);
+  out += ",\"pr_auc\":";
+  append_number(out, m.pr_auc);
+  out += ",\"pr_auc_davis_goadrich\":";
+  append_number(out, m.pr_auc_dg);
+  out += "},\"supplementary\":";
+  if (!roc_curve && !pr_curve) {
+    out += "[]";  // Empty R list
+  } else {
+    out += '{';
+    if (roc_curve) {
+      append_json_curve(out, "roc_curve", m.roc_curve, "fpr", "tpr");
+    }
+    if (pr_curve) {
+      if (roc_curve) {
+        out += ',';
+      }
+      append_json_curve(out, "pr_curve", m.pr_curve, "recall", "precision");
+    }
+    out += '}';
+  }
+  out += "}\n";
+}
+
+#endif
@@ -0,0 +1,272 @@
+/*
+
+  Encode a set of FASTA (or FASTQ) sequences into a packed sequence file
+  (pseq_file.h), that pwm_scoring, seqshuffle and pwm_server map instead of
+  parsing the sequences again; or check such a file.
+
+  The sections are built in memory, then hashed and written after the
+  header.
+
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "packed_seq.h"
+#include "fasta_reader.h"
+#include "pseq_file.h"
+
+typedef struct _options_t {
+  int help;
+  int nohdr;
+  int check;
+  double min_qual;           /* FASTQ mean quality filter (0 = off) */
+} options_t;
+
+static options_t options;
+
+/* Growing array of fixed-size items */
+typedef struct _array_t {
+  unsigned char *data;
+  size_t len;                /* Bytes used */
+  size_t size;
+} array_t;
+
+static void
+array_add(array_t *a, const void *items, size_t n)
+{
+  if (n == 0)
+    return;
+  if (a->len + n > a->size) {
+    size_t size = a->size > 0 ? a->size : 4096;
+    while (size < a->len + n)
+      size *= 2;
+    if ((a->data = realloc(a->data, size)) == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    a->size = size;
+  }
+  memcpy(a->data + a->len, items, n);
+  a->len += n;
+}
+
+typedef struct _sections_t {
+  pseq_header_t hdr;
+  array_t len, word_off, nrun_off, hdr_off, bits, nrun, text;
+} sections_t;
+
+static void
+sections_free(sections_t *s)
+{
+  free(s->len.data);
+  free(s->word_off.data);
+  free(s->nrun_off.data);
+  free(s->hdr_off.data);
+  free(s->bits.data);
+  free(s->nrun.data);
+  free(s->text.data);
+}
+
+static void
+add_record(sections_t *s, const seq_t *seq, const char *hdr, size_t hdr_len)
+{
+  uint32_t len = (uint32_t)seq->len;
+  uint64_t words = (uint64_t)(seq->len / SEQ_WORD_BASES + 2);
+  char nul = 0;
+
+  array_add(&s->len, &len, sizeof(len));
+  array_add(&s->bits, seq->bits, words * sizeof(uint64_t));
+  array_add(&s->nrun, seq->nrun, 2 * (size_t)seq->nrun_cnt * sizeof(int32_t));
+  s->hdr.count++;
+  s->hdr.bases += len;
+  s->hdr.words += words;
+  s->hdr.nruns += (uint64_t)seq->nrun_cnt;
+  array_add(&s->word_off, &s->hdr.words, sizeof(uint64_t));
+  array_add(&s->nrun_off, &s->hdr.nruns, sizeof(uint64_t));
+  if (s->hdr.flags & PSEQ_HEADERS) {
+    array_add(&s->text, hdr, hdr_len);
+    array_add(&s->text, &nul, 1);
+    s->hdr.hdr_bytes += hdr_len + 1;
+    array_add(&s->hdr_off, &s->hdr.hdr_bytes, sizeof(uint64_t));
+  }
+}
+
+/* Read all the records of a FASTA/FASTQ file (empty ones included, as
+   the readers skip them) */
+static int
+read_file(fasta_reader_t *input, const char *iFile, sections_t *s)
+{
+  seq_t seq;
+  uint64_t zero = 0;
+  int more;
+
+  seq_init(&seq);
+  array_add(&s->word_off, &zero, sizeof(zero));
+  array_add(&s->nrun_off, &zero, sizeof(zero));
+  if (s->hdr.flags & PSEQ_HEADERS)
+    array_add(&s->hdr_off, &zero, sizeof(zero));
+  while ((more = fasta_next(input)) > 0) {
+    size_t hdr_len = 0;
+    if (input->hdr == NULL)
+      continue;
+    if (input->seq_len > INT_MAX) {
+      fprintf(stderr, "Sequence too long in file %s\n", iFile);
+      more = -2;
+      break;
+    }
+    /* The header up to the first space, as the tools read it */
+    while (hdr_len < input->hdr_len && !isspace((unsigned char)input->hdr[hdr_len]))
+      hdr_len++;
+    seq_clear(&seq);
+    seq_reserve(&seq, (int)input->seq_len);
+    seq_append_text(&seq, input->seq, input->seq_len);
+    add_record(s, &seq, input->hdr, hdr_len);
+  }
+  if (more == -1)
+    fprintf(stderr, "Error reading file %s: %s\n", iFile, input->err);
+  seq_free(&seq);
+  return more == 0 ? 0 : -1;
+}
+
+static int
+write_file(const char *oFile, sections_t *s)
+{
+  static const unsigned char pad[8];
+  array_t *order[7] = {&s->len, &s->word_off, &s->nrun_off, &s->hdr_off, &s->bits, &s->nrun, &s->text};
+  FILE *f;
+  int k, ret = 0;
+
+  /* Sections padded to 8 bytes and hashed in file order */
+  s->hdr.hash = PSEQ_HASH_SEED;
+  for (k = 0; k < 7; k++) {
+    array_add(order[k], pad, (size_t)(PSEQ_PAD(order[k]->len) - order[k]->len));
+    s->hdr.hash = pseq_hash(s->hdr.hash, order[k]->data, order[k]->len);
+  }
+  if ((f = fopen(oFile, "wb")) == NULL) {
+    fprintf(stderr, "Unable to open '%s': %s(%d)\n", oFile, strerror(errno), errno);
+    return -1;
+  }
+  if (fwrite(&s->hdr, sizeof(pseq_header_t), 1, f) != 1)
+    ret = -1;
+  for (k = 0; k < 7 && ret == 0; k++) {
+    if (fwrite(order[k]->data, 1, order[k]->len, f) != order[k]->len)
+      ret = -1;
+  }
+  if (fclose(f) != 0)
+    ret = -1;
+  if (ret != 0)
+    fprintf(stderr, "Failed to write %s: %s\n", oFile, strerror(errno));
+  return ret;
+}
+
+/* Check the hash and every record of a packed file, and print a summary */
+static int
+check_file(const char *iFile)
+{
+  pseq_reader_t r;
+  seq_t view;
+  uint64_t hash;
+  int more;
+
+  if (pseq_open(&r, iFile) != 0) {
+    fprintf(stderr, "Unable to open '%s': %s\n", iFile, r.err);
+    return -1;
+  }
+  hash = pseq_hash(PSEQ_HASH_SEED, r.map + sizeof(pseq_header_t), r.map_size - sizeof(pseq_header_t));
+  if (hash != r.hdr.hash) {
+    fprintf(stderr, "Hash mismatch in %s: %016llx stored, %016llx computed\n", iFile,
+            (unsigned long long)r.hdr.hash, (unsigned long long)hash);
+    pseq_close(&r);
+    return -1;
+  }
+  while ((more = pseq_next(&r, &view)) > 0)
+    ;
+  if (more < 0) {
+    fprintf(stderr, "Error reading file %s: %s (record %llu)\n", iFile, r.err, (unsigned long long)r.next);
+    pseq_close(&r);
+    return -1;
+  }
+  printf("sequences\t%llu\nbases\t%llu\nn_runs\t%llu\nheaders\t%s\nhash\t%016llx\n",
+         (unsigned long long)r.hdr.count, (unsigned long long)r.hdr.bases, (unsigned long long)r.hdr.nruns,
+         (r.hdr.flags & PSEQ_HEADERS) ? "yes" : "no", (unsigned long long)r.hdr.hash);
+  pseq_close(&r);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  fasta_reader_t fasta_in;
+  sections_t s;
+  int ret;
+
+  while (1) {
+    int c = getopt(argc, argv, "chnQ:");
+    if (c == -1)
+      break;
+    switch (c) {
+    case 'c':
+      options.check = 1;
+      break;
+    case 'h':
+      options.help = 1;
+      break;
+    case 'n':
+      options.nohdr = 1;
+      break;
+    case 'Q':
+      options.min_qual = atof(optarg);
+      break;
+    case '?':
+      break;
+    default:
+      printf ("?? getopt returned character code 0%o ??\n", c);
+    }
+  }
+  if (options.help == 1 || argc - optind != (options.check ? 1 : 2)) {
+    fprintf(stderr,
+	    "Usage: %s [options] <fasta_file>|- <packed_file>\n"
+	    "       %s -c <packed_file>\n"
+	    "      where options are:\n"
+	    "        -c        Check a packed file (hash and records) and print a summary\n"
+	    "        -h        Show this help text\n"
+	    "        -n        Do not store the sequence headers\n"
+	    "        -Q <q>    FASTQ input: skip reads whose mean Phred quality is below <q>.\n"
+	    "\n\tEncode a set of FASTA (or FASTQ, possibly gzipped) sequences into a packed\n"
+	    "\tsequence file: 2-bit packed bases, N runs, an offset index and the headers.\n"
+	    "\tpwm_scoring, seqshuffle and pwm_server read it directly in place of the\n"
+	    "\tsequences, without parsing them.\n\n",
+	    argv[0], argv[0]);
+    return 1;
+  }
+  if (options.check)
+    return check_file(argv[optind]) == 0 ? 0 : 1;
+
+  if (fasta_open(&fasta_in, argv[optind]) != 0) {
+      fprintf(stderr, "Unable to open '%s': %s(%d)\n",
+          argv[optind], strerror(errno), errno);
+      exit(EXIT_FAILURE);
+  }
+  fasta_in.min_qual = options.min_qual;
+  memset(&s, 0, sizeof(s));
+  memcpy(s.hdr.magic, PSEQ_MAGIC, 8);
+  s.hdr.version = PSEQ_VERSION;
+  s.hdr.flags = options.nohdr ? 0 : PSEQ_HEADERS;
+  ret = read_file(&fasta_in, argv[optind], &s);
+  fasta_close(&fasta_in);
+  if (ret == 0 && s.hdr.count == 0) {
+    fprintf(stderr, "Could not find a sequence in file %s\n", argv[optind]);
+    ret = -1;
+  }
+  if (ret == 0)
+    ret = write_file(argv[optind + 1], &s);
+  sections_free(&s);
+  return ret == 0 ? 0 : 1;
+}
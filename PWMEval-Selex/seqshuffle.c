@@ -37,14 +37,22 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
+#include <getopt.h>
 #ifdef DEBUG
 #include <mcheck.h>
 #endif
 
-#define BUF_SIZE 3072
+#include "packed_seq.h"
+#include "fasta_reader.h"
+#include "pseq_file.h"
+#include "out_writer.h"
+#include "run_stats.h"
+
 #define NUCL  5
 #define LMAX  100
 #define HDR_MAX 132
+#define LINE_LEN 60    /* Bases per output line */
 
 typedef struct _options_t {
   int help;
@@ -52,22 +60,27 @@ typedef struct _options_t {
   int nohdr;
   int seed_flag;
   unsigned int seed;
+  double min_qual;           /* FASTQ mean quality filter (0 = off) */
 } options_t;
 
 static options_t options;
 
 static char nucleotide[] = {'A','C','G','T', 'N'};
 
-typedef struct _seq_t {
-  char *hdr;
-  int *seq;
-  int len;
-} seq_t, *seq_p_t;
-
-FILE *fasta_in;
+fasta_reader_t fasta_in;
+pseq_reader_t pseq_in;      /* Packed sequence file input, if mapped */
 
 int regLen = 0;
 
+int *codes;        /* Unpacked codes of a sequence containing N */
+int codes_size;
+char *text;        /* Shuffled sequence as text */
+int text_size;
+
+out_writer_t out;
+
+static run_stats_t stats;    /* --stats */
+
 //Arrange the n elements of ARRAY in random order.
 void 
 shuffle(int *array, int n)
@@ -84,112 +97,181 @@ shuffle(int *array, int n)
   }
 }
 
+//Same as shuffle(), on the n packed bases starting at position start.
+//The random draws are the same, so a given seed gives the same result.
+void
+shuffle_packed(uint64_t *bits, int start, int n)
+{
+  if (n > 1) {
+    for (int i = n-1; i > 0; i--) {
+      int j = rand() % (i+1);
+      int t = seq_get2(bits, start + i);
+      seq_set2(bits, start + i, seq_get2(bits, start + j));
+      seq_set2(bits, start + j, t);
+    }
+  }
+}
+
+//Shuffle positions [start, start+n) of the current sequence: packed in place,
+//or on its unpacked codes if it contains N (N runs do not move with the bases).
+static void
+shuffle_region(seq_p_t seq, int start, int n)
+{
+  if (seq->nrun_cnt == 0)
+    shuffle_packed(seq->bits, start, n);
+  else
+    shuffle(codes + start, n);
+}
+
+static char
+base_at(seq_p_t seq, int i)
+{
+  if (seq->nrun_cnt == 0)
+    return nucleotide[seq_get2(seq->bits, i)];
+  return nucleotide[codes[i]];
+}
+
+/* Write the shuffled sequence in FASTA format, LINE_LEN bases per line.
+   The sequence is decoded once, then copied line by line; a sequence whose
+   length is a multiple of LINE_LEN ends with an empty line. */
+static void
+write_seq(seq_p_t seq)
+{
+  int i;
+
+  if (seq->len > text_size) {
+    text_size = seq->len;
+    if ((text = realloc(text, (size_t)text_size)) == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+  }
+  if (seq->nrun_cnt == 0) {
+    seq_decode(seq, 0, seq->len, text);
+  } else {
+    for (i = 0; i < seq->len; i++)
+      text[i] = nucleotide[codes[i]];
+  }
+  out_char(&out, '>');
+  out_str(&out, seq->hdr);
+  out_write(&out, "_shu\n", 5);
+  for (i = 0; i + LINE_LEN <= seq->len; i += LINE_LEN) {
+    char *p = out_reserve(&out, LINE_LEN + 1);
+    memcpy(p, text + i, LINE_LEN);
+    p[LINE_LEN] = '\n';
+    out.len += LINE_LEN + 1;
+  }
+  out_write(&out, text + i, (size_t)(seq->len - i));
+  out_char(&out, '\n');
+}
+
+/* Read the next record of a packed sequence file (pseq_file.h), as
+   read_seq does; records without a stored header are named by their index.
+   The bases are copied out of the mapping, as they are shuffled in place */
 static int
-process_file(FILE *input, char *iFile)
+read_packed(pseq_reader_t *input, seq_p_t seq, const char *iFile)
 {
-  char buf[BUF_SIZE], *res;
-  seq_t seq;
-  int mLen;
+  seq_t rec;
+  int more;
 
-  if (input == NULL) {
-    FILE *f = fopen(iFile, "r");
-    if (f == NULL) {
-      fprintf(stderr, "Could not open file %s: %s(%d)\n",
-  	    iFile, strerror(errno), errno);
+  if ((more = pseq_next(input, &rec)) <= 0) {
+    if (more < 0)
+      fprintf(stderr, "Error reading file %s: %s\n", iFile, input->err);
+    return more;
+  }
+  if (rec.hdr == NULL) {
+    snprintf(seq->hdr, HDR_MAX, "%llu", (unsigned long long)(input->next - 1));
+  } else if (strlen(rec.hdr) >= HDR_MAX) {
+    fprintf(stderr, "Fasta Header too long \"%s\" in file %s\n", rec.hdr, iFile);
+    return -1;
+  } else {
+    strcpy(seq->hdr, rec.hdr);
+  }
+  pseq_copy(&rec, seq);
+  return 1;
+}
+
+/* Read the next sequence record.  Returns 1 if there is one, 0 at the end
+   of the input and -1 on error */
+static int
+read_seq(fasta_reader_t *input, seq_p_t seq, const char *iFile)
+{
+  const char *s, *end;
+  size_t i;
+  int more;
+
+  stats_phase(&stats, STATS_READ);
+  if (pseq_in.map != NULL) {
+    if ((more = read_packed(&pseq_in, seq, iFile)) > 0 && stats.enabled)
+      stats_record(&stats, seq->hdr, strnlen(seq->hdr, HDR_MAX), (unsigned long long)seq->len, (unsigned long long)seq_n_count(seq));
+    return more;
+  }
+  /* Skip the text before the first header */
+  while ((more = fasta_next(input)) > 0 && input->hdr == NULL)
+    ;
+  if (more <= 0) {
+    if (more < 0)
+      fprintf(stderr, "Error reading file %s: %s\n", iFile, input->err);
+    return more;
+  }
+  /* Get the header */
+  s = input->hdr;
+  end = input->hdr + input->hdr_len;
+  i = 0;
+  while (s < end && !isspace(*s)) {
+    if (i >= HDR_MAX) {
+      fprintf(stderr, "Fasta Header too long \"%.*s\" in file %s\n", (int)input->hdr_len, input->hdr, iFile);
       return -1;
     }
-    input = f;
+    seq->hdr[i++] = *s++;
+  }
+  if (i < HDR_MAX)
+    seq->hdr[i] = 0;
+  /* Gobble sequence  */ 
+  seq_clear(seq);
+  seq_reserve(seq, (int)input->seq_len);
+  seq_append_text(seq, input->seq, input->seq_len);
+  if (stats.enabled) {
+    stats.in_bytes += input->hdr_len + input->seq_len + input->qual_len;
+    stats_record(&stats, seq->hdr, i, (unsigned long long)seq->len, (unsigned long long)seq_n_count(seq));
   }
+  return 1;
+}
+
+static int
+process_file(fasta_reader_t *input, char *iFile)
+{
+  seq_t seq;
+  int more, ret = 0;
+
   if (options.debug != 0)
     fprintf(stderr, "Processing file %s\n", iFile);
-  while ((res = fgets(buf, BUF_SIZE, input)) != NULL
-	 && buf[0] != '>')
-    ;
-  if (res == NULL || buf[0] != '>') {
+  seq_init(&seq);
+  seq.hdr = malloc(HDR_MAX * sizeof(char));
+  if ((more = read_seq(input, &seq, iFile)) == 0) {
     fprintf(stderr, "Could not find a sequence in file %s\n", iFile);
-    if (input != stdin) {
-      fclose(input);
-    }
-    return -1;
+    ret = -1;
   }
-  seq.hdr = malloc(HDR_MAX * sizeof(char));
-  seq.seq = malloc(BUF_SIZE * sizeof(int));
-  mLen = BUF_SIZE;
-  while (res != NULL) {
-    /* Get the header */
-    if (buf[0] != '>') {
-      fprintf(stderr, "Could not find a sequence header in file %s\n", iFile);
-      if (input != stdin) {
-        fclose(input);
-      }
-      return -1;
-    }
-    char *s = buf;
-    s += 1;
-    int i = 0;
-    while (*s && !isspace(*s)) {
-      if (i >= HDR_MAX) {
-        fprintf(stderr, "Fasta Header too long \"%s\" in file %s\n", res, iFile);
-        fclose(input);
-        return -1;
-      }
-      seq.hdr[i++] = *s++;
-    }
-    if (i < HDR_MAX)
-      seq.hdr[i] = 0;
-    /* Gobble sequence  */ 
-    seq.len = 0;
-    while ((res = fgets(buf, BUF_SIZE, input)) != NULL && buf[0] != '>') {
-      char c;
-      int n;
-      s = buf;
-      while ((c = *s++) != 0) {
-	if (isalpha(c)) {
-	  c = (char) toupper(c);
-	  switch (c) {
-	  case 'A':
-            n = 0;
-            break;
-	  case 'C':
-            n = 1;
-            break;
-	  case 'G':
-            n = 2;
-            break;
-	  case 'T':
-            n = 3;
-            break;
-	  case 'N':
-            n = 4;
-	    break;
-	  default:
-            n = 4;
-	    ;
-	  }
-	  if (seq.len >= mLen) {
-	    mLen += BUF_SIZE;
-	    seq.seq = realloc(seq.seq, (size_t)mLen * sizeof(int));
-	  }
-	  seq.seq[seq.len++] = n;
-	}
-      }
-    }
+  for (; more > 0; more = read_seq(input, &seq, iFile)) {
     /* We now have the (not nul terminated) sequence.
        Process it. */
     if (seq.len != 0) {
-      if (regLen == 0) { // shuffle entire sequence
-        shuffle(seq.seq, seq.len);
-        // Print out shuffled sequence
-        // Print Sequence Header
-        printf(">%s_shu\n", seq.hdr);
-        int i = 0;
-        for (i = 0; i < seq.len; i++) {
-          printf("%c", nucleotide[seq.seq[i]]);
-          if ( ((i + 1) % 60) == 0 ) {
-            printf("\n");
+      stats_phase(&stats, STATS_PROCESS);
+      if (seq.nrun_cnt != 0) {
+        if (seq.len > codes_size) {
+          codes_size = seq.len;
+          if ((codes = realloc(codes, (size_t)codes_size * sizeof(int))) == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
           }
         }
-        printf("\n");
+        seq_unpack(&seq, 0, seq.len, codes);
+      }
+      if (regLen == 0) { // shuffle entire sequence
+        shuffle_region(&seq, 0, seq.len);
+        // Print out shuffled sequence
+        stats_phase(&stats, STATS_WRITE);
+        write_seq(&seq);
       } else { // regional shuffling
         int i = 0;
         int cnt = 1;
@@ -198,36 +280,36 @@ process_file(FILE *input, char *iFile)
           if (options.debug != 0) {
             fprintf(stderr, "%d shuffling piece : i=%d reg Len=%d   ", cnt, i, regLen);
             for (k = i; k < i + regLen; k++) {
-              fprintf(stderr, "%c", nucleotide[seq.seq[k]]);
+              fprintf(stderr, "%c", base_at(&seq, k));
             }
             fprintf(stderr, "\n");
             cnt++;
           }
-          shuffle(&seq.seq[i], regLen); // shuffle each region separately
+          shuffle_region(&seq, i, regLen); // shuffle each region separately
         }
         if ( i < (seq.len - 1) ) {
           int res = seq.len - i - 1;
           if (options.debug != 0) {
             fprintf(stderr, "Last piece: i=%d res=%d\n", i, res);
-            fprintf(stderr, "%c\n", nucleotide[seq.seq[i]]);
+            fprintf(stderr, "%c\n", base_at(&seq, i));
           }
-          shuffle(&seq.seq[i + 1], res);  // shuffle residual nucleotides
+          shuffle_region(&seq, i + 1, res);  // shuffle residual nucleotides
         }
         // Print out shuffled sequence
-        // Print Sequence Header
-        printf(">%s_shu\n", seq.hdr);
-        i = 0;
-        for (i = 0; i < seq.len; i++) {
-          printf("%c", nucleotide[seq.seq[i]]);
-          if ( ((i + 1) % 60) == 0 ) {
-            printf("\n");
-          }
-        }
-        printf("\n");
+        stats_phase(&stats, STATS_WRITE);
+        write_seq(&seq);
       }
     }
   }
-  return 0;
+  if (more < 0)
+    ret = -1;
+  free(seq.hdr);
+  seq_free(&seq);
+  free(codes);
+  free(text);
+  fasta_close(input);
+  pseq_close(&pseq_in);
+  return ret;
 }
 
 int
@@ -237,9 +319,17 @@ main(int argc, char *argv[])
   mcheck(NULL);
   mtrace();
 #endif
+  static struct option long_options[] =
+      {
+          {"stats",      optional_argument, 0, 1},
+          {"stats-file", required_argument, 0, 2},
+          {0, 0, 0, 0}
+      };
+
+  stats_start(&stats, "seqshuffle", "shuffle");
   options.seed_flag = 0;
   while (1) {
-    int c = getopt(argc, argv, "dhr:s:");
+    int c = getopt_long(argc, argv, "dhQ:r:s:", long_options, NULL);
     if (c == -1)
       break;
     switch (c) {
@@ -249,6 +339,9 @@ main(int argc, char *argv[])
     case 'h':
       options.help = 1;
       break;
+    case 'Q':
+      options.min_qual = atof(optarg);
+      break;
     case 'r':
       regLen = atoi(optarg);
       break;
@@ -256,6 +349,14 @@ main(int argc, char *argv[])
       options.seed = atoi(optarg);
       options.seed_flag = 1;
       break;
+    case 1:
+      if (stats_parse(&stats, optarg) != 0)
+        return 1;
+      break;
+    case 2:
+      stats.enabled = 1;
+      stats.path = optarg;
+      break;
     case '?':
       break;
     default:
@@ -268,10 +369,15 @@ main(int argc, char *argv[])
 	    "      where options are:\n"
 	    "        -d        Print debug information\n"
 	    "        -h        Show this help text\n"
+	    "        -Q <q>    FASTQ input: skip reads whose mean Phred quality is below <q>.\n"
 	    "        -r <len>  Shuffle sequence(s) in regions of <len>bp (by default <len>=0).\n"
 	    "        -s <seed> Set the seed (integer) for the pseudo-random number generator algorithm.\n"
 	    "                  By default, time(0) is used as seed.\n"
-	    "\n\tPerform regional shuffling on a set of FASTA-formatted sequences-\n"
+	    "        --stats[=text|json]  Report run statistics on stderr at the end (phase wall times, CPU\n"
+	    "                  time, records, bases, non-ACGT bases, longest record, bytes, throughput, peak RSS).\n"
+	    "        --stats-file <file>  Write them to <file> instead (implies --stats).\n"
+	    "\n\tPerform regional shuffling on a set of FASTA (or FASTQ) sequences-\n"
+            "\tThe input may also be a packed sequence file (seqpack).\n"
             "\tIf regional shuffling is not defined (option -r is not set), the entire\n"
             "\tsequence(s) is(are) shuffled.\n"
             "\tThe shuffled sequence(s) is(are) written to standard output.\n\n",
@@ -279,22 +385,18 @@ main(int argc, char *argv[])
     return 1;
   }
 
-  if (argc > optind) {
-      if(!strcmp(argv[optind],"-")) {
-          fasta_in = stdin;
-      } else {
-          fasta_in = fopen(argv[optind], "r");
-          if (fasta_in == NULL) {
-              fprintf(stderr, "Unable to open '%s': %s(%d)\n",
-                  argv[optind], strerror(errno), errno);
-             exit(EXIT_FAILURE);
-          }
-          if (options.debug)
-             fprintf(stderr, "Processing file %s\n", argv[optind]);
-      }
-  } else {
-      fasta_in = stdin;
+  if (argc > optind && pseq_probe(argv[optind])) {
+    if (pseq_open(&pseq_in, argv[optind]) != 0) {
+      fprintf(stderr, "Unable to open '%s': %s\n", argv[optind], pseq_in.err);
+      exit(EXIT_FAILURE);
+    }
+    stats.in_bytes = pseq_in.map_size;
+  } else if (fasta_open(&fasta_in, argc > optind ? argv[optind] : NULL) != 0) {
+      fprintf(stderr, "Unable to open '%s': %s(%d)\n",
+          argv[optind], strerror(errno), errno);
+      exit(EXIT_FAILURE);
   }
+  fasta_in.min_qual = options.min_qual;
 
   // Use a different seed value so that we don't get same 
   // result each time we run this program 
@@ -304,7 +406,9 @@ main(int argc, char *argv[])
     srand (time(NULL)); 
 
   if (options.debug != 0) {
-    if (fasta_in != stdin) {
+    if (pseq_in.map != NULL) {
+      fprintf(stderr, "Packed Sequence File : %s\n", argv[optind]);
+    } else if (fasta_in.stream != stdin) {
       fprintf(stderr, "Fasta Sequence File : %s\n", argv[optind]);
     } else {
       fprintf(stderr, "FASTA Sequence File from STDIN\n");
@@ -312,8 +416,14 @@ main(int argc, char *argv[])
     fprintf(stderr, "Regional Shuffling: %d\n", regLen);
   }
   
-  if (process_file(fasta_in, argv[optind++]) != 0)
+  out_init(&out, STDOUT_FILENO);
+  if (process_file(&fasta_in, argv[optind++]) != 0) {
+    out_close(&out);
     return 1;
+  }
+  stats_phase(&stats, STATS_WRITE);
+  out_close(&out);
+  stats.out_bytes = out.written;
 
-  return 0;
+  return stats_report(&stats) == 0 ? 0 : 1;
 }